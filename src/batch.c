@@ -0,0 +1,175 @@
+#include "batch.h"
+
+#include "clock.h"
+#include "controller.h"
+#include "nes.h"
+
+#include <stdlib.h>
+#include <threads.h>
+
+/* Batch runner
+ * Jobs are split into one contiguous queue per worker. A worker runs its own queue from the front
+ * and, once it is empty, steals single jobs from the back of the other queues. Every job powers on
+ * its own nes_t, so workers share nothing but the queues.
+ */
+
+typedef struct {
+    mtx_t lock;
+    size_t head; // Next job the owner runs
+    size_t tail; // One past the last job, stolen from
+} batch_queue_t;
+
+typedef struct {
+    nes_batch_job_t* jobs;
+    batch_queue_t* queues;
+    unsigned workers;
+} batch_t;
+
+typedef struct {
+    batch_t* batch;
+    unsigned id;
+    thrd_t thread;
+    size_t stolen;
+} batch_worker_t;
+
+static u64 hash(u8 const* data, size_t size) {
+    u64 h = 0xCBF29CE484222325;
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ data[i]) * 0x100000001B3;
+    }
+    return h;
+}
+
+static void run_job(nes_batch_job_t* job) {
+    job->ok = false;
+    job->cycles = job->instructions = 0;
+    job->seconds = 0;
+
+    nes_t* nes = malloc(sizeof(nes_t));
+    if (!nes) return;
+    if (!nes_init(nes, job->rom)) {
+        free(nes);
+        return;
+    }
+
+    double start = clock_now();
+    for (u32 frame = 0; frame < job->frames; frame++) {
+        u8 buttons = job->input && frame < job->input_size ? job->input[frame] : 0;
+        controller_set(nes, 0, buttons);
+        // Only the last frame is hashed
+        job->cycles += frame + 1 < job->frames ? nes_skip_frame(nes) : nes_run_frame(nes);
+    }
+    job->seconds = clock_now() - start;
+    job->instructions = nes->cpu.instructions;
+    job->ram_hash = hash(nes->memory.ram, sizeof(nes->memory.ram));
+    job->frame_hash = hash(nes->ppu.GRAM, sizeof(nes->ppu.GRAM));
+    job->ok = true;
+
+    nes_free(nes);
+    free(nes);
+}
+
+static bool queue_pop(batch_queue_t* queue, size_t* job) {
+    mtx_lock(&queue->lock);
+    bool found = queue->head < queue->tail;
+    if (found) *job = queue->head++;
+    mtx_unlock(&queue->lock);
+    return found;
+}
+
+static bool queue_steal(batch_queue_t* queue, size_t* job) {
+    mtx_lock(&queue->lock);
+    bool found = queue->head < queue->tail;
+    if (found) *job = --queue->tail;
+    mtx_unlock(&queue->lock);
+    return found;
+}
+
+static int worker_main(void* arg) {
+    batch_worker_t* worker = arg;
+    batch_t* batch = worker->batch;
+    size_t job;
+
+    for (;;) {
+        if (!queue_pop(&batch->queues[worker->id], &job)) {
+            // Jobs are never added, so all queues being empty means the batch is done
+            bool found = false;
+            for (unsigned i = 1; i < batch->workers && !found; i++) {
+                found = queue_steal(&batch->queues[(worker->id + i) % batch->workers], &job);
+            }
+            if (!found) return 0;
+            worker->stolen++;
+        }
+        batch->jobs[job].worker = worker->id;
+        run_job(&batch->jobs[job]);
+    }
+}
+
+// Runs every job on a pool of workers threads, the calling thread being the first of them.
+// Returns false if the pool could not be set up, in which case no job has run.
+bool nes_batch_run(
+  nes_batch_job_t* jobs, size_t count, unsigned workers, nes_batch_stats_t* stats) {
+    if (workers < 1) workers = 1;
+    if (workers > count && count) workers = count;
+
+    batch_queue_t* queues = calloc(workers, sizeof(batch_queue_t));
+    batch_worker_t* pool = calloc(workers, sizeof(batch_worker_t));
+    if (!queues || !pool) {
+        free(queues);
+        free(pool);
+        return false;
+    }
+    batch_t batch = { jobs, queues, workers };
+
+    unsigned locks = 0;
+    size_t per_worker = (count + workers - 1) / workers;
+    for (; locks < workers; locks++) {
+        if (mtx_init(&queues[locks].lock, mtx_plain) != thrd_success) break;
+        queues[locks].head = locks * per_worker < count ? locks * per_worker : count;
+        size_t tail = queues[locks].head + per_worker;
+        queues[locks].tail = tail < count ? tail : count;
+        pool[locks].batch = &batch;
+        pool[locks].id = locks;
+    }
+
+    bool ok = locks == workers;
+    unsigned started = 1;
+    double start = clock_now();
+    if (ok) {
+        for (; started < workers; started++) {
+            if (thrd_create(&pool[started].thread, worker_main, &pool[started]) != thrd_success) {
+                break;
+            }
+        }
+        // Jobs of workers that failed to start are stolen by the others
+        worker_main(&pool[0]);
+        for (unsigned i = 1; i < started; i++) {
+            thrd_join(pool[i].thread, NULL);
+        }
+    }
+
+    if (ok && stats) {
+        stats->seconds = clock_now() - start;
+        stats->frames = stats->cycles = stats->instructions = 0;
+        stats->failed = stats->stolen = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (!jobs[i].ok) {
+                stats->failed++;
+                continue;
+            }
+            stats->frames += jobs[i].frames;
+            stats->cycles += jobs[i].cycles;
+            stats->instructions += jobs[i].instructions;
+        }
+        for (unsigned i = 0; i < workers; i++) {
+            stats->stolen += pool[i].stolen;
+        }
+    }
+
+    for (unsigned i = 0; i < locks; i++) {
+        mtx_destroy(&queues[i].lock);
+    }
+    free(queues);
+    free(pool);
+    return ok;
+}
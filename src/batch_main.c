@@ -0,0 +1,213 @@
+#include "batch.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+/* Batch runner front end
+ * Every line of the job list is "rom frames [script]", blank lines and lines starting with # are
+ * skipped. A script holds the controller 1 buttons of each frame as whitespace separated hex bytes,
+ * a byte may be followed by *count to hold it for several frames.
+ *
+ * Usage: nes_batch jobs [-j workers]
+ */
+
+#define MAX_LINE 1024
+
+typedef struct {
+    nes_batch_job_t* jobs;
+    size_t count;
+    size_t capacity;
+} job_list_t;
+
+static unsigned default_workers(void) {
+#if defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > 0) return (unsigned)n;
+#endif
+    return 1;
+}
+
+static bool load_script(char const* path, u8** input, size_t* size) {
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+
+    size_t capacity = 0;
+    *input = NULL;
+    *size = 0;
+
+    bool ok = true;
+    char token[32];
+    while (ok && fscanf(f, "%31s", token) == 1) {
+        char* end;
+        unsigned long buttons = strtoul(token, &end, 16);
+        unsigned long count = 1;
+        if (*end == '*') count = strtoul(end + 1, &end, 10);
+        if (*end || end == token || buttons > 0xFF) {
+            ok = false;
+            break;
+        }
+        if (*size + count > capacity) {
+            capacity = (*size + count) * 2;
+            u8* grown = realloc(*input, capacity);
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            *input = grown;
+        }
+        memset(*input + *size, (int)buttons, count);
+        *size += count;
+    }
+
+    fclose(f);
+    if (!ok) {
+        free(*input);
+        *input = NULL;
+    }
+    return ok;
+}
+
+static bool add_job(job_list_t* list, char const* rom, u32 frames, char const* script) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 16;
+        nes_batch_job_t* grown = realloc(list->jobs, capacity * sizeof(nes_batch_job_t));
+        if (!grown) return false;
+        list->jobs = grown;
+        list->capacity = capacity;
+    }
+
+    nes_batch_job_t* job = &list->jobs[list->count];
+    memset(job, 0, sizeof(nes_batch_job_t));
+    job->frames = frames;
+    job->rom = malloc(strlen(rom) + 1);
+    if (!job->rom) return false;
+    strcpy((char*)job->rom, rom);
+    if (script && !load_script(script, (u8**)&job->input, &job->input_size)) {
+        fprintf(stderr, "Failed to read script %s\n", script);
+        free((char*)job->rom);
+        return false;
+    }
+    list->count++;
+    return true;
+}
+
+static bool load_jobs(char const* path, job_list_t* list) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+
+    bool ok = true;
+    char line[MAX_LINE];
+    for (int n = 1; ok && fgets(line, sizeof(line), f); n++) {
+        char rom[MAX_LINE], script[MAX_LINE];
+        unsigned long frames;
+        char const* start = line;
+        while (isspace((unsigned char)*start)) start++;
+        if (!*start || *start == '#') continue;
+
+        int fields = sscanf(start, "%s %lu %s", rom, &frames, script);
+        if (fields < 2) {
+            fprintf(stderr, "%s:%d: expected \"rom frames [script]\"\n", path, n);
+            ok = false;
+            break;
+        }
+        ok = add_job(list, rom, (u32)frames, fields == 3 ? script : NULL);
+    }
+
+    fclose(f);
+    return ok;
+}
+
+static void free_jobs(job_list_t* list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free((char*)list->jobs[i].rom);
+        free((u8*)list->jobs[i].input);
+    }
+    free(list->jobs);
+}
+
+int main(int argc, char** argv) {
+    char const* path = NULL;
+    unsigned workers = default_workers();
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            workers = (unsigned)atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "Usage: %s jobs [-j workers]\n", argv[0]);
+        return 1;
+    }
+
+    job_list_t list = { 0 };
+    if (!load_jobs(path, &list) || !list.count) {
+        if (!list.count) fprintf(stderr, "Nothing to run\n");
+        free_jobs(&list);
+        return 1;
+    }
+
+    nes_batch_stats_t stats;
+    if (workers > list.count) workers = list.count;
+    if (!nes_batch_run(list.jobs, list.count, workers, &stats)) {
+        fprintf(stderr, "Failed to start the workers\n");
+        free_jobs(&list);
+        return 1;
+    }
+
+    printf(
+      "%-4s %-6s %8s %16s %16s %10s %10s  %s\n",
+      "job",
+      "worker",
+      "frames",
+      "ram hash",
+      "frame hash",
+      "frames/s",
+      "M instr/s",
+      "rom");
+    for (size_t i = 0; i < list.count; i++) {
+        nes_batch_job_t const* job = &list.jobs[i];
+        if (!job->ok) {
+            printf("%-4zu %-6s %8s %16s  %s\n", i, "-", "-", "failed", job->rom);
+            continue;
+        }
+        printf(
+          "%-4zu %-6u %8lu %016llx %016llx %10.1f %10.2f  %s\n",
+          i,
+          job->worker,
+          (unsigned long)job->frames,
+          (unsigned long long)job->ram_hash,
+          (unsigned long long)job->frame_hash,
+          job->frames / job->seconds,
+          job->instructions / job->seconds / 1e6,
+          job->rom);
+    }
+    printf(
+      "%zu jobs on %u workers, %zu stolen, %zu failed: %.3f s, %.1f frames/s, %.2f M instr/s, "
+      "%.2f M cycles/s\n",
+      list.count,
+      workers,
+      stats.stolen,
+      stats.failed,
+      stats.seconds,
+      stats.frames / stats.seconds,
+      stats.instructions / stats.seconds / 1e6,
+      stats.cycles / stats.seconds / 1e6);
+
+    int status = stats.failed ? 1 : 0;
+    free_jobs(&list);
+    return status;
+}
@@ -0,0 +1,417 @@
+#include "clock.h"
+#include "controller.h"
+#include "nes.h"
+#include "netplay.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "savestate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Headless throughput benchmark
+ * Every iteration powers on a fresh machine, runs the warm-up frames untimed and then times a
+ * fixed number of frames or cycles, so iterations are repeatable and comparable between builds.
+ * The frames are then timed again without drawing them. Saving, loading, forking and updating a
+ * state of the warmed-up machine is timed last, then capturing every frame into the rewind ring and
+ * stepping back through it one frame at a time, and running frames with up to RUNAHEAD_MAX frames
+ * of run-ahead. Last, two netplay sessions are run over a loopback with latency and jitter, timing
+ * the frames run again after wrong predictions.
+ *
+ * Usage: nes_bench [rom] [-f frames] [-c cycles] [-w warm-up frames] [-i iterations]
+ * A cycle count only applies to the first timing, every other section works in whole frames and
+ * runs the given number of frames.
+ */
+
+#define DEFAULT_ROM "test/nestest.nes"
+#define DEFAULT_FRAMES 600
+#define DEFAULT_WARMUP 60
+#define DEFAULT_ITERATIONS 5
+#define STATE_ITERATIONS 10000
+#define STATE_FRAMES 600
+#define REWIND_CAPACITY 0x1000000   // Ring size in bytes
+#define REWIND_INTERVAL 60          // Captures per keyframe
+#define REWIND_FPS 60               // Frames per second of rewind
+#define RUNAHEAD_MAX 3              // Most frames run ahead
+#define NETPLAY_LATENCY 4           // Frames every packet takes
+#define NETPLAY_JITTER 3            // Most frames added to the latency
+#define FRAME_SECONDS (1 / 60.0988) // NTSC frame
+
+typedef struct {
+    double seconds;
+    u64 instructions;
+    u64 cycles;
+    u64 frames;
+} result_t;
+
+static bool run(
+  char const* rom, u64 frames, u64 cycles, u64 warmup, bool skip, result_t* result) {
+    nes_t* nes = malloc(sizeof(nes_t));
+    if (!nes || !nes_init(nes, rom)) {
+        free(nes);
+        return false;
+    }
+    for (u64 i = 0; i < warmup; i++) {
+        nes_run_frame(nes);
+    }
+
+    u64 instructions = nes->cpu.instructions;
+    u64 frame = nes->ppu.frame;
+    double start = clock_now();
+    if (cycles) {
+        result->cycles = nes_run_cycles(nes, cycles);
+    } else {
+        result->cycles = 0;
+        for (u64 i = 0; i < frames; i++) {
+            result->cycles += skip ? nes_skip_frame(nes) : nes_run_frame(nes);
+        }
+    }
+    result->seconds = clock_now() - start;
+    result->instructions = nes->cpu.instructions - instructions;
+    result->frames = nes->ppu.frame - frame;
+
+    nes_free(nes);
+    free(nes);
+    return true;
+}
+
+// Times saving and loading the state of a machine after the warm-up frames
+static bool run_state(char const* rom, u64 warmup) {
+    nes_t* nes = malloc(sizeof(nes_t));
+    if (!nes || !nes_init(nes, rom)) {
+        free(nes);
+        return false;
+    }
+    for (u64 i = 0; i < warmup; i++) {
+        nes_run_frame(nes);
+    }
+    size_t size = nes_state_size(nes);
+    u8* state = malloc(size);
+    bool ok = state != NULL;
+
+    double save = clock_now();
+    for (int i = 0; ok && i < STATE_ITERATIONS; i++) {
+        ok = nes_state_save(nes, state, size) == size;
+    }
+    save = clock_now() - save;
+    double load = clock_now();
+    for (int i = 0; ok && i < STATE_ITERATIONS; i++) {
+        ok = nes_state_load(nes, state, size);
+    }
+    load = clock_now() - load;
+    if (ok) {
+        printf(
+          "state  %zu bytes, save %.2f us, load %.2f us\n",
+          size,
+          save * 1e6 / STATE_ITERATIONS,
+          load * 1e6 / STATE_ITERATIONS);
+    }
+
+    // Forking stands in for saving into a new console and loading the state there
+    nes_t* fork = malloc(sizeof(nes_t));
+    ok = ok && fork;
+    double forked = clock_now();
+    for (int i = 0; ok && i < STATE_ITERATIONS; i++) {
+        nes_fork(fork, nes);
+        nes_free(fork);
+    }
+    forked = clock_now() - forked;
+    if (ok) {
+        printf(
+          "state  fork and free %.2f us, save and load %.2f us\n",
+          forked * 1e6 / STATE_ITERATIONS,
+          (save + load) * 1e6 / STATE_ITERATIONS);
+    }
+    free(fork);
+
+    // Checkpoints after every frame, alternating between saving a copy and updating in place
+    u8* copy = malloc(size);
+    ok = ok && copy && nes_state_update(nes, state, size) == size;
+    save = 0;
+    double update = 0;
+    u64 dirty = 0;
+    for (int i = 0; ok && i < STATE_FRAMES; i++) {
+        nes_run_frame(nes);
+        double start = clock_now();
+        if (i % 2) {
+            ok = nes_state_save(nes, copy, size) == size;
+            save += clock_now() - start;
+        } else {
+#ifdef NES_DIRTY_PAGES
+            for (size_t j = 0; j < NES_DIRTY_COUNT; j++) {
+                dirty += nes->dirty.map[j];
+            }
+            start = clock_now();
+#endif
+            ok = nes_state_update(nes, state, size) == size;
+            update += clock_now() - start;
+        }
+    }
+    if (ok) {
+        printf(
+          "state  after a frame, save %.2f us, update %.2f us copying %.0f memory bytes\n",
+          save * 2e6 / STATE_FRAMES,
+          update * 2e6 / STATE_FRAMES,
+          (double)dirty * NES_DIRTY_BLOCK_SIZE * 2 / STATE_FRAMES);
+    }
+    free(copy);
+
+    free(state);
+    nes_free(nes);
+    free(nes);
+    return ok;
+}
+
+// Captures the given number of frames into a rewind ring, then steps back through them from the
+// newest to the oldest
+static bool run_rewind(char const* rom, u64 frames, u64 warmup) {
+    nes_t* nes = malloc(sizeof(nes_t));
+    if (!nes || !nes_init(nes, rom)) {
+        free(nes);
+        return false;
+    }
+    for (u64 i = 0; i < warmup; i++) {
+        nes_run_frame(nes);
+    }
+    nes_rewind_t rw;
+    if (!nes_rewind_init(&rw, nes, REWIND_CAPACITY, frames, REWIND_INTERVAL)) {
+        nes_free(nes);
+        free(nes);
+        return false;
+    }
+
+    double capture = 0;
+    bool ok = true;
+    for (u64 i = 0; ok && i < frames; i++) {
+        nes_run_frame(nes);
+        double start = clock_now();
+        ok = nes_rewind_capture(&rw, nes);
+        capture += clock_now() - start;
+    }
+    size_t captures = rw.count;
+    size_t used = rw.used;
+
+    double restore = 0;
+    double slowest = 0;
+    for (size_t i = 0; ok && i < captures; i++) {
+        double start = clock_now();
+        ok = nes_rewind_restore(&rw, nes, i ? 1 : 0);
+        double latency = clock_now() - start;
+        restore += latency;
+        if (latency > slowest) slowest = latency;
+    }
+    if (ok && captures) {
+        printf(
+          "rewind %zu frames, %.1f kB per second, capture %.2f us, restore %.2f us (max %.2f us)\n",
+          captures,
+          (double)used / captures * REWIND_FPS / 1e3,
+          capture * 1e6 / captures,
+          restore * 1e6 / captures,
+          slowest * 1e6);
+    }
+
+    nes_rewind_free(&rw);
+    nes_free(nes);
+    free(nes);
+    return ok;
+}
+
+// Times frames with every run-ahead up to RUNAHEAD_MAX frames, the host cost of a frame grows with
+// the frames run ahead
+static bool run_runahead(char const* rom, u64 frames, u64 warmup) {
+    nes_t* nes = malloc(sizeof(nes_t));
+    if (!nes || !nes_init(nes, rom)) {
+        free(nes);
+        return false;
+    }
+    for (u64 i = 0; i < warmup; i++) {
+        nes_run_frame(nes);
+    }
+
+    bool ok = true;
+    for (u32 ahead = 1; ok && ahead <= RUNAHEAD_MAX; ahead++) {
+        nes_runahead_t ra;
+        ok = nes_runahead_init(&ra, nes, ahead);
+        double slowest = 0;
+        for (u64 i = 0; ok && i < frames; i++) {
+            ok = nes_runahead_frame(&ra, nes);
+            if (ra.frame_seconds > slowest) slowest = ra.frame_seconds;
+        }
+        if (ok && ra.count) {
+            printf(
+              "ahead  %u frames, %.0f us per frame (max %.0f us), %.0f us running ahead\n",
+              ahead,
+              ra.total_seconds * 1e6 / ra.count,
+              slowest * 1e6,
+              ra.total_ahead * 1e6 / ra.count);
+        }
+        nes_runahead_free(&ra);
+    }
+
+    nes_free(nes);
+    free(nes);
+    return ok;
+}
+
+// Runs two sessions of the ROM against each other, with the buttons of both players changing every
+// few frames, and reports how many frames run again after a wrong prediction fit in a frame
+static bool run_netplay(char const* rom, u64 frames, u64 warmup) {
+    nes_t* nes = malloc(2 * sizeof(nes_t));
+    nes_loopback_t* lb = malloc(sizeof(nes_loopback_t));
+    if (!nes || !lb || !nes_init(&nes[0], rom)) {
+        free(nes);
+        free(lb);
+        return false;
+    }
+    if (!nes_init(&nes[1], rom)) {
+        nes_free(&nes[0]);
+        free(nes);
+        free(lb);
+        return false;
+    }
+    for (u64 i = 0; i < warmup; i++) {
+        nes_run_frame(&nes[0]);
+        nes_run_frame(&nes[1]);
+    }
+    nes_netplay_t np[2];
+    nes_loopback_init(lb, NETPLAY_LATENCY, NETPLAY_JITTER, 1);
+    bool ok = nes_netplay_init(&np[0], &nes[0], nes_loopback_transport(lb, 0), 0);
+    ok = nes_netplay_init(&np[1], &nes[1], nes_loopback_transport(lb, 1), 1) && ok;
+
+    u32 seed = 1;
+    u8 buttons[2] = { 0 };
+    while (ok && (np[0].frame < frames || np[1].frame < frames)) {
+        for (int i = 0; i < 2; i++) {
+            seed = seed * 1103515245 + 12345;
+            if (seed >> 28 == 0) buttons[i] = seed >> 16;
+            if (np[i].frame >= frames) continue;
+            if (nes_netplay_frame(&np[i], buttons[i]) == NES_NETPLAY_FAILED) ok = false;
+        }
+        nes_loopback_tick(lb);
+    }
+    if (ok && np[0].replayed) {
+        double replay = np[0].replay_seconds / np[0].replayed;
+        printf(
+          "netplay %llu frames, %llu rollbacks of %.1f frames (max %u), %.0f us per frame run "
+          "again (max rollback %.0f us), %.1f fit in a frame\n",
+          (unsigned long long)np[0].frame,
+          (unsigned long long)np[0].rollbacks,
+          (double)np[0].replayed / np[0].rollbacks,
+          np[0].max_replayed,
+          replay * 1e6,
+          np[0].max_replay_seconds * 1e6,
+          FRAME_SECONDS / replay);
+    }
+
+    nes_netplay_free(&np[0]);
+    nes_netplay_free(&np[1]);
+    nes_free(&nes[0]);
+    nes_free(&nes[1]);
+    free(lb);
+    free(nes);
+    return ok;
+}
+
+static void print(char const* label, result_t const* r) {
+    printf(
+      "%-6s %12.1f %12.2f %12.2f %12.0f\n",
+      label,
+      r->frames / r->seconds,
+      r->instructions / r->seconds / 1e6,
+      r->cycles / r->seconds / 1e6,
+      r->frames ? r->seconds * 1e9 / r->frames : 0.0);
+}
+
+static int compare_seconds(void const* a, void const* b) {
+    double sa = ((result_t const*)a)->seconds;
+    double sb = ((result_t const*)b)->seconds;
+    return (sa > sb) - (sa < sb);
+}
+
+int main(int argc, char** argv) {
+    char const* rom = DEFAULT_ROM;
+    u64 frames = DEFAULT_FRAMES;
+    u64 cycles = 0;
+    u64 warmup = DEFAULT_WARMUP;
+    int iterations = DEFAULT_ITERATIONS;
+
+    for (int i = 1; i < argc; i++) {
+        char const* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (argv[i][0] != '-') {
+            rom = argv[i];
+            continue;
+        }
+        if (!value || strlen(argv[i]) != 2) {
+            fprintf(
+              stderr,
+              "Usage: %s [rom] [-f frames] [-c cycles] [-w warm-up] [-i iterations]\n"
+              "  -c times the first section by cycles, the others always run -f frames\n",
+              argv[0]);
+            return 1;
+        }
+        switch (argv[i++][1]) {
+            case 'f':
+                frames = strtoull(value, NULL, 0);
+                break;
+            case 'c':
+                cycles = strtoull(value, NULL, 0);
+                break;
+            case 'w':
+                warmup = strtoull(value, NULL, 0);
+                break;
+            case 'i':
+                iterations = atoi(value);
+                break;
+            default:
+                fprintf(stderr, "Unknown option %s\n", argv[i - 1]);
+                return 1;
+        }
+    }
+    if (iterations < 1 || (!cycles && !frames)) {
+        fprintf(stderr, "Nothing to run\n");
+        return 1;
+    }
+
+    result_t* results = malloc(iterations * sizeof(result_t));
+    if (!results) return 1;
+
+    if (cycles) {
+        printf("%s: %llu cycles", rom, (unsigned long long)cycles);
+    } else {
+        printf("%s: %llu frames", rom, (unsigned long long)frames);
+    }
+    printf(" x %d iterations, %llu warm-up frames\n", iterations, (unsigned long long)warmup);
+    printf("%-6s %12s %12s %12s %12s\n", "", "frames/s", "M instr/s", "M cycles/s", "ns/frame");
+
+    for (int i = 0; i < iterations; i++) {
+        if (!run(rom, frames, cycles, warmup, false, &results[i])) {
+            fprintf(stderr, "Failed to load %s\n", rom);
+            free(results);
+            return 1;
+        }
+        char label[16];
+        snprintf(label, sizeof(label), "#%d", i + 1);
+        print(label, &results[i]);
+    }
+
+    qsort(results, iterations, sizeof(result_t), compare_seconds);
+    print("best", &results[0]);
+    print("median", &results[iterations / 2]);
+    if (frames) {
+        for (int i = 0; i < iterations; i++) {
+            run(rom, frames, 0, warmup, true, &results[i]);
+        }
+        qsort(results, iterations, sizeof(result_t), compare_seconds);
+        print("skip", &results[0]);
+    }
+    run_state(rom, warmup);
+    if (frames) run_rewind(rom, frames, warmup);
+    if (frames) run_runahead(rom, frames, warmup);
+    // A rollback that cannot load its state leaves the sessions out of sync
+    bool ok = !frames || run_netplay(rom, frames, warmup);
+    if (!ok) fprintf(stderr, "Netplay failed\n");
+
+    free(results);
+    return ok ? 0 : 1;
+}
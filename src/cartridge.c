@@ -3,14 +3,101 @@
 #include "bitmask.h"
 #include "log.h"
 #include "mappers/mapper0.h"
+#include "memory.h"
 #include "nes.h"
 #include "ppu.h"
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef __STDC_NO_ATOMICS__
+#include <stdatomic.h>
+#endif
 
-cartridge_result_t cartridge_init(nes_t* nes, char const* filename) {
+/* Shared cartridge memory
+ * The ROM, PRG-RAM and CHR-RAM are reference counted so that forked consoles can share them. The
+ * ROM is never written. PRG-RAM and CHR-RAM are shared until either console writes to them: PRG-RAM
+ * pages are mapped read-only while shared so that CPU writes come here through the I/O path, and
+ * CHR-RAM is only written here. The first write copies the memory, or only takes it back once the
+ * other consoles have released it.
+ */
+
+typedef union {
+#ifndef __STDC_NO_ATOMICS__
+    atomic_uint refs;
+#else
+    unsigned refs; // Forks sharing memory are only safe on one thread without atomics
+#endif
+    max_align_t align;
+} shared_t;
+
+static shared_t* shared_header(u8 const* data) {
+    return (shared_t*)data - 1;
+}
+
+static u8* shared_alloc(size_t size) {
+    shared_t* shared = calloc(1, sizeof(shared_t) + size);
+    if (!shared) return NULL;
+    shared->refs = 1;
+    return (u8*)(shared + 1);
+}
+
+static u8* shared_ref(u8* data) {
+    if (data) shared_header(data)->refs++;
+    return data;
+}
+
+static void shared_release(u8* data) {
+    if (data && --shared_header(data)->refs == 0) free(shared_header(data));
+}
+
+static bool shared_unique(u8 const* data) {
+    return shared_header(data)->refs == 1;
+}
+
+// Gives the console its own copy of memory it shares, returns false if memory is missing
+static bool shared_own(u8** data, size_t size) {
+    if (!*data || shared_unique(*data)) return true;
+    u8* copy = shared_alloc(size);
+    if (!copy) return false;
+    memcpy(copy, *data, size);
+    shared_release(*data);
+    *data = copy;
+    return true;
+}
+
+/* Decoded tiles
+ * Every row of every tile is kept as its 8 pixels, one 2-bit palette index per byte from left to
+ * right, followed by the same row flipped, so that the renderer copies rows instead of extracting
+ * bits. CHR-ROM is decoded once at load. CHR-RAM rows are decoded again as they are written, and
+ * forks copy the decoded tiles together with CHR-RAM.
+ */
+
+#define TILE_ROW_SIZE 16
+
+static size_t chr_size(nes_t const* nes) {
+    return nes->cartridge.config.chr_size * NES_CHR_DATA_UNIT_SIZE;
+}
+
+// Every 16 bytes of CHR, a tile of 8 rows, decodes to 8 rows of TILE_ROW_SIZE
+static size_t tiles_size(nes_t const* nes) {
+    return chr_size(nes) / 2 * TILE_ROW_SIZE;
+}
+
+// Decodes the tile row whose low bitplane is at the given CHR offset
+static void decode_row(nes_t* nes, u32 offset) {
+    u8 low = nes->cartridge.chr[offset];
+    u8 high = nes->cartridge.chr[offset + 8];
+    u8* row = nes->cartridge.tiles + ((offset >> 4) * 8 + (offset & 7)) * TILE_ROW_SIZE;
+    for (int i = 0; i < 8; i++) {
+        u8 pixel = (NTH_BIT(high, 7 - i) << 1) | NTH_BIT(low, 7 - i);
+        row[i] = pixel;
+        row[TILE_ROW_SIZE - 1 - i] = pixel;
+    }
+}
+
+static cartridge_result_t load(nes_t* nes, char const* filename) {
     // Load ROM into memory
     FILE* rom_file = fopen(filename, "rb");
     if (!rom_file) {
@@ -18,10 +105,13 @@ cartridge_result_t cartridge_init(nes_t* nes, char const* filename) {
     }
     fseek(rom_file, 0L, SEEK_END);
     size_t rom_size = ftell(rom_file);
-    nes->cartridge.rom = malloc(rom_size * sizeof(u8));
+    nes->cartridge.rom = shared_alloc(rom_size * sizeof(u8));
     rewind(rom_file);
-    fread(nes->cartridge.rom, 1, rom_size, rom_file);
+    bool read = nes->cartridge.rom && fread(nes->cartridge.rom, 1, rom_size, rom_file) == rom_size;
     fclose(rom_file);
+    if (!read || rom_size < NES_HEADER_SIZE) {
+        return CARTRIDGE_INVALID;
+    }
 
     /* Header - 16 bytes */
     // 4 byte magic number
@@ -36,15 +126,14 @@ cartridge_result_t cartridge_init(nes_t* nes, char const* filename) {
     // CHR-ROM in 8 kb blocks
     if (nes->cartridge.rom[5]) {
         nes->cartridge.config.chr_size = nes->cartridge.rom[5];
+        nes->cartridge.config.has_chr_ram = false;
     } else {
         nes->cartridge.config.chr_size = 1;
         nes->cartridge.config.has_chr_ram = true;
     }
     // Flags 6
     // PPU nametable mirroring style
-    // TODO
-    // nes->cartridge.config.mirroring = NTH_BIT(nes->cartridge.rom[6], 0);
-    // ppu_set_mirror(nes->cartridge.config.mirroring);
+    ppu_set_mirror(nes, NTH_BIT(nes->cartridge.rom[6], 0) ? VERTICAL : HORIZONTAL);
     // Presence of PRG RAM
     nes->cartridge.config.has_prg_ram = NTH_BIT(nes->cartridge.rom[6], 1);
     // 512 byte trainer before PRG data
@@ -66,16 +155,44 @@ cartridge_result_t cartridge_init(nes_t* nes, char const* filename) {
     }
     // Flags 10-15 unused
 
-    // Load PRG data
+    // Load PRG data, it must all be in the file
+    size_t prg_end =
+      NES_HEADER_SIZE + (size_t)nes->cartridge.config.prg_size * NES_PRG_DATA_UNIT_SIZE;
+    if (rom_size < prg_end) {
+        return CARTRIDGE_INVALID;
+    }
     nes->cartridge.prg = nes->cartridge.rom + NES_HEADER_SIZE;
 
-    // Load CHR data
-    nes->cartridge.chr = nes->cartridge.rom + NES_HEADER_SIZE +
-                         nes->cartridge.config.prg_size * NES_PRG_DATA_UNIT_SIZE;
+    // Load CHR data, CHR RAM is not part of the file
+    if (nes->cartridge.config.has_chr_ram) {
+        nes->cartridge.chr = shared_alloc(NES_CHR_DATA_UNIT_SIZE * sizeof(u8));
+        if (!nes->cartridge.chr) {
+            return CARTRIDGE_INVALID;
+        }
+    } else {
+        size_t chr_offset = prg_end;
+        // CHR-ROM is decoded whole, it must all be in the file
+        if (rom_size < chr_offset + chr_size(nes)) {
+            return CARTRIDGE_INVALID;
+        }
+        nes->cartridge.chr = nes->cartridge.rom + chr_offset;
+    }
+    // Decode every tile row, CHR-RAM starts out blank
+    nes->cartridge.tiles = shared_alloc(tiles_size(nes));
+    if (!nes->cartridge.tiles) {
+        return CARTRIDGE_INVALID;
+    }
+    for (u32 offset = 0; offset < chr_size(nes); offset++) {
+        if (!(offset & 8)) decode_row(nes, offset);
+    }
     // Allocate PRG RAM
-    if (nes->cartridge.config.has_prg_ram)
+    if (nes->cartridge.config.has_prg_ram) {
         nes->cartridge.prg_ram =
-          malloc(nes->cartridge.config.prg_ram_size * NES_PRG_RAM_UNIT_SIZE * sizeof(u8));
+          shared_alloc(nes->cartridge.config.prg_ram_size * NES_PRG_RAM_UNIT_SIZE * sizeof(u8));
+        if (!nes->cartridge.prg_ram) {
+            return CARTRIDGE_INVALID;
+        }
+    }
 
     switch (nes->cartridge.config.mapper) {
         case 0:
@@ -89,6 +206,18 @@ cartridge_result_t cartridge_init(nes_t* nes, char const* filename) {
     return CARTRIDGE_SUCCESS;
 }
 
+cartridge_result_t cartridge_init(nes_t* nes, char const* filename) {
+    nes->cartridge.rom = NULL;
+    nes->cartridge.chr = NULL;
+    nes->cartridge.prg_ram = NULL;
+    nes->cartridge.tiles = NULL;
+    nes->cartridge.shared = false;
+    cartridge_result_t result = load(nes, filename);
+    // Memory allocated before the failure is released, the console is not freed by the caller
+    if (result != CARTRIDGE_SUCCESS) reset(nes);
+    return result;
+}
+
 u8 cartridge_prg_rd(nes_t* nes, u16 addr) {
     if (addr >= NES_PRG_DATA_OFFSET) {
         int slot = (addr - NES_PRG_DATA_OFFSET) / NES_PRG_SLOT_SIZE;
@@ -107,21 +236,80 @@ u8 cartridge_chr_rd(nes_t* nes, u16 addr) {
 }
 
 void cartridge_prg_wr(nes_t* nes, u16 addr, u8 data) {
+    // PRG-RAM pages are only unmapped while shared with a fork
+    if (addr >= NES_PRG_RAM_OFFSET && addr < NES_PRG_DATA_OFFSET) {
+        if (!nes->cartridge.config.has_prg_ram || !cartridge_own(nes)) return;
+        nes->cartridge.prg_ram[addr - NES_PRG_RAM_OFFSET] = data;
+        memory_dirty(nes, NES_DIRTY_PRG_RAM, addr - NES_PRG_RAM_OFFSET);
+        return;
+    }
     // TODO: Use mapper's write implementation
-    (void)nes;
-    (void)addr;
-    (void)data;
 }
 
 void cartridge_chr_wr(nes_t* nes, u16 addr, u8 data) {
     if (nes->cartridge.config.has_chr_ram) {
+        if (nes->cartridge.shared && !cartridge_own(nes)) return;
         nes->cartridge.chr[addr] = data;
+        memory_dirty(nes, NES_DIRTY_CHR_RAM, addr);
+        decode_row(nes, addr & ~8);
     }
 }
 
+// Decoded pixels of the tile row whose low bitplane is at the given pattern table address
+u8 const* cartridge_chr_row(nes_t* nes, u16 addr, bool flip) {
+    u32 offset = nes->cartridge.chr_map[addr / NES_CHR_SLOT_SIZE] + addr % NES_CHR_SLOT_SIZE;
+    return nes->cartridge.tiles + ((offset >> 4) * 8 + (offset & 7)) * TILE_ROW_SIZE +
+           (flip ? 8 : 0);
+}
+
+// Loads CHR-RAM whole, decoding only the tiles that differ. The console must own its CHR-RAM.
+void cartridge_chr_load(nes_t* nes, u8 const* data) {
+    for (u32 offset = 0; offset < NES_CHR_DATA_UNIT_SIZE; offset += 16) {
+        if (!memcmp(nes->cartridge.chr + offset, data + offset, 16)) continue;
+        memcpy(nes->cartridge.chr + offset, data + offset, 16);
+        for (int row = 0; row < 8; row++) {
+            decode_row(nes, offset + row);
+        }
+    }
+}
+
+// Shares the cartridge of a console with a fork, both copy PRG-RAM and CHR-RAM on the next write
+void cartridge_fork(nes_t* child, nes_t* parent) {
+    child->cartridge = parent->cartridge;
+    shared_ref(child->cartridge.rom);
+    if (child->cartridge.config.has_prg_ram) shared_ref(child->cartridge.prg_ram);
+    if (child->cartridge.config.has_chr_ram) shared_ref(child->cartridge.chr);
+    shared_ref(child->cartridge.tiles);
+    bool shared = child->cartridge.config.has_prg_ram || child->cartridge.config.has_chr_ram;
+    child->cartridge.shared = shared;
+    parent->cartridge.shared = shared;
+    memory_map_prg_ram(parent);
+}
+
+// Makes the PRG-RAM and CHR-RAM of the console its own before they are written, returns false if
+// memory is missing
+bool cartridge_own(nes_t* nes) {
+    if (!nes->cartridge.shared) return true;
+    if (nes->cartridge.config.has_prg_ram) {
+        size_t size = nes->cartridge.config.prg_ram_size * NES_PRG_RAM_UNIT_SIZE;
+        if (!shared_own(&nes->cartridge.prg_ram, size)) return false;
+    }
+    if (nes->cartridge.config.has_chr_ram) {
+        if (!shared_own(&nes->cartridge.chr, NES_CHR_DATA_UNIT_SIZE)) return false;
+        if (!shared_own(&nes->cartridge.tiles, tiles_size(nes))) return false;
+    }
+    nes->cartridge.shared = false;
+    memory_map_prg_ram(nes);
+    return true;
+}
+
 void reset(nes_t* nes) {
-    free(nes->cartridge.rom);
+    shared_release(nes->cartridge.rom);
     if (nes->cartridge.config.has_prg_ram) {
-        free(nes->cartridge.prg_ram);
+        shared_release(nes->cartridge.prg_ram);
+    }
+    if (nes->cartridge.config.has_chr_ram) {
+        shared_release(nes->cartridge.chr);
     }
+    shared_release(nes->cartridge.tiles);
 }
@@ -0,0 +1,37 @@
+#include "controller.h"
+
+#include "nes.h"
+
+/* Standard controller
+ * Writing 1 to $4016 makes both controllers latch their buttons continuously, writing 0 stops
+ * them. Each read of $4016 / $4017 then shifts out the next button, A first. Once all 8 have been
+ * read, official controllers return 1.
+ */
+
+void controller_init(nes_t* nes) {
+    for (int i = 0; i < 2; i++) {
+        nes->controller.buttons[i] = 0;
+        nes->controller.shift[i] = 0;
+    }
+    nes->controller.strobe = false;
+}
+
+void controller_set(nes_t* nes, u8 port, u8 buttons) {
+    nes->controller.buttons[port] = buttons;
+    if (nes->controller.strobe) nes->controller.shift[port] = buttons;
+}
+
+u8 controller_rd(nes_t* nes, u8 port) {
+    if (nes->controller.strobe) return nes->controller.buttons[port] & 0x01;
+    u8 bit = nes->controller.shift[port] & 0x01;
+    nes->controller.shift[port] = (nes->controller.shift[port] >> 1) | 0x80;
+    return bit;
+}
+
+void controller_wr(nes_t* nes, u8 data) {
+    nes->controller.strobe = data & 0x01;
+    if (nes->controller.strobe) {
+        nes->controller.shift[0] = nes->controller.buttons[0];
+        nes->controller.shift[1] = nes->controller.buttons[1];
+    }
+}
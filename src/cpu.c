@@ -1,30 +1,29 @@
 #include "cpu.h"
 
 #include "bitmask.h"
+#include "cartridge.h"
+#ifdef NES_CPU_JIT
+#include "jit.h"
+#endif
 #include "log.h"
 #include "memory.h"
 #include "nes.h"
+#include "opcodes.h"
+#include "ppu.h"
 
 // For passing addressing modes as instruction arguments
 typedef u16 (*mode)();
 
-// Processor status flag definitions
-enum {
-    STATUS_CARRY,       // [0] C: Carry flag
-    STATUS_ZERO,        // [1] Z: Zero flag
-    STATUS_INT_DISABLE, // [2] I: Interrupt disable
-    STATUS_DECIMAL,     // [3] D: Decimal mode, can be set/cleared but not used
-    STATUS_BREAK,       // [4] B: Break command
-    STATUS_UNUSED,      // [5] -: Not used, wired to 1
-    STATUS_OVERFLOW,    // [6] V: Overflow flag
-    STATUS_NEGATIVE,    // [7] N: Negative flag
-};
+// Instructions and addressing modes are expanded into one handler per opcode, where the mode
+// passed to the instruction is a constant and can be inlined as well
+#ifdef __GNUC__
+#define INLINE static inline __attribute__((always_inline))
+#else
+#define INLINE static inline
+#endif
 
+// Devices are not stepped here, they catch up to cpu.cycle through the scheduler
 static void tick(nes_t* state) {
-    // TODO:
-    // ppu_tick(state);
-    // ppu_tick(state);
-    // ppu_tick(state);
     state->cpu.cycle++;
 }
 
@@ -39,21 +38,103 @@ static u8 pull(nes_t* state) {
 }
 
 /* Flag adjustment */
+// In lazy mode C, Z, V and N are not kept in p. C and V are stored as booleans, Z and N as the
+// value they were last derived from, and the bits are only computed when P is read as a whole.
+
+#define LAZY_FLAGS_MASK                                                                            \
+    ((1 << STATUS_CARRY) | (1 << STATUS_ZERO) | (1 << STATUS_OVERFLOW) | (1 << STATUS_NEGATIVE))
+
+static inline void assign_c(nes_t* state, bool c) {
+#ifdef NES_CPU_LAZY_FLAGS
+    state->cpu.c = c;
+#else
+    ASSIGN_NTH_BIT(state->cpu.p, STATUS_CARRY, c);
+#endif
+}
+
+static inline void assign_v(nes_t* state, bool v) {
+#ifdef NES_CPU_LAZY_FLAGS
+    state->cpu.v = v;
+#else
+    ASSIGN_NTH_BIT(state->cpu.p, STATUS_OVERFLOW, v);
+#endif
+}
 
 static inline void update_c(nes_t* state, u16 r) {
-    ASSIGN_NTH_BIT(state->cpu.p, STATUS_CARRY, r > 0xFF);
+    assign_c(state, r > 0xFF);
 }
 
 static inline void update_z(nes_t* state, u8 d) {
+#ifdef NES_CPU_LAZY_FLAGS
+    state->cpu.z = d;
+#else
     ASSIGN_NTH_BIT(state->cpu.p, STATUS_ZERO, d == 0);
+#endif
 }
 
 static inline void update_v(nes_t* state, u8 d1, u8 d2, u16 r) {
-    ASSIGN_NTH_BIT(state->cpu.p, STATUS_OVERFLOW, (0xFF ^ d1 ^ d2) & (d1 ^ r) & 0x80);
+    assign_v(state, (0xFF ^ d1 ^ d2) & (d1 ^ r) & 0x80);
 }
 
 static inline void update_n(nes_t* state, u8 d) {
+#ifdef NES_CPU_LAZY_FLAGS
+    state->cpu.n = d;
+#else
     ASSIGN_NTH_BIT(state->cpu.p, STATUS_NEGATIVE, NTH_BIT(d, 7));
+#endif
+}
+
+static inline bool flag_c(nes_t* state) {
+#ifdef NES_CPU_LAZY_FLAGS
+    return state->cpu.c;
+#else
+    return NTH_BIT(state->cpu.p, STATUS_CARRY);
+#endif
+}
+
+static inline bool flag_z(nes_t* state) {
+#ifdef NES_CPU_LAZY_FLAGS
+    return state->cpu.z == 0;
+#else
+    return NTH_BIT(state->cpu.p, STATUS_ZERO);
+#endif
+}
+
+static inline bool flag_v(nes_t* state) {
+#ifdef NES_CPU_LAZY_FLAGS
+    return state->cpu.v;
+#else
+    return NTH_BIT(state->cpu.p, STATUS_OVERFLOW);
+#endif
+}
+
+static inline bool flag_n(nes_t* state) {
+#ifdef NES_CPU_LAZY_FLAGS
+    return NTH_BIT(state->cpu.n, 7);
+#else
+    return NTH_BIT(state->cpu.p, STATUS_NEGATIVE);
+#endif
+}
+
+// Status register with every flag up to date
+static inline u8 get_p(nes_t* state) {
+#ifdef NES_CPU_LAZY_FLAGS
+    return (state->cpu.p & ~LAZY_FLAGS_MASK) | (flag_c(state) << STATUS_CARRY) |
+           (flag_z(state) << STATUS_ZERO) | (flag_v(state) << STATUS_OVERFLOW) |
+           (flag_n(state) << STATUS_NEGATIVE);
+#else
+    return state->cpu.p;
+#endif
+}
+
+static inline void set_p(nes_t* state, u8 p) {
+    state->cpu.p = p;
+#ifdef NES_CPU_LAZY_FLAGS
+    state->cpu.c = NTH_BIT(p, STATUS_CARRY);
+    state->cpu.z = !NTH_BIT(p, STATUS_ZERO);
+    state->cpu.v = NTH_BIT(p, STATUS_OVERFLOW);
+    state->cpu.n = p;
+#endif
 }
 
 /* Interrupts */
@@ -67,7 +148,7 @@ static void interrupt_nmi(nes_t* state) {
     tick(state);
     push(state, state->cpu.pc & 0xFF);
     tick(state);
-    push(state, state->cpu.p | (1 << STATUS_UNUSED));
+    push(state, get_p(state) | (1 << STATUS_UNUSED));
     tick(state);
     SET_NTH_BIT(state->cpu.p, STATUS_INT_DISABLE);
     u8 addrl = memory_read(state, NES_NMI_HANDLE_OFFSET);
@@ -106,7 +187,7 @@ static void interrupt_irq(nes_t* state) {
     tick(state);
     push(state, state->cpu.pc & 0xFF);
     tick(state);
-    push(state, state->cpu.p | (1 << STATUS_UNUSED));
+    push(state, get_p(state) | (1 << STATUS_UNUSED));
     tick(state);
     SET_NTH_BIT(state->cpu.p, STATUS_INT_DISABLE);
     u8 addrl = memory_read(state, NES_IRQ_BRK_HANDLE_OFFSET);
@@ -116,13 +197,14 @@ static void interrupt_irq(nes_t* state) {
     tick(state);
 }
 
-static void BRK(nes_t* state) {
+INLINE void instr_brk(nes_t* state, mode m) {
+    (void)m;
     state->cpu.pc++;
     tick(state);
     push(state, state->cpu.pc >> 8);
     tick(state);
     push(state, state->cpu.pc & 0xFF);
-    push(state, state->cpu.p | (1 << STATUS_BREAK) | (1 << STATUS_UNUSED));
+    push(state, get_p(state) | (1 << STATUS_BREAK) | (1 << STATUS_UNUSED));
     tick(state);
     SET_NTH_BIT(state->cpu.p, STATUS_INT_DISABLE);
     u8 addrl = memory_read(state, NES_IRQ_BRK_HANDLE_OFFSET);
@@ -133,28 +215,49 @@ static void BRK(nes_t* state) {
 }
 
 /* Addressing modes */
+// Each mode is split into fetching its operand bytes and resolving the effective address from
+// the operand (addr_*). Operand fetches are side effect free and their cycles are accounted for
+// while resolving, so the block cache can replay the resolve step with pre-decoded operands.
+
+// Fetch the next instruction byte, increment PC
+INLINE u8 fetch(nes_t* state) {
+    return memory_read(state, state->cpu.pc++);
+}
+
+// Fetch a 16 bit little endian operand, increment PC twice
+INLINE u16 fetch16(nes_t* state) {
+    u8 l = fetch(state);
+    u8 h = fetch(state);
+    return l | (h << 8);
+}
+
+// Implied / Accumulator:
+// - No operand, the instruction only works on registers
+INLINE u16 addr_impl(nes_t* state) {
+    (void)state;
+    return 0;
+}
 
 // Immediate:
 // - Return current PC and increment PC (immediate stored here)
-static u16 addr_imm(nes_t* state) {
+INLINE u16 addr_imm(nes_t* state) {
     return state->cpu.pc++;
 }
 
 // ZP:
 // - Read the immediate, increment PC
 // - Return the immediate
-static u16 addr_zp(nes_t* state) {
-    u16 addr = memory_read(state, addr_imm(state));
+INLINE u16 ea_zp(nes_t* state, u16 imm) {
     tick(state);
-    return addr;
+    return imm;
 }
 
 // ZP, X:
 // - Read the immediate, increment PC
 // - Calculate imm + X, include wraparound
 // - Return the new address
-static u16 addr_zpx(nes_t* state) {
-    u16 addr = (addr_zp(state) + state->cpu.x) % 0x100;
+INLINE u16 ea_zpx(nes_t* state, u16 imm) {
+    u16 addr = (ea_zp(state, imm) + state->cpu.x) % 0x100;
     tick(state);
     return addr;
 }
@@ -163,8 +266,8 @@ static u16 addr_zpx(nes_t* state) {
 // - Read the immediate, increment PC
 // - Calculate imm + Y, include wraparound
 // - Return the new address
-static u16 addr_zpy(nes_t* state) {
-    u16 addr = (addr_zp(state) + state->cpu.y) % 0x100;
+INLINE u16 ea_zpy(nes_t* state, u16 imm) {
+    u16 addr = (ea_zp(state, imm) + state->cpu.y) % 0x100;
     tick(state);
     return addr;
 }
@@ -173,10 +276,10 @@ static u16 addr_zpy(nes_t* state) {
 // - Read the immediate, increment PC
 // - Merge new immediate with old immediate, increment PC
 // - Return the merged address
-static u16 addr_absl(nes_t* state) {
-    u8 addrl = (u8)addr_zp(state);
-    u8 addrh = (u8)addr_zp(state);
-    return addrl | (addrh << 8);
+INLINE u16 ea_absl(nes_t* state, u16 imm) {
+    tick(state);
+    tick(state);
+    return imm;
 }
 
 // Absolute, X:
@@ -184,9 +287,9 @@ static u16 addr_absl(nes_t* state) {
 // - Read the new immediate, add the old immediate with X, increment PC
 // - If the sum of old imm and X overflows, reread the address next tick
 // - Merge old imm + X with new imm, return the merged address
-static u16 addr_absx_rd(nes_t* state) {
-    u16 addrl = addr_zp(state);
-    u8 addrh = memory_read(state, addr_imm(state));
+INLINE u16 ea_absx_rd(nes_t* state, u16 imm) {
+    u16 addrl = ea_zp(state, imm & 0xFF);
+    u8 addrh = imm >> 8;
     addrl += state->cpu.x;
     tick(state);
     if ((addrl & 0xFF00) != 0) {
@@ -198,9 +301,9 @@ static u16 addr_absx_rd(nes_t* state) {
 }
 
 // Must incur a tick regardless of page boundary cross
-static u16 addr_absx_wr(nes_t* state) {
-    u16 addrl = addr_zp(state);
-    u8 addrh = memory_read(state, addr_imm(state));
+INLINE u16 ea_absx_wr(nes_t* state, u16 imm) {
+    u16 addrl = ea_zp(state, imm & 0xFF);
+    u8 addrh = imm >> 8;
     addrl += state->cpu.x;
     tick(state);
     if ((addrl & 0xFF00) != 0) {
@@ -216,9 +319,9 @@ static u16 addr_absx_wr(nes_t* state) {
 // - Read the new immediate, add the old immediate with Y, increment PC
 // - If the sum of old imm and Y overflows, reread the address next tick
 // - Merge old imm + Y with new imm, return the merged address
-static u16 addr_absy_rd(nes_t* state) {
-    u16 addrl = addr_zp(state);
-    u8 addrh = memory_read(state, addr_imm(state));
+INLINE u16 ea_absy_rd(nes_t* state, u16 imm) {
+    u16 addrl = ea_zp(state, imm & 0xFF);
+    u8 addrh = imm >> 8;
     addrl += state->cpu.y;
     tick(state);
     if ((addrl & 0xFF00) != 0) {
@@ -230,9 +333,9 @@ static u16 addr_absy_rd(nes_t* state) {
 }
 
 // Must incur a tick regardless of page boundary cross
-static u16 addr_absy_wr(nes_t* state) {
-    u16 addrl = addr_zp(state);
-    u8 addrh = memory_read(state, addr_imm(state));
+INLINE u16 ea_absy_wr(nes_t* state, u16 imm) {
+    u16 addrl = ea_zp(state, imm & 0xFF);
+    u8 addrh = imm >> 8;
     addrl += state->cpu.y;
     tick(state);
     if ((addrl & 0xFF00) != 0) {
@@ -248,10 +351,8 @@ static u16 addr_absy_wr(nes_t* state) {
 // - Read imm (pointer high), increment PC
 // - Read low byte from pointer
 // - Read high byte from pointer (wrap around) and return the merged address
-static u16 addr_ind(nes_t* state) {
-    u8 ptrl = (u8)addr_zp(state);
-    u8 ptrh = (u8)addr_zp(state);
-    u16 ptr = ptrl | (ptrh << 8);
+INLINE u16 ea_ind(nes_t* state, u16 imm) {
+    u16 ptr = ea_absl(state, imm);
     u8 addrl = memory_read(state, ptr);
     tick(state);
     u8 addrh = memory_read(state, (ptr & 0xFF00) | ((ptr + 1) % 0x100));
@@ -264,8 +365,8 @@ static u16 addr_ind(nes_t* state) {
 // - Read address at imm + X on zero page
 // - Read low byte from pointer
 // - Read high byte from pointer and return the merged address
-static u16 addr_xind(nes_t* state) {
-    u8 ptr = (u8)addr_zpx(state);
+INLINE u16 ea_xind(nes_t* state, u16 imm) {
+    u8 ptr = (u8)ea_zpx(state, imm);
     u8 addrl = memory_read(state, ptr);
     tick(state);
     u8 addrh = memory_read(state, (ptr + 1) % 0x100);
@@ -279,8 +380,8 @@ static u16 addr_xind(nes_t* state) {
 // - Read high byte from pointer on zero page, add Y to low byte
 // - If the sum of low byte and X overflows, reread the address next tick
 // - Return the merged address
-static u16 addr_indy_rd(nes_t* state) {
-    u8 ptr = (u8)addr_zp(state);
+INLINE u16 ea_indy_rd(nes_t* state, u16 imm) {
+    u8 ptr = (u8)ea_zp(state, imm);
     u16 addrl = memory_read(state, ptr);
     tick(state);
     u8 addrh = memory_read(state, (ptr + 1) % 0x100);
@@ -295,8 +396,8 @@ static u16 addr_indy_rd(nes_t* state) {
 }
 
 // Must incur a tick regardless of page boundary cross
-static u16 addr_indy_wr(nes_t* state) {
-    u8 ptr = (u8)addr_zp(state);
+INLINE u16 ea_indy_wr(nes_t* state, u16 imm) {
+    u8 ptr = (u8)ea_zp(state, imm);
     u16 addrl = memory_read(state, ptr);
     tick(state);
     u8 addrh = memory_read(state, (ptr + 1) % 0x100);
@@ -314,18 +415,39 @@ static u16 addr_indy_wr(nes_t* state) {
 // - Read imm (offset), increment PC
 // - Add offset to PC
 // - If adding the offset overflowed the low byte of PC, add a cycle
-static u16 addr_rel(nes_t* state) {
-    s8 imm = (s8)addr_zp(state);
-    u16 addr = state->cpu.pc + imm;
+INLINE u16 ea_rel(nes_t* state, u16 imm) {
+    s8 offset = (s8)ea_zp(state, imm);
+    u16 addr = state->cpu.pc + offset;
     tick(state);
     if ((addr & 0x100) != (state->cpu.pc & 0x100)) tick(state);
     return addr;
 }
 
+#define ADDRESSING_MODE(name, fetch_operand)                                                       \
+    INLINE u16 addr_##name(nes_t* state) {                                                         \
+        return ea_##name(state, fetch_operand(state));                                             \
+    }
+
+ADDRESSING_MODE(zp, fetch)
+ADDRESSING_MODE(zpx, fetch)
+ADDRESSING_MODE(zpy, fetch)
+ADDRESSING_MODE(absl, fetch16)
+ADDRESSING_MODE(absx_rd, fetch16)
+ADDRESSING_MODE(absx_wr, fetch16)
+ADDRESSING_MODE(absy_rd, fetch16)
+ADDRESSING_MODE(absy_wr, fetch16)
+ADDRESSING_MODE(ind, fetch16)
+ADDRESSING_MODE(xind, fetch)
+ADDRESSING_MODE(indy_rd, fetch)
+ADDRESSING_MODE(indy_wr, fetch)
+ADDRESSING_MODE(rel, fetch)
+
+#undef ADDRESSING_MODE
+
 /* Instructions */
 
 // Load / Store operations
-static void instr_lda(nes_t* state, mode m) {
+INLINE void instr_lda(nes_t* state, mode m) {
     u8 d = memory_read(state, m(state));
     update_z(state, d);
     update_n(state, d);
@@ -333,7 +455,7 @@ static void instr_lda(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_ldx(nes_t* state, mode m) {
+INLINE void instr_ldx(nes_t* state, mode m) {
     u8 d = memory_read(state, m(state));
     update_z(state, d);
     update_n(state, d);
@@ -341,7 +463,7 @@ static void instr_ldx(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_ldy(nes_t* state, mode m) {
+INLINE void instr_ldy(nes_t* state, mode m) {
     u8 d = memory_read(state, m(state));
     update_z(state, d);
     update_n(state, d);
@@ -349,55 +471,61 @@ static void instr_ldy(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_sta(nes_t* state, mode m) {
+INLINE void instr_sta(nes_t* state, mode m) {
     memory_write(state, m(state), state->cpu.a);
     tick(state);
 }
 
-static void instr_stx(nes_t* state, mode m) {
+INLINE void instr_stx(nes_t* state, mode m) {
     memory_write(state, m(state), state->cpu.x);
     tick(state);
 }
 
-static void instr_sty(nes_t* state, mode m) {
+INLINE void instr_sty(nes_t* state, mode m) {
     memory_write(state, m(state), state->cpu.y);
     tick(state);
 }
 
-static void instr_txa(nes_t* state) {
+INLINE void instr_txa(nes_t* state, mode m) {
+    (void)m;
     update_z(state, state->cpu.x);
     update_n(state, state->cpu.x);
     state->cpu.a = state->cpu.x;
     tick(state);
 }
 
-static void instr_txs(nes_t* state) {
+INLINE void instr_txs(nes_t* state, mode m) {
+    (void)m;
     state->cpu.s = state->cpu.x;
     tick(state);
 }
 
-static void instr_tya(nes_t* state) {
+INLINE void instr_tya(nes_t* state, mode m) {
+    (void)m;
     update_z(state, state->cpu.y);
     update_n(state, state->cpu.y);
     state->cpu.a = state->cpu.y;
     tick(state);
 }
 
-static void instr_tax(nes_t* state) {
+INLINE void instr_tax(nes_t* state, mode m) {
+    (void)m;
     update_z(state, state->cpu.a);
     update_n(state, state->cpu.a);
     state->cpu.x = state->cpu.a;
     tick(state);
 }
 
-static void instr_tay(nes_t* state) {
+INLINE void instr_tay(nes_t* state, mode m) {
+    (void)m;
     update_z(state, state->cpu.a);
     update_n(state, state->cpu.a);
     state->cpu.y = state->cpu.a;
     tick(state);
 }
 
-static void instr_tsx(nes_t* state) {
+INLINE void instr_tsx(nes_t* state, mode m) {
+    (void)m;
     update_z(state, state->cpu.s);
     update_n(state, state->cpu.s);
     state->cpu.x = state->cpu.s;
@@ -405,30 +533,34 @@ static void instr_tsx(nes_t* state) {
 }
 
 // Stack operations
-static void instr_php(nes_t* state) {
+INLINE void instr_php(nes_t* state, mode m) {
+    (void)m;
     // Throw away next byte
     tick(state);
-    push(state, state->cpu.p | (1 << STATUS_BREAK) | (1 << STATUS_UNUSED));
+    push(state, get_p(state) | (1 << STATUS_BREAK) | (1 << STATUS_UNUSED));
     tick(state);
 }
 
-static void instr_plp(nes_t* state) {
+INLINE void instr_plp(nes_t* state, mode m) {
+    (void)m;
     // Throw away next byte
     tick(state);
     // S increment
     tick(state);
-    state->cpu.p = (pull(state) & ~(1 << STATUS_BREAK)) | (1 << STATUS_UNUSED);
+    set_p(state, (pull(state) & ~(1 << STATUS_BREAK)) | (1 << STATUS_UNUSED));
     tick(state);
 }
 
-static void instr_pha(nes_t* state) {
+INLINE void instr_pha(nes_t* state, mode m) {
+    (void)m;
     // Throw away next byte
     tick(state);
     push(state, state->cpu.a);
     tick(state);
 }
 
-static void instr_pla(nes_t* state) {
+INLINE void instr_pla(nes_t* state, mode m) {
+    (void)m;
     // Throw away next byte
     tick(state);
     // S increment
@@ -440,9 +572,9 @@ static void instr_pla(nes_t* state) {
 }
 
 // Arithmetic / Logical operations
-static void instr_adc(nes_t* state, mode m) {
+INLINE void instr_adc(nes_t* state, mode m) {
     u8 d = memory_read(state, m(state));
-    u16 s = state->cpu.a + d + NTH_BIT(state->cpu.p, STATUS_CARRY);
+    u16 s = state->cpu.a + d + flag_c(state);
     update_c(state, s);
     update_z(state, (u8)s);
     update_v(state, state->cpu.a, d, s);
@@ -451,9 +583,9 @@ static void instr_adc(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_sbc(nes_t* state, mode m) {
+INLINE void instr_sbc(nes_t* state, mode m) {
     u8 d = memory_read(state, m(state));
-    u16 s = state->cpu.a + (d ^ 0xFF) + NTH_BIT(state->cpu.p, STATUS_CARRY);
+    u16 s = state->cpu.a + (d ^ 0xFF) + flag_c(state);
     update_c(state, s);
     update_z(state, (u8)s);
     update_v(state, state->cpu.a, (d ^ 0xFF), s);
@@ -462,7 +594,7 @@ static void instr_sbc(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_and(nes_t* state, mode m) {
+INLINE void instr_and(nes_t* state, mode m) {
     u8 d = memory_read(state, m(state));
     state->cpu.a &= d;
     update_z(state, state->cpu.a);
@@ -470,7 +602,7 @@ static void instr_and(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_eor(nes_t* state, mode m) {
+INLINE void instr_eor(nes_t* state, mode m) {
     u8 d = memory_read(state, m(state));
     state->cpu.a ^= d;
     update_z(state, state->cpu.a);
@@ -478,7 +610,7 @@ static void instr_eor(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_ora(nes_t* state, mode m) {
+INLINE void instr_ora(nes_t* state, mode m) {
     u8 d = memory_read(state, m(state));
     state->cpu.a |= d;
     update_z(state, state->cpu.a);
@@ -486,16 +618,16 @@ static void instr_ora(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_bit(nes_t* state, mode m) {
+INLINE void instr_bit(nes_t* state, mode m) {
     u8 d = memory_read(state, m(state));
     update_z(state, state->cpu.a & d);
-    ASSIGN_NTH_BIT(state->cpu.p, STATUS_NEGATIVE, NTH_BIT(d, 7));
-    ASSIGN_NTH_BIT(state->cpu.p, STATUS_OVERFLOW, NTH_BIT(d, 6));
+    update_n(state, d);
+    assign_v(state, NTH_BIT(d, 6));
     tick(state);
 }
 
 // Compares
-static void instr_cmp(nes_t* state, mode m) {
+INLINE void instr_cmp(nes_t* state, mode m) {
     u8 d = memory_read(state, m(state));
     u16 s = state->cpu.a + (d ^ 0xFF) + 1;
     update_c(state, s);
@@ -504,7 +636,7 @@ static void instr_cmp(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_cpx(nes_t* state, mode m) {
+INLINE void instr_cpx(nes_t* state, mode m) {
     u8 d = memory_read(state, m(state));
     u16 s = state->cpu.x + (d ^ 0xFF) + 1;
     update_c(state, s);
@@ -513,7 +645,7 @@ static void instr_cpx(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_cpy(nes_t* state, mode m) {
+INLINE void instr_cpy(nes_t* state, mode m) {
     u8 d = memory_read(state, m(state));
     u16 s = state->cpu.y + (d ^ 0xFF) + 1;
     update_c(state, s);
@@ -523,7 +655,7 @@ static void instr_cpy(nes_t* state, mode m) {
 }
 
 // Increments / Decrements
-static void instr_inc(nes_t* state, mode m) {
+INLINE void instr_inc(nes_t* state, mode m) {
     u16 addr = m(state);
     u8 d = memory_read(state, addr);
     tick(state);
@@ -535,21 +667,23 @@ static void instr_inc(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_inx(nes_t* state) {
+INLINE void instr_inx(nes_t* state, mode m) {
+    (void)m;
     state->cpu.x++;
     update_z(state, state->cpu.x);
     update_n(state, state->cpu.x);
     tick(state);
 }
 
-static void instr_iny(nes_t* state) {
+INLINE void instr_iny(nes_t* state, mode m) {
+    (void)m;
     state->cpu.y++;
     update_z(state, state->cpu.y);
     update_n(state, state->cpu.y);
     tick(state);
 }
 
-static void instr_dec(nes_t* state, mode m) {
+INLINE void instr_dec(nes_t* state, mode m) {
     u16 addr = m(state);
     u8 d = memory_read(state, addr);
     tick(state);
@@ -561,14 +695,16 @@ static void instr_dec(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_dex(nes_t* state) {
+INLINE void instr_dex(nes_t* state, mode m) {
+    (void)m;
     state->cpu.x--;
     update_z(state, state->cpu.x);
     update_n(state, state->cpu.x);
     tick(state);
 }
 
-static void instr_dey(nes_t* state) {
+INLINE void instr_dey(nes_t* state, mode m) {
+    (void)m;
     state->cpu.y--;
     update_z(state, state->cpu.y);
     update_n(state, state->cpu.y);
@@ -576,11 +712,11 @@ static void instr_dey(nes_t* state) {
 }
 
 // Shifts
-static void instr_asl(nes_t* state, mode m) {
+INLINE void instr_asl(nes_t* state, mode m) {
     u16 addr = m(state);
     u8 d = memory_read(state, addr);
     tick(state);
-    ASSIGN_NTH_BIT(state->cpu.p, STATUS_CARRY, NTH_BIT(d, 7));
+    assign_c(state, NTH_BIT(d, 7));
     d <<= 1;
     update_z(state, d);
     update_n(state, d);
@@ -589,19 +725,20 @@ static void instr_asl(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_asl_a(nes_t* state) {
-    ASSIGN_NTH_BIT(state->cpu.p, STATUS_CARRY, NTH_BIT(state->cpu.a, 7));
+INLINE void instr_asl_a(nes_t* state, mode m) {
+    (void)m;
+    assign_c(state, NTH_BIT(state->cpu.a, 7));
     state->cpu.a <<= 1;
     update_z(state, state->cpu.a);
     update_n(state, state->cpu.a);
     tick(state);
 }
 
-static void instr_lsr(nes_t* state, mode m) {
+INLINE void instr_lsr(nes_t* state, mode m) {
     u16 addr = m(state);
     u8 d = memory_read(state, addr);
     tick(state);
-    ASSIGN_NTH_BIT(state->cpu.p, STATUS_CARRY, NTH_BIT(d, 0));
+    assign_c(state, NTH_BIT(d, 0));
     d >>= 1;
     update_z(state, d);
     update_n(state, d);
@@ -610,20 +747,21 @@ static void instr_lsr(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_lsr_a(nes_t* state) {
-    ASSIGN_NTH_BIT(state->cpu.p, STATUS_CARRY, NTH_BIT(state->cpu.a, 0));
+INLINE void instr_lsr_a(nes_t* state, mode m) {
+    (void)m;
+    assign_c(state, NTH_BIT(state->cpu.a, 0));
     state->cpu.a >>= 1;
     update_z(state, state->cpu.a);
     update_n(state, state->cpu.a);
     tick(state);
 }
 
-static void instr_rol(nes_t* state, mode m) {
+INLINE void instr_rol(nes_t* state, mode m) {
     u16 addr = m(state);
     u8 d = memory_read(state, addr);
     tick(state);
-    bool c = NTH_BIT(state->cpu.p, STATUS_CARRY);
-    ASSIGN_NTH_BIT(state->cpu.p, STATUS_CARRY, NTH_BIT(d, 7));
+    bool c = flag_c(state);
+    assign_c(state, NTH_BIT(d, 7));
     d = (d << 1) | c;
     update_z(state, d);
     update_n(state, d);
@@ -632,21 +770,22 @@ static void instr_rol(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_rol_a(nes_t* state) {
-    bool c = NTH_BIT(state->cpu.p, STATUS_CARRY);
-    ASSIGN_NTH_BIT(state->cpu.p, STATUS_CARRY, NTH_BIT(state->cpu.a, 7));
+INLINE void instr_rol_a(nes_t* state, mode m) {
+    (void)m;
+    bool c = flag_c(state);
+    assign_c(state, NTH_BIT(state->cpu.a, 7));
     state->cpu.a = (state->cpu.a << 1) | c;
     update_z(state, state->cpu.a);
     update_n(state, state->cpu.a);
     tick(state);
 }
 
-static void instr_ror(nes_t* state, mode m) {
+INLINE void instr_ror(nes_t* state, mode m) {
     u16 addr = m(state);
     u8 d = memory_read(state, addr);
     tick(state);
-    bool c = NTH_BIT(state->cpu.p, STATUS_CARRY);
-    ASSIGN_NTH_BIT(state->cpu.p, STATUS_CARRY, NTH_BIT(d, 0));
+    bool c = flag_c(state);
+    assign_c(state, NTH_BIT(d, 0));
     d = (d >> 1) | (c << 7);
     update_z(state, d);
     update_n(state, d);
@@ -655,9 +794,10 @@ static void instr_ror(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_ror_a(nes_t* state) {
-    bool c = NTH_BIT(state->cpu.p, STATUS_CARRY);
-    ASSIGN_NTH_BIT(state->cpu.p, STATUS_CARRY, NTH_BIT(state->cpu.a, 0));
+INLINE void instr_ror_a(nes_t* state, mode m) {
+    (void)m;
+    bool c = flag_c(state);
+    assign_c(state, NTH_BIT(state->cpu.a, 0));
     state->cpu.a = (state->cpu.a >> 1) | (c << 7);
     update_z(state, state->cpu.a);
     update_n(state, state->cpu.a);
@@ -665,11 +805,12 @@ static void instr_ror_a(nes_t* state) {
 }
 
 // Jumps / calls
-static void instr_jmp(nes_t* state, mode m) {
+INLINE void instr_jmp(nes_t* state, mode m) {
     state->cpu.pc = m(state);
 }
 
-static void instr_jsr(nes_t* state) {
+INLINE void instr_jsr(nes_t* state, mode m) {
+    (void)m;
     u8 addrl = memory_read(state, state->cpu.pc);
     state->cpu.pc += 1;
     tick(state);
@@ -683,7 +824,8 @@ static void instr_jsr(nes_t* state) {
     tick(state);
 }
 
-static void instr_rts(nes_t* state) {
+INLINE void instr_rts(nes_t* state, mode m) {
+    (void)m;
     // Throw away next byte
     tick(state);
     // S increment
@@ -697,12 +839,13 @@ static void instr_rts(nes_t* state) {
     tick(state);
 }
 
-static void instr_rti(nes_t* state) {
+INLINE void instr_rti(nes_t* state, mode m) {
+    (void)m;
     // Throw away next byte
     tick(state);
     // S increment
     tick(state);
-    state->cpu.p = (pull(state) & ~(1 << STATUS_BREAK)) | (1 << STATUS_UNUSED);
+    set_p(state, (pull(state) & ~(1 << STATUS_BREAK)) | (1 << STATUS_UNUSED));
     tick(state);
     u8 addrl = pull(state);
     tick(state);
@@ -712,8 +855,8 @@ static void instr_rti(nes_t* state) {
 }
 
 // Branches
-static void instr_bpl(nes_t* state, mode m) {
-    if (!NTH_BIT(state->cpu.p, STATUS_NEGATIVE)) {
+INLINE void instr_bpl(nes_t* state, mode m) {
+    if (!flag_n(state)) {
         state->cpu.pc = m(state);
     } else {
         state->cpu.pc++;
@@ -721,8 +864,8 @@ static void instr_bpl(nes_t* state, mode m) {
     }
 }
 
-static void instr_bmi(nes_t* state, mode m) {
-    if (NTH_BIT(state->cpu.p, STATUS_NEGATIVE)) {
+INLINE void instr_bmi(nes_t* state, mode m) {
+    if (flag_n(state)) {
         state->cpu.pc = m(state);
     } else {
         state->cpu.pc++;
@@ -730,8 +873,8 @@ static void instr_bmi(nes_t* state, mode m) {
     }
 }
 
-static void instr_bvc(nes_t* state, mode m) {
-    if (!NTH_BIT(state->cpu.p, STATUS_OVERFLOW)) {
+INLINE void instr_bvc(nes_t* state, mode m) {
+    if (!flag_v(state)) {
         state->cpu.pc = m(state);
     } else {
         state->cpu.pc++;
@@ -739,8 +882,8 @@ static void instr_bvc(nes_t* state, mode m) {
     }
 }
 
-static void instr_bvs(nes_t* state, mode m) {
-    if (NTH_BIT(state->cpu.p, STATUS_OVERFLOW)) {
+INLINE void instr_bvs(nes_t* state, mode m) {
+    if (flag_v(state)) {
         state->cpu.pc = m(state);
     } else {
         state->cpu.pc++;
@@ -748,8 +891,8 @@ static void instr_bvs(nes_t* state, mode m) {
     }
 }
 
-static void instr_bcc(nes_t* state, mode m) {
-    if (!NTH_BIT(state->cpu.p, STATUS_CARRY)) {
+INLINE void instr_bcc(nes_t* state, mode m) {
+    if (!flag_c(state)) {
         state->cpu.pc = m(state);
     } else {
         state->cpu.pc++;
@@ -757,8 +900,8 @@ static void instr_bcc(nes_t* state, mode m) {
     }
 }
 
-static void instr_bcs(nes_t* state, mode m) {
-    if (NTH_BIT(state->cpu.p, STATUS_CARRY)) {
+INLINE void instr_bcs(nes_t* state, mode m) {
+    if (flag_c(state)) {
         state->cpu.pc = m(state);
     } else {
         state->cpu.pc++;
@@ -766,8 +909,8 @@ static void instr_bcs(nes_t* state, mode m) {
     }
 }
 
-static void instr_bne(nes_t* state, mode m) {
-    if (!NTH_BIT(state->cpu.p, STATUS_ZERO)) {
+INLINE void instr_bne(nes_t* state, mode m) {
+    if (!flag_z(state)) {
         state->cpu.pc = m(state);
     } else {
         state->cpu.pc++;
@@ -775,8 +918,8 @@ static void instr_bne(nes_t* state, mode m) {
     }
 }
 
-static void instr_beq(nes_t* state, mode m) {
-    if (NTH_BIT(state->cpu.p, STATUS_ZERO)) {
+INLINE void instr_beq(nes_t* state, mode m) {
+    if (flag_z(state)) {
         state->cpu.pc = m(state);
     } else {
         state->cpu.pc++;
@@ -785,53 +928,67 @@ static void instr_beq(nes_t* state, mode m) {
 }
 
 // Status register operations
-static void instr_clc(nes_t* state) {
-    CLEAR_NTH_BIT(state->cpu.p, STATUS_CARRY);
+INLINE void instr_clc(nes_t* state, mode m) {
+    (void)m;
+    assign_c(state, 0);
     tick(state);
 }
 
-static void instr_cli(nes_t* state) {
+INLINE void instr_cli(nes_t* state, mode m) {
+    (void)m;
     CLEAR_NTH_BIT(state->cpu.p, STATUS_INT_DISABLE);
     tick(state);
 }
 
-static void instr_clv(nes_t* state) {
-    CLEAR_NTH_BIT(state->cpu.p, STATUS_OVERFLOW);
+INLINE void instr_clv(nes_t* state, mode m) {
+    (void)m;
+    assign_v(state, 0);
     tick(state);
 }
 
-static void instr_cld(nes_t* state) {
+INLINE void instr_cld(nes_t* state, mode m) {
+    (void)m;
     CLEAR_NTH_BIT(state->cpu.p, STATUS_DECIMAL);
     tick(state);
 }
 
-static void instr_sec(nes_t* state) {
-    SET_NTH_BIT(state->cpu.p, STATUS_CARRY);
+INLINE void instr_sec(nes_t* state, mode m) {
+    (void)m;
+    assign_c(state, 1);
     tick(state);
 }
 
-static void instr_sei(nes_t* state) {
+INLINE void instr_sei(nes_t* state, mode m) {
+    (void)m;
     SET_NTH_BIT(state->cpu.p, STATUS_INT_DISABLE);
     tick(state);
 }
 
-static void instr_sed(nes_t* state) {
+INLINE void instr_sed(nes_t* state, mode m) {
+    (void)m;
     SET_NTH_BIT(state->cpu.p, STATUS_DECIMAL);
     tick(state);
 }
 
 // System functions
-static void instr_nop(nes_t* state) {
+INLINE void instr_nop(nes_t* state, mode m) {
+    (void)m;
+    tick(state);
+}
+
+INLINE void instr_ill(nes_t* state, mode m) {
+    (void)m;
+    LOG("Unsupported instruction: 0x%02X\n", memory_read(state, state->cpu.pc - 1));
     tick(state);
 }
 
 // Illegal opcodes
-static void instr_skb(nes_t* state, mode m) {
+INLINE void instr_skb(nes_t* state, mode m) {
     m(state);
     tick(state);
 }
 
-static void instr_lax(nes_t* state, mode m) {
+INLINE void instr_lax(nes_t* state, mode m) {
     u8 d = memory_read(state, m(state));
     update_z(state, d);
     update_n(state, d);
@@ -840,13 +997,13 @@ static void instr_lax(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_sax(nes_t* state, mode m) {
+INLINE void instr_sax(nes_t* state, mode m) {
     u16 addr = m(state);
     memory_write(state, addr, state->cpu.a & state->cpu.x);
     tick(state);
 }
 
-static void instr_axs(nes_t* state, mode m) {
+INLINE void instr_axs(nes_t* state, mode m) {
     u8 d = memory_read(state, m(state));
     u16 s = (state->cpu.a & state->cpu.x) + (d ^ 0xFF) + 1;
     update_c(state, s);
@@ -856,7 +1013,7 @@ static void instr_axs(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_dcp(nes_t* state, mode m) {
+INLINE void instr_dcp(nes_t* state, mode m) {
     u16 addr = m(state);
     u8 d = memory_read(state, addr);
     tick(state);
@@ -870,12 +1027,12 @@ static void instr_dcp(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_isc(nes_t* state, mode m) {
+INLINE void instr_isc(nes_t* state, mode m) {
     u16 addr = m(state);
     u8 d = memory_read(state, addr);
     tick(state);
     d++;
-    u16 s = state->cpu.a + (d ^ 0xFF) + NTH_BIT(state->cpu.p, STATUS_CARRY);
+    u16 s = state->cpu.a + (d ^ 0xFF) + flag_c(state);
     update_c(state, s);
     update_z(state, (u8)s);
     update_v(state, state->cpu.a, (d ^ 0xFF), s);
@@ -886,11 +1043,11 @@ static void instr_isc(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_slo(nes_t* state, mode m) {
+INLINE void instr_slo(nes_t* state, mode m) {
     u16 addr = m(state);
     u8 d = memory_read(state, addr);
     tick(state);
-    ASSIGN_NTH_BIT(state->cpu.p, STATUS_CARRY, NTH_BIT(d, 7));
+    assign_c(state, NTH_BIT(d, 7));
     d <<= 1;
     state->cpu.a |= d;
     update_z(state, state->cpu.a);
@@ -900,12 +1057,12 @@ static void instr_slo(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_rla(nes_t* state, mode m) {
+INLINE void instr_rla(nes_t* state, mode m) {
     u16 addr = m(state);
     u8 d = memory_read(state, addr);
     tick(state);
-    bool c = NTH_BIT(state->cpu.p, STATUS_CARRY);
-    ASSIGN_NTH_BIT(state->cpu.p, STATUS_CARRY, NTH_BIT(d, 7));
+    bool c = flag_c(state);
+    assign_c(state, NTH_BIT(d, 7));
     d = (d << 1) | c;
     state->cpu.a &= d;
     update_z(state, state->cpu.a);
@@ -915,11 +1072,11 @@ static void instr_rla(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_sre(nes_t* state, mode m) {
+INLINE void instr_sre(nes_t* state, mode m) {
     u16 addr = m(state);
     u8 d = memory_read(state, addr);
     tick(state);
-    ASSIGN_NTH_BIT(state->cpu.p, STATUS_CARRY, NTH_BIT(d, 0));
+    assign_c(state, NTH_BIT(d, 0));
     d >>= 1;
     state->cpu.a ^= d;
     update_z(state, state->cpu.a);
@@ -929,14 +1086,14 @@ static void instr_sre(nes_t* state, mode m) {
     tick(state);
 }
 
-static void instr_rra(nes_t* state, mode m) {
+INLINE void instr_rra(nes_t* state, mode m) {
     u16 addr = m(state);
     u8 d = memory_read(state, addr);
     tick(state);
-    bool c = NTH_BIT(state->cpu.p, STATUS_CARRY);
-    ASSIGN_NTH_BIT(state->cpu.p, STATUS_CARRY, NTH_BIT(d, 0));
+    bool c = flag_c(state);
+    assign_c(state, NTH_BIT(d, 0));
     d = (d >> 1) | (c << 7);
-    u16 s = state->cpu.a + d + NTH_BIT(state->cpu.p, STATUS_CARRY);
+    u16 s = state->cpu.a + d + flag_c(state);
     update_c(state, s);
     update_z(state, (u8)s);
     update_v(state, state->cpu.a, d, s);
@@ -947,280 +1104,409 @@ static void instr_rra(nes_t* state, mode m) {
     tick(state);
 }
 
+/* Opcode table */
+
+#ifdef NES_CPU_BLOCK_CACHE
+// Addressing modes replaying a pre-decoded operand from the block cache
+#define CACHED_MODE(name)                                                                          \
+    INLINE u16 cached_##name(nes_t* state) {                                                       \
+        state->cpu.pc += OPERAND_##name;                                                           \
+        return ea_##name(state, state->cache.uop->operand);                                        \
+    }
+
+// Implied and immediate modes never fetch an operand
+INLINE u16 cached_impl(nes_t* state) {
+    return addr_impl(state);
+}
+
+INLINE u16 cached_imm(nes_t* state) {
+    return addr_imm(state);
+}
+
+CACHED_MODE(zp)
+CACHED_MODE(zpx)
+CACHED_MODE(zpy)
+CACHED_MODE(absl)
+CACHED_MODE(absx_rd)
+CACHED_MODE(absx_wr)
+CACHED_MODE(absy_rd)
+CACHED_MODE(absy_wr)
+CACHED_MODE(ind)
+CACHED_MODE(xind)
+CACHED_MODE(indy_rd)
+CACHED_MODE(indy_wr)
+CACHED_MODE(rel)
+
+#undef CACHED_MODE
+#endif // NES_CPU_BLOCK_CACHE
+
+#ifdef NES_CPU_BLOCK_CACHE
+// Instructions are executed through the per-opcode handlers, the table describes them for the
+// block cache
+typedef void (*instr)(nes_t*, mode);
+
+typedef struct {
+    instr exec;       // Instruction handler
+    mode addr;        // Addressing mode passed to the handler
+    u8 size;          // Operand bytes
+    u8 cycles;        // Base cycle count, see opcodes.h
+    char const* name; // Mnemonic
+} opcode_t;
+
+#define OPCODE_ENTRY(op, fn, m, cyc, mnemonic)                                                     \
+    [op] = { instr_##fn, addr_##m, OPERAND_##m, cyc, mnemonic },
+static opcode_t const opcodes[256] = { CPU_OPCODE_TABLE(OPCODE_ENTRY) };
+#undef OPCODE_ENTRY
+#endif
+
+/* Block cache */
+// Straight-line code in PRG-ROM is decoded once into blocks of uops with their operands already
+// fetched. Blocks are tagged with the PRG bank they were decoded from, so a bank switch through
+// prg_map invalidates them on the next lookup. Code outside PRG-ROM is always interpreted.
+
+#ifdef NES_CPU_BLOCK_CACHE
+static nes_block_t* cache_entry(nes_t* state, u16 pc) {
+    return &state->cache.blocks[(pc ^ (pc >> 8)) % NES_BLOCK_CACHE_SIZE];
+}
+
+static u32 cache_bank(nes_t* state, u16 pc) {
+    return state->cartridge.prg_map[(pc - NES_PRG_DATA_OFFSET) / NES_PRG_SLOT_SIZE];
+}
+
+// Control transfers end a block
+static bool is_flow(instr fn) {
+    return fn == instr_brk || fn == instr_jsr || fn == instr_jmp || fn == instr_rts ||
+           fn == instr_rti || fn == instr_bpl || fn == instr_bmi || fn == instr_bvc ||
+           fn == instr_bvs || fn == instr_bcc || fn == instr_bcs || fn == instr_bne ||
+           fn == instr_beq || fn == instr_ill;
+}
+
+static bool is_write(instr fn) {
+    return fn == instr_sta || fn == instr_stx || fn == instr_sty || fn == instr_sax ||
+           fn == instr_asl || fn == instr_lsr || fn == instr_rol || fn == instr_ror ||
+           fn == instr_inc || fn == instr_dec || fn == instr_slo || fn == instr_rla ||
+           fn == instr_sre || fn == instr_rra || fn == instr_dcp || fn == instr_isc;
+}
+
+// Writes that may reach the mapper, and so possibly switch banks, end a block
+static bool is_mapper_write(opcode_t const* o, u16 operand) {
+    if (!is_write(o->exec)) return false;
+    if (o->addr == addr_zp || o->addr == addr_zpx || o->addr == addr_zpy) return false;
+    if (o->addr == addr_absl) return operand >= 0x4020;
+    if (o->addr == addr_absx_wr || o->addr == addr_absy_wr) return operand + 0xFF >= 0x4020;
+    return true;
+}
+
+static bool is_branch(instr fn) {
+    return fn == instr_bpl || fn == instr_bmi || fn == instr_bvc || fn == instr_bvs ||
+           fn == instr_bcc || fn == instr_bcs || fn == instr_bne || fn == instr_beq;
+}
+
+/* Idle loops */
+// Games wait for vblank by spinning on a RAM flag set by the NMI handler, on PPUSTATUS, or on a
+// jump to itself. A block that branches back to its own start and only loads and compares values
+// leaves the CPU in the same state on every iteration, so once it has run through once the
+// remaining iterations can be skipped until something else may change those values: an event for
+// RAM (only interrupt handlers write it while the CPU spins), the PPU for PPUSTATUS.
+
+enum { REG_A = 1 << 0, REG_X = 1 << 1, REG_Y = 1 << 2 };
+
+// Registers read and written by an instruction allowed in an idle loop, false for anything else
+static bool idle_regs(opcode_t const* o, u8* read, u8* written) {
+    *read = o->addr == addr_zpx ? REG_X : o->addr == addr_zpy ? REG_Y : 0;
+    *written = 0;
+    if (o->exec == instr_lda) *written = REG_A;
+    else if (o->exec == instr_ldx) *written = REG_X;
+    else if (o->exec == instr_ldy) *written = REG_Y;
+    else if (o->exec == instr_cmp || o->exec == instr_bit) *read |= REG_A;
+    else if (o->exec == instr_cpx) *read |= REG_X;
+    else if (o->exec == instr_cpy) *read |= REG_Y;
+    else if (o->exec == instr_and || o->exec == instr_ora || o->exec == instr_eor) {
+        *read |= REG_A;
+        *written = REG_A;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Finds whether a decoded block is an idle loop and sets its iteration cycles
+static void cache_idle(nes_block_t* block) {
+    nes_uop_t const* last = &block->uops[block->count - 1];
+    opcode_t const* o = &opcodes[last->op];
+
+    block->idle = 0;
+    block->poll = false;
+    if (o->exec == instr_jmp && o->addr == addr_absl) {
+        // Only a jump to itself, anything before it may have side effects
+        if (block->count != 1 || last->operand != block->pc) return;
+        block->idle = last->cycles;
+        return;
+    }
+    if (!is_branch(o->exec)) return;
+    u16 next = last->pc + 2;
+    u16 target = next + (s8)last->operand;
+    if (target != block->pc) return;
+
+    // Every register read has to be loaded earlier in the iteration or never be written at all,
+    // otherwise the iteration depends on the previous one
+    u8 read[NES_BLOCK_MAX_UOPS], written[NES_BLOCK_MAX_UOPS];
+    u8 modified = 0;
+    bool poll = false;
+    for (u8 i = 0; i < block->count - 1; i++) {
+        nes_uop_t const* uop = &block->uops[i];
+        opcode_t const* op = &opcodes[uop->op];
+        if (!idle_regs(op, &read[i], &written[i])) return;
+        modified |= written[i];
+        if (op->addr == addr_absl) {
+            if ((uop->operand & 0xE007) == 0x2002) {
+                poll = true;
+            } else if (uop->operand >= 0x2000 && uop->operand < 0x6000) {
+                return;
+            }
+        } else if (op->addr != addr_imm && op->addr != addr_zp && op->addr != addr_zpx &&
+                   op->addr != addr_zpy) {
+            return;
+        }
+    }
+    u8 loaded = 0;
+    for (u8 i = 0; i < block->count - 1; i++) {
+        if (read[i] & modified & ~loaded) return;
+        loaded |= written[i];
+    }
+
+    // Taken branches take one more cycle, two when crossing a page
+    block->idle = block->cycles + 1 + ((target & 0x100) != (next & 0x100));
+    block->poll = poll;
+}
+
+// Skips the iterations of an idle loop that would end before anything it reads may change
+static void cache_skip_idle(nes_t* state, nes_block_t const* block) {
+    u64 until = state->scheduler.next;
+    if (block->poll) {
+        // The last read of PPUSTATUS was made during the iteration that just ended
+        u64 change = ppu_status_change(state, state->cpu.cycle - block->idle);
+        if (change < until) until = change;
+    }
+    // Stop short of the event so it is still handled between the same two instructions
+    if (until <= state->cpu.cycle + block->idle) return;
+    u64 iterations = (until - state->cpu.cycle - 1) / block->idle;
+    state->cpu.cycle += iterations * block->idle;
+    state->cpu.instructions += iterations * block->count;
+}
+
+static void cache_decode(nes_t* state, nes_block_t* block, u16 pc) {
+    // Blocks never leave the PRG slot they start in
+    u32 end = (pc | (NES_PRG_SLOT_SIZE - 1)) + 1;
+    u32 addr = pc;
+
+    block->pc = pc;
+    block->bank = cache_bank(state, pc);
+    block->count = 0;
+    block->cycles = 0;
+#ifdef NES_CPU_JIT
+    block->hits = 0;
+    block->code = NULL;
+#endif
+    while (block->count < NES_BLOCK_MAX_UOPS && addr < end) {
+        u8 op = cartridge_prg_rd(state, addr);
+        opcode_t const* o = &opcodes[op];
+        // Instructions straddling the slot boundary are left to the interpreter
+        if (addr + 1 + o->size > end) break;
+
+        nes_uop_t* uop = &block->uops[block->count++];
+        uop->pc = addr;
+        uop->op = op;
+        uop->cycles = o->cycles;
+        uop->operand = 0;
+        for (u8 i = 0; i < o->size; i++) {
+            uop->operand |= cartridge_prg_rd(state, addr + 1 + i) << (8 * i);
+        }
+        block->cycles += o->cycles;
+        if (is_flow(o->exec) || is_mapper_write(o, uop->operand)) break;
+        addr += 1 + o->size;
+    }
+    if (block->count) cache_idle(block);
+}
+
+// Returns the cached instruction at PC, or NULL if it has to be interpreted
+static nes_uop_t const* cache_next(nes_t* state) {
+    u16 pc = state->cpu.pc;
+    nes_block_t const* block = state->cache.block;
+    nes_uop_t const* next = state->cache.uop + 1;
+
+    // Fall through to the next instruction of the current block
+    if (block && next < block->uops + block->count && next->pc == pc) {
+        return state->cache.uop = next;
+    }
+    if (pc < NES_PRG_DATA_OFFSET) {
+        state->cache.block = NULL;
+        return state->cache.uop = NULL;
+    }
+
+    nes_block_t* entry = cache_entry(state, pc);
+    if (!entry->count || entry->pc != pc || entry->bank != cache_bank(state, pc)) {
+        cache_decode(state, entry, pc);
+    } else if (
+      entry->idle && block == entry && state->cache.uop == &entry->uops[entry->count - 1]) {
+        // Branched back to the start of an idle loop after a full iteration
+        cache_skip_idle(state, entry);
+    }
+    state->cache.block = entry;
+    return state->cache.uop = entry->count ? entry->uops : NULL;
+}
+
+static void cache_reset(nes_t* state) {
+    for (size_t i = 0; i < NES_BLOCK_CACHE_SIZE; i++) {
+        state->cache.blocks[i].count = 0;
+    }
+    state->cache.block = NULL;
+    state->cache.uop = NULL;
+}
+#endif // NES_CPU_BLOCK_CACHE
+
+#ifdef NES_CPU_JIT
+// Run the native translation of the block just entered by cache_next, translating it once it is
+// hot. Returns false if the instruction at PC has to be interpreted.
+static bool jit_execute(nes_t* state) {
+    nes_block_t* block = state->cache.block;
+    // Events are only handled between steps, interpret blocks that would run past the next one
+    if (state->cpu.cycle + block->cycles >= state->scheduler.next) return false;
+    if (!block->code) {
+        if (block->hits == NES_JIT_REJECTED) return false;
+        if (++block->hits < NES_JIT_THRESHOLD) return false;
+        if (!jit_compile(state, block)) {
+            block->hits = NES_JIT_REJECTED;
+            return false;
+        }
+    }
+
+    u8 executed = block->code(state);
+    // cpu_step counts the last one
+    state->cpu.instructions += executed - 1;
+    // Interpret the rest of the block from the cache
+    state->cache.uop = &block->uops[executed - 1];
+    return true;
+}
+#endif // NES_CPU_JIT
+
 /* CPU Execution */
 
+#if defined(NES_CPU_COMPUTED_GOTO) && defined(__GNUC__)
+// Labels as values are a GNU extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
 static void execute_instruction(nes_t* state) {
+#define OPCODE_LABEL(op, fn, m, cyc, mnemonic) [op] = &&op_##op,
+    static void* const dispatch[256] = { CPU_OPCODE_TABLE(OPCODE_LABEL) };
+#undef OPCODE_LABEL
+
+#ifdef NES_CPU_BLOCK_CACHE
+#define OPCODE_LABEL(op, fn, m, cyc, mnemonic) [op] = &&cached_op_##op,
+    static void* const dispatch_cached[256] = { CPU_OPCODE_TABLE(OPCODE_LABEL) };
+#undef OPCODE_LABEL
+
+    nes_uop_t const* uop = cache_next(state);
+#ifdef NES_CPU_JIT
+    // Translated code is only entered at the start of a block
+    if (uop && uop == state->cache.block->uops && jit_execute(state)) return;
+#endif
+    if (uop) {
+        // Opcode was fetched when the block was decoded
+        state->cpu.pc++;
+        tick(state);
+        goto *dispatch_cached[uop->op];
+    }
+#endif
+
     // Fetch
-    u8 op = memory_read(state, state->cpu.pc++);
+    u8 op = fetch(state);
     tick(state);
 
-#define INSTRUCTION_CASE_DEFAULT(op, fn)                                                           \
-    case op: {                                                                                     \
-        fn(state);                                                                                 \
-        break;                                                                                     \
+    // Decode/Execute
+    goto *dispatch[op];
+
+#define OPCODE_TARGET(op, fn, m, cyc, mnemonic)                                                    \
+    op_##op: instr_##fn(state, addr_##m);                                                          \
+    return;
+    CPU_OPCODE_TABLE(OPCODE_TARGET)
+#undef OPCODE_TARGET
+
+#ifdef NES_CPU_BLOCK_CACHE
+#define OPCODE_TARGET(op, fn, m, cyc, mnemonic)                                                    \
+    cached_op_##op: instr_##fn(state, cached_##m);                                                 \
+    return;
+    CPU_OPCODE_TABLE(OPCODE_TARGET)
+#undef OPCODE_TARGET
+#endif
+}
+
+#pragma GCC diagnostic pop
+#else
+// One handler per opcode, the table dispatch only makes a single indirect call
+#define OPCODE_HANDLER(op, fn, m, cyc, mnemonic)                                                   \
+    static void op_##op(nes_t* state) {                                                            \
+        instr_##fn(state, addr_##m);                                                               \
     }
+CPU_OPCODE_TABLE(OPCODE_HANDLER)
+#undef OPCODE_HANDLER
 
-#define INSTRUCTION_CASE_VARIANT(op, fn, variant)                                                  \
-    case op: {                                                                                     \
-        fn(state, variant);                                                                        \
-        break;                                                                                     \
+#ifdef NES_CPU_BLOCK_CACHE
+#define OPCODE_HANDLER(op, fn, m, cyc, mnemonic)                                                   \
+    static void cached_op_##op(nes_t* state) {                                                     \
+        instr_##fn(state, cached_##m);                                                             \
     }
+CPU_OPCODE_TABLE(OPCODE_HANDLER)
+#undef OPCODE_HANDLER
+#endif
 
-    // Decode/Execute
-    switch (op) {
-        INSTRUCTION_CASE_DEFAULT(0x00, BRK)
-        INSTRUCTION_CASE_VARIANT(0x01, instr_ora, addr_xind)
-        INSTRUCTION_CASE_VARIANT(0x05, instr_ora, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0x06, instr_asl, addr_zp)
-        INSTRUCTION_CASE_DEFAULT(0x08, instr_php)
-        INSTRUCTION_CASE_VARIANT(0x09, instr_ora, addr_imm)
-        INSTRUCTION_CASE_DEFAULT(0x0A, instr_asl_a)
-        INSTRUCTION_CASE_VARIANT(0x0D, instr_ora, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x0E, instr_asl, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x10, instr_bpl, addr_rel)
-        INSTRUCTION_CASE_VARIANT(0x11, instr_ora, addr_indy_rd)
-        INSTRUCTION_CASE_VARIANT(0x15, instr_ora, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0x16, instr_asl, addr_zpx)
-        INSTRUCTION_CASE_DEFAULT(0x18, instr_clc)
-        INSTRUCTION_CASE_VARIANT(0x19, instr_ora, addr_absy_rd)
-        INSTRUCTION_CASE_VARIANT(0x1D, instr_ora, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0x1E, instr_asl, addr_absx_wr)
-        INSTRUCTION_CASE_DEFAULT(0x20, instr_jsr)
-        INSTRUCTION_CASE_VARIANT(0x21, instr_and, addr_xind)
-        INSTRUCTION_CASE_VARIANT(0x24, instr_bit, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0x25, instr_and, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0x26, instr_rol, addr_zp)
-        INSTRUCTION_CASE_DEFAULT(0x28, instr_plp)
-        INSTRUCTION_CASE_VARIANT(0x29, instr_and, addr_imm)
-        INSTRUCTION_CASE_DEFAULT(0x2A, instr_rol_a)
-        INSTRUCTION_CASE_VARIANT(0x2C, instr_bit, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x2D, instr_and, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x2E, instr_rol, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x30, instr_bmi, addr_rel)
-        INSTRUCTION_CASE_VARIANT(0x31, instr_and, addr_indy_rd)
-        INSTRUCTION_CASE_VARIANT(0x35, instr_and, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0x36, instr_rol, addr_zpx)
-        INSTRUCTION_CASE_DEFAULT(0x38, instr_sec)
-        INSTRUCTION_CASE_VARIANT(0x39, instr_and, addr_absy_rd)
-        INSTRUCTION_CASE_VARIANT(0x3D, instr_and, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0x3E, instr_rol, addr_absx_wr)
-        INSTRUCTION_CASE_DEFAULT(0x40, instr_rti)
-        INSTRUCTION_CASE_VARIANT(0x41, instr_eor, addr_xind)
-        INSTRUCTION_CASE_VARIANT(0x45, instr_eor, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0x46, instr_lsr, addr_zp)
-        INSTRUCTION_CASE_DEFAULT(0x48, instr_pha)
-        INSTRUCTION_CASE_VARIANT(0x49, instr_eor, addr_imm)
-        INSTRUCTION_CASE_DEFAULT(0x4A, instr_lsr_a)
-        INSTRUCTION_CASE_VARIANT(0x4C, instr_jmp, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x4D, instr_eor, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x4E, instr_lsr, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x50, instr_bvc, addr_rel)
-        INSTRUCTION_CASE_VARIANT(0x51, instr_eor, addr_indy_rd)
-        INSTRUCTION_CASE_VARIANT(0x55, instr_eor, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0x56, instr_lsr, addr_zpx)
-        INSTRUCTION_CASE_DEFAULT(0x58, instr_cli)
-        INSTRUCTION_CASE_VARIANT(0x59, instr_eor, addr_absy_rd)
-        INSTRUCTION_CASE_VARIANT(0x5D, instr_eor, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0x5E, instr_lsr, addr_absx_wr)
-        INSTRUCTION_CASE_DEFAULT(0x60, instr_rts)
-        INSTRUCTION_CASE_VARIANT(0x61, instr_adc, addr_xind)
-        INSTRUCTION_CASE_VARIANT(0x65, instr_adc, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0x66, instr_ror, addr_zp)
-        INSTRUCTION_CASE_DEFAULT(0x68, instr_pla)
-        INSTRUCTION_CASE_VARIANT(0x69, instr_adc, addr_imm)
-        INSTRUCTION_CASE_DEFAULT(0x6A, instr_ror_a)
-        INSTRUCTION_CASE_VARIANT(0x6C, instr_jmp, addr_ind)
-        INSTRUCTION_CASE_VARIANT(0x6D, instr_adc, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x6E, instr_ror, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x70, instr_bvs, addr_rel)
-        INSTRUCTION_CASE_VARIANT(0x71, instr_adc, addr_indy_rd)
-        INSTRUCTION_CASE_VARIANT(0x75, instr_adc, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0x76, instr_ror, addr_zpx)
-        INSTRUCTION_CASE_DEFAULT(0x78, instr_sei)
-        INSTRUCTION_CASE_VARIANT(0x79, instr_adc, addr_absy_rd)
-        INSTRUCTION_CASE_VARIANT(0x7D, instr_adc, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0x7E, instr_ror, addr_absx_wr)
-        INSTRUCTION_CASE_VARIANT(0x81, instr_sta, addr_xind)
-        INSTRUCTION_CASE_VARIANT(0x84, instr_sty, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0x85, instr_sta, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0x86, instr_stx, addr_zp)
-        INSTRUCTION_CASE_DEFAULT(0x88, instr_dey)
-        INSTRUCTION_CASE_DEFAULT(0x8A, instr_txa)
-        INSTRUCTION_CASE_VARIANT(0x8C, instr_sty, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x8D, instr_sta, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x8E, instr_stx, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x90, instr_bcc, addr_rel)
-        INSTRUCTION_CASE_VARIANT(0x91, instr_sta, addr_indy_wr)
-        INSTRUCTION_CASE_VARIANT(0x94, instr_sty, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0x95, instr_sta, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0x96, instr_stx, addr_zpy)
-        INSTRUCTION_CASE_DEFAULT(0x98, instr_tya)
-        INSTRUCTION_CASE_VARIANT(0x99, instr_sta, addr_absy_wr)
-        INSTRUCTION_CASE_DEFAULT(0x9A, instr_txs)
-        INSTRUCTION_CASE_VARIANT(0x9D, instr_sta, addr_absx_wr)
-        INSTRUCTION_CASE_VARIANT(0xA0, instr_ldy, addr_imm)
-        INSTRUCTION_CASE_VARIANT(0xA1, instr_lda, addr_xind)
-        INSTRUCTION_CASE_VARIANT(0xA2, instr_ldx, addr_imm)
-        INSTRUCTION_CASE_VARIANT(0xA4, instr_ldy, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0xA5, instr_lda, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0xA6, instr_ldx, addr_zp)
-        INSTRUCTION_CASE_DEFAULT(0xA8, instr_tay)
-        INSTRUCTION_CASE_VARIANT(0xA9, instr_lda, addr_imm)
-        INSTRUCTION_CASE_DEFAULT(0xAA, instr_tax)
-        INSTRUCTION_CASE_VARIANT(0xAC, instr_ldy, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0xAD, instr_lda, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0xAE, instr_ldx, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0xB0, instr_bcs, addr_rel)
-        INSTRUCTION_CASE_VARIANT(0xB1, instr_lda, addr_indy_rd)
-        INSTRUCTION_CASE_VARIANT(0xB4, instr_ldy, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0xB5, instr_lda, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0xB6, instr_ldx, addr_zpy)
-        INSTRUCTION_CASE_DEFAULT(0xB8, instr_clv)
-        INSTRUCTION_CASE_VARIANT(0xB9, instr_lda, addr_absy_rd)
-        INSTRUCTION_CASE_DEFAULT(0xBA, instr_tsx)
-        INSTRUCTION_CASE_VARIANT(0xBC, instr_ldy, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0xBD, instr_lda, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0xBE, instr_ldx, addr_absy_rd)
-        INSTRUCTION_CASE_VARIANT(0xC0, instr_cpy, addr_imm)
-        INSTRUCTION_CASE_VARIANT(0xC1, instr_cmp, addr_xind)
-        INSTRUCTION_CASE_VARIANT(0xC4, instr_cpy, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0xC5, instr_cmp, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0xC6, instr_dec, addr_zp)
-        INSTRUCTION_CASE_DEFAULT(0xC8, instr_iny)
-        INSTRUCTION_CASE_VARIANT(0xC9, instr_cmp, addr_imm)
-        INSTRUCTION_CASE_DEFAULT(0xCA, instr_dex)
-        INSTRUCTION_CASE_VARIANT(0xCC, instr_cpy, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0xCD, instr_cmp, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0xCE, instr_dec, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0xD0, instr_bne, addr_rel)
-        INSTRUCTION_CASE_VARIANT(0xD1, instr_cmp, addr_indy_rd)
-        INSTRUCTION_CASE_VARIANT(0xD5, instr_cmp, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0xD6, instr_dec, addr_zpx)
-        INSTRUCTION_CASE_DEFAULT(0xD8, instr_cld)
-        INSTRUCTION_CASE_VARIANT(0xD9, instr_cmp, addr_absy_rd)
-        INSTRUCTION_CASE_VARIANT(0xDD, instr_cmp, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0xDE, instr_dec, addr_absx_wr)
-        INSTRUCTION_CASE_VARIANT(0xE0, instr_cpx, addr_imm)
-        INSTRUCTION_CASE_VARIANT(0xE1, instr_sbc, addr_xind)
-        INSTRUCTION_CASE_VARIANT(0xE4, instr_cpx, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0xE5, instr_sbc, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0xE6, instr_inc, addr_zp)
-        INSTRUCTION_CASE_DEFAULT(0xE8, instr_inx)
-        INSTRUCTION_CASE_VARIANT(0xE9, instr_sbc, addr_imm)
-        INSTRUCTION_CASE_DEFAULT(0xEA, instr_nop)
-        INSTRUCTION_CASE_VARIANT(0xEC, instr_cpx, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0xED, instr_sbc, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0xEE, instr_inc, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0xF0, instr_beq, addr_rel)
-        INSTRUCTION_CASE_VARIANT(0xF1, instr_sbc, addr_indy_rd)
-        INSTRUCTION_CASE_VARIANT(0xF5, instr_sbc, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0xF6, instr_inc, addr_zpx)
-        INSTRUCTION_CASE_DEFAULT(0xF8, instr_sed)
-        INSTRUCTION_CASE_VARIANT(0xF9, instr_sbc, addr_absy_rd)
-        INSTRUCTION_CASE_VARIANT(0xFD, instr_sbc, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0xFE, instr_inc, addr_absx_wr)
-        // Illegal opcodes
-        INSTRUCTION_CASE_VARIANT(0x03, instr_slo, addr_xind)
-        INSTRUCTION_CASE_VARIANT(0x07, instr_slo, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0x0F, instr_slo, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x13, instr_slo, addr_indy_rd)
-        INSTRUCTION_CASE_VARIANT(0x17, instr_slo, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0x1B, instr_slo, addr_absy_rd)
-        INSTRUCTION_CASE_VARIANT(0x1F, instr_slo, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0x23, instr_rla, addr_xind)
-        INSTRUCTION_CASE_VARIANT(0x27, instr_rla, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0x2F, instr_rla, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x33, instr_rla, addr_indy_rd)
-        INSTRUCTION_CASE_VARIANT(0x37, instr_rla, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0x3B, instr_rla, addr_absy_rd)
-        INSTRUCTION_CASE_VARIANT(0x3F, instr_rla, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0x43, instr_sre, addr_xind)
-        INSTRUCTION_CASE_VARIANT(0x47, instr_sre, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0x4F, instr_sre, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x53, instr_sre, addr_indy_rd)
-        INSTRUCTION_CASE_VARIANT(0x57, instr_sre, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0x5B, instr_sre, addr_absy_rd)
-        INSTRUCTION_CASE_VARIANT(0x5F, instr_sre, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0x63, instr_rra, addr_xind)
-        INSTRUCTION_CASE_VARIANT(0x67, instr_rra, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0x6F, instr_rra, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x73, instr_rra, addr_indy_rd)
-        INSTRUCTION_CASE_VARIANT(0x77, instr_rra, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0x7B, instr_rra, addr_absy_rd)
-        INSTRUCTION_CASE_VARIANT(0x7F, instr_rra, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0x83, instr_sax, addr_xind)
-        INSTRUCTION_CASE_VARIANT(0x87, instr_sax, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0x8F, instr_sax, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x97, instr_sax, addr_zpy)
-        INSTRUCTION_CASE_VARIANT(0xA3, instr_lax, addr_xind)
-        INSTRUCTION_CASE_VARIANT(0xA7, instr_lax, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0xAB, instr_lax, addr_imm)
-        INSTRUCTION_CASE_VARIANT(0xAF, instr_lax, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0xB3, instr_lax, addr_indy_rd)
-        INSTRUCTION_CASE_VARIANT(0xB7, instr_lax, addr_zpy)
-        INSTRUCTION_CASE_VARIANT(0xBF, instr_lax, addr_absy_rd)
-        INSTRUCTION_CASE_VARIANT(0xC3, instr_dcp, addr_xind)
-        INSTRUCTION_CASE_VARIANT(0xC7, instr_dcp, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0xCB, instr_axs, addr_imm)
-        INSTRUCTION_CASE_VARIANT(0xCF, instr_dcp, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0xD3, instr_dcp, addr_indy_rd)
-        INSTRUCTION_CASE_VARIANT(0xD7, instr_dcp, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0xDB, instr_dcp, addr_absy_rd)
-        INSTRUCTION_CASE_VARIANT(0xDF, instr_dcp, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0xE3, instr_isc, addr_xind)
-        INSTRUCTION_CASE_VARIANT(0xE7, instr_isc, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0xEB, instr_sbc, addr_imm)
-        INSTRUCTION_CASE_VARIANT(0xEF, instr_isc, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0xF3, instr_isc, addr_indy_rd)
-        INSTRUCTION_CASE_VARIANT(0xF7, instr_isc, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0xFB, instr_isc, addr_absy_rd)
-        INSTRUCTION_CASE_VARIANT(0xFF, instr_isc, addr_absx_rd)
-        INSTRUCTION_CASE_DEFAULT(0x1A, instr_nop)
-        INSTRUCTION_CASE_DEFAULT(0x3A, instr_nop)
-        INSTRUCTION_CASE_DEFAULT(0x5A, instr_nop)
-        INSTRUCTION_CASE_DEFAULT(0x7A, instr_nop)
-        INSTRUCTION_CASE_DEFAULT(0xDA, instr_nop)
-        INSTRUCTION_CASE_DEFAULT(0xFA, instr_nop)
-        INSTRUCTION_CASE_VARIANT(0x04, instr_skb, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0x44, instr_skb, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0x64, instr_skb, addr_zp)
-        INSTRUCTION_CASE_VARIANT(0x14, instr_skb, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0x34, instr_skb, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0x54, instr_skb, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0x74, instr_skb, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0xD4, instr_skb, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0xF4, instr_skb, addr_zpx)
-        INSTRUCTION_CASE_VARIANT(0x80, instr_skb, addr_imm)
-        INSTRUCTION_CASE_VARIANT(0x82, instr_skb, addr_imm)
-        INSTRUCTION_CASE_VARIANT(0x89, instr_skb, addr_imm)
-        INSTRUCTION_CASE_VARIANT(0xC2, instr_skb, addr_imm)
-        INSTRUCTION_CASE_VARIANT(0xE2, instr_skb, addr_imm)
-        INSTRUCTION_CASE_VARIANT(0x0C, instr_skb, addr_absl)
-        INSTRUCTION_CASE_VARIANT(0x1C, instr_skb, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0x3C, instr_skb, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0x5C, instr_skb, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0x7C, instr_skb, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0xDC, instr_skb, addr_absx_rd)
-        INSTRUCTION_CASE_VARIANT(0xFC, instr_skb, addr_absx_rd)
-        default:
-            LOG("Unsupported instruction: 0x%02X\n", op);
-            instr_nop(state);
-            break;
+static void execute_instruction(nes_t* state) {
+#define OPCODE_HANDLER(op, fn, m, cyc, mnemonic) [op] = op_##op,
+    static void (*const dispatch[256])(nes_t*) = { CPU_OPCODE_TABLE(OPCODE_HANDLER) };
+#undef OPCODE_HANDLER
+
+#ifdef NES_CPU_BLOCK_CACHE
+#define OPCODE_HANDLER(op, fn, m, cyc, mnemonic) [op] = cached_op_##op,
+    static void (*const dispatch_cached[256])(nes_t*) = { CPU_OPCODE_TABLE(OPCODE_HANDLER) };
+#undef OPCODE_HANDLER
+
+    nes_uop_t const* uop = cache_next(state);
+#ifdef NES_CPU_JIT
+    // Translated code is only entered at the start of a block
+    if (uop && uop == state->cache.block->uops && jit_execute(state)) return;
+#endif
+    if (uop) {
+        // Opcode was fetched when the block was decoded
+        state->cpu.pc++;
+        tick(state);
+        dispatch_cached[uop->op](state);
+        return;
     }
+#endif
+
+    // Fetch
+    u8 op = fetch(state);
+    tick(state);
 
-#undef INSTRUCTION_CASE_DEFAULT
-#undef INSTRUCTION_CASE_VARIANT
+    // Decode/Execute
+    dispatch[op](state);
 }
+#endif // NES_CPU_COMPUTED_GOTO
 
 void cpu_init(nes_t* state) {
     state->cpu.a = 0x00;
     state->cpu.x = 0x00;
     state->cpu.y = 0x00;
     state->cpu.s = 0x00;
-    state->cpu.p = 0x00 | (1 << STATUS_INT_DISABLE) | (1 << STATUS_UNUSED);
+    set_p(state, 0x00 | (1 << STATUS_INT_DISABLE) | (1 << STATUS_UNUSED));
     state->cpu.nmi = 0;
     state->cpu.irq = 0;
     state->cpu.cycle = 0;
+    state->cpu.instructions = 0;
+#ifdef NES_CPU_BLOCK_CACHE
+    cache_reset(state);
+#endif
     interrupt_reset(state);
 }
 
@@ -1231,7 +1517,42 @@ void cpu_step(nes_t* state) {
         interrupt_irq(state);
     }
     execute_instruction(state);
+    state->cpu.instructions++;
+}
+
+u8 cpu_status(nes_t* state) {
+    return get_p(state);
+}
+
+void cpu_set_status(nes_t* state, u8 p) {
+    set_p(state, p);
+}
+
+#ifdef NES_CPU_BLOCK_CACHE
+// Returns the address following the idle loop starting at PC, 0 if PC does not start one
+u16 cpu_idle_loop(nes_t* state, u16 pc) {
+    if (pc < NES_PRG_DATA_OFFSET) return 0;
+    nes_block_t* entry = cache_entry(state, pc);
+    if (!entry->count || entry->pc != pc || entry->bank != cache_bank(state, pc)) {
+        // The interpreter resumes from a fresh block if it was executing the one replaced
+        if (entry == state->cache.block) {
+            state->cache.block = NULL;
+            state->cache.uop = NULL;
+        }
+        cache_decode(state, entry, pc);
+    }
+    if (!entry->idle) return 0;
+    nes_uop_t const* last = &entry->uops[entry->count - 1];
+    return last->pc + 1 + opcodes[last->op].size;
+}
+#endif
+
+#ifdef NES_CPU_BLOCK_CACHE
+// Drops all decoded blocks, for a console whose blocks were copied from another one
+void cpu_cache_reset(nes_t* state) {
+    cache_reset(state);
 }
+#endif
 
 void cpu_set_nmi(nes_t* state, bool enable) {
     state->cpu.nmi = enable;
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "nes.h"
+
+#include <stddef.h>
+
+// One console run: inputs are filled in by the caller, results by nes_batch_run
+typedef struct {
+    char const* rom;   // iNES file to power on
+    u8 const* input;   // Controller 1 buttons for each frame, released past the end, may be NULL
+    size_t input_size; // Number of frames in input
+    u32 frames;        // Frames to run
+
+    bool ok;          // ROM loaded and all frames ran
+    u64 ram_hash;     // FNV-1a hash of the 2kB of RAM after the last frame
+    u64 frame_hash;   // FNV-1a hash of the frame buffer after the last frame
+    u64 cycles;       // CPU cycles run
+    u64 instructions; // Instructions run
+    double seconds;   // Host time spent running the frames
+    unsigned worker;  // Worker that ran the job
+} nes_batch_job_t;
+
+typedef struct {
+    double seconds;   // Host time of the whole batch
+    u64 frames;       // Frames run by all jobs
+    u64 cycles;       // CPU cycles run by all jobs
+    u64 instructions; // Instructions run by all jobs
+    size_t failed;    // Jobs that did not run
+    size_t stolen;    // Jobs run by another worker than the one they were queued on
+} nes_batch_stats_t;
+
+bool nes_batch_run(
+  nes_batch_job_t* jobs, size_t count, unsigned workers, nes_batch_stats_t* stats);
@@ -14,4 +14,8 @@ u8 cartridge_prg_rd(nes_t* nes, u16 addr);
 u8 cartridge_chr_rd(nes_t* nes, u16 addr);
 void cartridge_prg_wr(nes_t* nes, u16 addr, u8 data);
 void cartridge_chr_wr(nes_t* nes, u16 addr, u8 data);
+u8 const* cartridge_chr_row(nes_t* nes, u16 addr, bool flip);
+void cartridge_chr_load(nes_t* nes, u8 const* data);
+void cartridge_fork(nes_t* child, nes_t* parent);
+bool cartridge_own(nes_t* nes);
 void reset(nes_t* nes);
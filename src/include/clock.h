@@ -0,0 +1,10 @@
+#pragma once
+
+#include <time.h>
+
+// Wall clock time in seconds, for timing runs on the host
+static inline double clock_now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "nes.h"
+
+// Standard controller buttons, in the order they are read
+enum {
+    CONTROLLER_A = 1 << 0,
+    CONTROLLER_B = 1 << 1,
+    CONTROLLER_SELECT = 1 << 2,
+    CONTROLLER_START = 1 << 3,
+    CONTROLLER_UP = 1 << 4,
+    CONTROLLER_DOWN = 1 << 5,
+    CONTROLLER_LEFT = 1 << 6,
+    CONTROLLER_RIGHT = 1 << 7,
+};
+
+void controller_init(nes_t* nes);
+void controller_set(nes_t* nes, u8 port, u8 buttons);
+u8 controller_rd(nes_t* nes, u8 port);
+void controller_wr(nes_t* nes, u8 data);
@@ -2,7 +2,25 @@
 
 #include "nes.h"
 
+// Processor status flag definitions
+enum {
+    STATUS_CARRY,       // [0] C: Carry flag
+    STATUS_ZERO,        // [1] Z: Zero flag
+    STATUS_INT_DISABLE, // [2] I: Interrupt disable
+    STATUS_DECIMAL,     // [3] D: Decimal mode, can be set/cleared but not used
+    STATUS_BREAK,       // [4] B: Break command
+    STATUS_UNUSED,      // [5] -: Not used, wired to 1
+    STATUS_OVERFLOW,    // [6] V: Overflow flag
+    STATUS_NEGATIVE,    // [7] N: Negative flag
+};
+
 void cpu_init(nes_t* state);
 void cpu_step(nes_t* state);
+u8 cpu_status(nes_t* state);
+void cpu_set_status(nes_t* state, u8 p);
+#ifdef NES_CPU_BLOCK_CACHE
+u16 cpu_idle_loop(nes_t* state, u16 pc);
+void cpu_cache_reset(nes_t* state);
+#endif
 void cpu_set_nmi(nes_t* state, bool enable);
 void cpu_set_irq(nes_t* state, bool enable);
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "nes.h"
+
+bool jit_init(nes_t* nes);
+void jit_free(nes_t* nes);
+bool jit_compile(nes_t* nes, nes_block_t* block);
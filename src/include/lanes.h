@@ -0,0 +1,18 @@
+#pragma once
+
+#include "nes.h"
+
+#include <stddef.h>
+
+// Consoles run together by one lane group, a power of two. 16 lanes of u8 registers fill an SSE
+// register, 32 an AVX2 one.
+#ifndef NES_LANES
+#define NES_LANES 16
+#endif
+
+typedef struct {
+    u64 vector; // Instructions run by the lane-parallel core, counted once per lane
+    u64 scalar; // Instructions run by the scalar core
+} nes_lanes_stats_t;
+
+void nes_lanes_run_frame(nes_t* const* consoles, size_t count, nes_lanes_stats_t* stats);
@@ -3,5 +3,37 @@
 #include "nes.h"
 
 void memory_init(nes_t* state);
-u8 memory_read(nes_t* state, u16 addr);
-void memory_write(nes_t* state, u16 addr, u8 data);
+void memory_map_prg(nes_t* state);
+void memory_map_prg_ram(nes_t* state);
+void memory_dirty_all(nes_t* state);
+u8 memory_io_read(nes_t* state, u16 addr);
+void memory_io_write(nes_t* state, u16 addr, u8 data);
+
+// Flags the block of tracked memory holding offset as written, first is the memory's first flag
+static inline void memory_dirty(nes_t* state, u16 first, u16 offset) {
+#ifdef NES_DIRTY_PAGES
+    state->dirty.map[first + (offset >> NES_DIRTY_BLOCK_SHIFT)] = 1;
+#else
+    (void)state;
+    (void)first;
+    (void)offset;
+#endif
+}
+
+// Pages backed by host memory are accessed through the page tables, the rest are I/O
+static inline u8 memory_read(nes_t* state, u16 addr) {
+    u8 const* page = state->memory.read_map[addr >> 8];
+    return page ? page[addr & 0xFF] : memory_io_read(state, addr);
+}
+
+static inline void memory_write(nes_t* state, u16 addr, u8 data) {
+    u8* page = state->memory.write_map[addr >> 8];
+    if (page) {
+        page[addr & 0xFF] = data;
+#ifdef NES_DIRTY_PAGES
+        memory_dirty(state, state->dirty.page[addr >> 8], addr & 0xFF);
+#endif
+    } else {
+        memory_io_write(state, addr, data);
+    }
+}
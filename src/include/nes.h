@@ -30,29 +30,228 @@
 #define NES_HEADER_SIZE 0x10
 #define NES_PRG_DATA_UNIT_SIZE 0x4000
 #define NES_PRG_RAM_UNIT_SIZE 0x2000
+#define NES_CHR_DATA_UNIT_SIZE 0x2000
 #define NES_PRG_SLOT_SIZE 0x2000
 #define NES_CHR_SLOT_SIZE 0x400
+#define NES_PAGE_SIZE 0x100
+#define NES_PAGE_COUNT 0x100
+
+#define NES_VRAM_SIZE 0x800
 
 #define NES_DISPLAY_WIDTH 256
 #define NES_DISPLAY_HEIGHT 240
 
+/* PPU registers */
+// PPUCTRL ($2000)
+typedef union {
+    struct {
+        unsigned nt : 2;     // Nametable ($2000 / $2400 / $2800 / $2C00).
+        unsigned incr : 1;   // Address increment (1 / 32).
+        unsigned sprTbl : 1; // Sprite pattern table ($0000 / $1000).
+        unsigned bgTbl : 1;  // BG pattern table ($0000 / $1000).
+        unsigned sprSz : 1;  // Sprite size (8x8 / 8x16).
+        unsigned slave : 1;  // PPU master/slave.
+        unsigned nmi : 1;    // Enable NMI.
+    };
+    u8 r;
+} ppu_ctrl_t;
+
+// PPUMASK ($2001)
+typedef union {
+    struct {
+        unsigned gray : 1;    // Grayscale.
+        unsigned bgLeft : 1;  // Show background in leftmost 8 pixels.
+        unsigned sprLeft : 1; // Show sprite in leftmost 8 pixels.
+        unsigned bg : 1;      // Show background.
+        unsigned spr : 1;     // Show sprites.
+        unsigned red : 1;     // Intensify reds.
+        unsigned green : 1;   // Intensify greens.
+        unsigned blue : 1;    // Intensify blues.
+    };
+    u8 r;
+} ppu_mask_t;
+
+// PPUSTATUS ($2002)
+typedef union {
+    struct {
+        unsigned bus : 5;    // Not significant.
+        unsigned sprOvf : 1; // Sprite overflow.
+        unsigned sprHit : 1; // Sprite 0 Hit.
+        unsigned vBlank : 1; // In VBlank?
+    };
+    u8 r;
+} ppu_status_t;
+
+// PPUSCROLL ($2005) and PPUADDR ($2006)
+typedef union {
+    struct {
+        unsigned cX : 5; // Coarse X.
+        unsigned cY : 5; // Coarse Y.
+        unsigned nt : 2; // Nametable.
+        unsigned fY : 3; // Fine Y.
+    };
+    struct {
+        unsigned l : 8;
+        unsigned h : 7;
+    };
+    unsigned addr : 14;
+    unsigned r : 15;
+} ppu_addr_t;
+
+typedef struct {
+    u8 id;        // Index in OAM
+    u8 x;         // X position
+    u8 y;         // Y position
+    u8 tile;      // Tile index
+    u8 attr;      // Attributes
+    u8 dataL;     // Tile data (low)
+    u8 dataH;     // Tile data (high)
+    u8 pixels[8]; // Tile data decoded, left to right after flipping
+} ppu_sprite_t;
+
+typedef enum {
+    HORIZONTAL,
+    VERTICAL,
+} ppu_mirror_t;
+
+struct nes;
+
+// Events the CPU runs up to before devices are caught up
+typedef enum {
+    NES_EVENT_PPU_VBLANK,  // PPU enters vblank, raising NMI if enabled
+    NES_EVENT_PPU_SPRITE0, // Sprite 0 line starts, earliest possible sprite 0 hit
+    NES_EVENT_MAPPER_IRQ,  // Mapper IRQ counter expires
+    NES_EVENT_APU_FRAME,   // APU frame counter raises its IRQ
+    NES_EVENT_RUN_END,     // End of the cycle budget given to nes_run_cycles
+    NES_EVENT_COUNT,
+} nes_event_t;
+
+#define NES_EVENT_NEVER UINT64_MAX
+
+#ifdef NES_CPU_JIT
+#define NES_JIT_BUFFER_SIZE 0x40000 // Size of the native code buffer in bytes
+#define NES_JIT_THRESHOLD 2         // Block entries before the block is translated
+#define NES_JIT_REJECTED 0xFF       // Block starts with an instruction the JIT cannot translate
+
+// Native translation of a block, returns the number of instructions it executed
+typedef u8 (*nes_jit_code_t)(struct nes* nes);
+#endif // NES_CPU_JIT
+
+// Written memory is tracked in blocks of NES_DIRTY_BLOCK_SIZE bytes, each tracked memory has a
+// range of flags in the dirty map starting at the given index
+#define NES_DIRTY_BLOCK_SHIFT 6
+#define NES_DIRTY_BLOCK_SIZE (1 << NES_DIRTY_BLOCK_SHIFT)
+#define NES_DIRTY_RAM 0
+#define NES_DIRTY_PRG_RAM (NES_DIRTY_RAM + NES_RAM_SIZE / NES_DIRTY_BLOCK_SIZE)
+#define NES_DIRTY_CHR_RAM (NES_DIRTY_PRG_RAM + NES_PRG_RAM_UNIT_SIZE / NES_DIRTY_BLOCK_SIZE)
+#define NES_DIRTY_VRAM (NES_DIRTY_CHR_RAM + NES_CHR_DATA_UNIT_SIZE / NES_DIRTY_BLOCK_SIZE)
+#define NES_DIRTY_COUNT (NES_DIRTY_VRAM + NES_VRAM_SIZE / NES_DIRTY_BLOCK_SIZE)
+
+#ifdef NES_CPU_BLOCK_CACHE
+#define NES_BLOCK_CACHE_SIZE 256 // Number of cached blocks, power of two
+#define NES_BLOCK_MAX_UOPS 16    // Maximum number of instructions in a block
+
+// Pre-decoded instruction
 typedef struct {
+    u16 pc;      // Address of the opcode
+    u16 operand; // Operand bytes: address for ZP/absolute modes, pointer or offset otherwise
+    u8 op;       // Opcode
+    u8 cycles;   // Base cycles
+} nes_uop_t;
+
+// Straight-line run of PRG-ROM instructions, ending at a control transfer
+typedef struct {
+    u32 bank;   // prg_map entry the block was decoded from
+    u16 pc;     // Address of the first instruction
+    u16 cycles; // Sum of the base cycles of all instructions
+    u8 count;   // Number of decoded instructions, 0 if unused
+    u8 idle;    // Cycles per iteration if the block is an idle loop, 0 otherwise
+    bool poll;  // Idle loop reads PPUSTATUS
+#ifdef NES_CPU_JIT
+    u8 hits;             // Entries counted towards NES_JIT_THRESHOLD
+    nes_jit_code_t code; // Native translation, NULL if not translated
+#endif
+    nes_uop_t uops[NES_BLOCK_MAX_UOPS];
+} nes_block_t;
+#endif // NES_CPU_BLOCK_CACHE
+
+typedef struct nes {
     struct {
         u16 pc;
         u8 s;
         u8 a;
         u8 x;
         u8 y;
-        u8 p;
+        u8 p; // Status flags, C, Z, V and N are stale in lazy mode, see cpu_status
+#ifdef NES_CPU_LAZY_FLAGS
+        bool c; // C flag
+        u8 z;   // Zero if the Z flag is set
+        bool v; // V flag
+        u8 n;   // Bit 7 is the N flag
+#endif
         bool nmi;
         bool irq;
         u64 cycle;
+        u64 instructions; // Instructions executed, including skipped idle loop iterations
     } cpu;
 
     struct {
         u8 ram[NES_RAM_SIZE];
+        u8* read_map[NES_PAGE_COUNT];  // Host memory backing each page, NULL if handled as I/O
+        u8* write_map[NES_PAGE_COUNT]; // Host memory backing each page, NULL if handled as I/O
     } memory;
 
+    struct {
+        ppu_ctrl_t ctrl;
+        ppu_mask_t mask;
+        ppu_status_t status;
+        ppu_addr_t vAddr; // Current VRAM address
+        ppu_addr_t tAddr; // Temporary VRAM address
+        u8 fX;            // Fine X scroll
+        bool w;           // First or second write toggle of PPUSCROLL and PPUADDR
+        u8 bus;           // Last value written to or read from a register
+        u8 buffer;        // PPUDATA read buffer
+        ppu_mirror_t mirroring;
+
+        u8 ciRam[NES_VRAM_SIZE]; // Nametables
+        u8 cgRam[0x20];          // Palettes
+        u8 oamMem[0x100];
+        ppu_sprite_t oam[8];    // Sprites on the current line
+        ppu_sprite_t secOam[8]; // Sprites found for the next line
+        u8 oamAddr;
+        // Sprites of every line, found again from OAM after it or the sprite height changes
+        bool linesFound;
+        u8 lineCount[NES_DISPLAY_HEIGHT];      // Sprites on the line, 9 for any more than 8
+        u8 lineSprites[NES_DISPLAY_HEIGHT][8]; // OAM index of the first 8
+
+        // Background latches
+        u16 addr; // Address of the pending fetch
+        u8 nt, at, bgL, bgH;
+        // Background shift registers
+        u8 atShiftL, atShiftH;
+        u16 bgShiftL, bgShiftH;
+        u8 atLatchL, atLatchH;
+
+        bool frameOdd;
+        u16 scanline, dot;
+        bool skip; // Lines are not drawn, only checked for sprite 0 hits, see nes_skip_frame
+        u8 GRAM[NES_DISPLAY_WIDTH * NES_DISPLAY_HEIGHT]; // Palette index of every pixel
+
+        u64 cycle; // CPU cycle the PPU has caught up to
+        u64 frame; // Frames completed, counted when vblank starts
+    } ppu;
+
+    struct {
+        u8 buttons[2]; // Buttons held on each port, see controller.h
+        u8 shift[2];   // Buttons latched by the last strobe, not read yet
+        bool strobe;   // Buttons are latched continuously
+    } controller;
+
+    struct {
+        u64 next;                // Cycle of the earliest pending event
+        u64 at[NES_EVENT_COUNT]; // Cycle of each event, NES_EVENT_NEVER if not pending
+    } scheduler;
+
     struct {
         struct {
             u8 mapper;   // Mapper ID
@@ -64,16 +263,46 @@ typedef struct {
             bool has_prg_ram; // Cart contains additional PRG RAM
             u8 prg_ram_size;  // Size of PRG RAM in 8kB units if available
         } config;
-        u8* rom;
+        u8* rom;     // Shared with forks
         u8* prg;
-        u8* prg_ram;
-        u8* chr;
+        u8* prg_ram; // Shared with forks until written
+        u8* chr;     // CHR-RAM is shared with forks until written
+        u8* tiles;   // CHR decoded, shared with forks like CHR
+        bool shared; // PRG-RAM or CHR-RAM may be shared with a fork
         u32 prg_map[4];
         u32 chr_map[8];
         // u8 prg_bank;
         // u8 chr_bank;
     } cartridge;
+
+#ifdef NES_DIRTY_PAGES
+    struct {
+        u8 map[NES_DIRTY_COUNT];  // Set for every block written since the last checkpoint
+        u16 page[NES_PAGE_COUNT]; // Flag of the first block of each page backed by tracked memory
+    } dirty;
+#endif
+
+#ifdef NES_CPU_BLOCK_CACHE
+    struct {
+        nes_block_t blocks[NES_BLOCK_CACHE_SIZE];
+        nes_block_t* block;       // Block being executed
+        nes_uop_t const* uop;     // Instruction being executed
+    } cache;
+#endif
+
+#ifdef NES_CPU_JIT
+    struct {
+        u8* code;    // Executable buffer, NULL if the JIT is unavailable
+        size_t used; // Bytes of the buffer holding translations
+    } jit;
+#endif
 } nes_t;
 
 bool nes_init(nes_t* nes, char const* file);
+void nes_free(nes_t* nes);
 void nes_step(nes_t* nes);
+u64 nes_run_cycles(nes_t* nes, u64 cycles);
+u64 nes_run_frame(nes_t* nes);
+u64 nes_skip_frame(nes_t* nes);
+bool nes_copy(nes_t* nes, nes_t const* from);
+void nes_fork(nes_t* child, nes_t* parent);
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "nes.h"
+
+#include <stddef.h>
+
+#define NES_NETPLAY_WINDOW 8 // Most frames run ahead of the remote input, the deepest rollback
+#define NES_NETPLAY_HISTORY (2 * NES_NETPLAY_WINDOW) // Frames of input kept
+#define NES_NETPLAY_PACKET_SIZE (9 + NES_NETPLAY_WINDOW)
+#define NES_LOOPBACK_QUEUE 64 // Packets in flight to each side, more are dropped
+
+// Carries packets of at most NES_NETPLAY_PACKET_SIZE bytes to the other player. Packets may be
+// lost, duplicated or reordered.
+typedef struct {
+    void* context;
+    void (*send)(void* context, u8 const* data, size_t size);
+    size_t (*receive)(void* context, u8* data, size_t size); // Size of the next packet, 0 if none
+} nes_netplay_transport_t;
+
+typedef enum {
+    NES_NETPLAY_RAN,     // The frame was run
+    NES_NETPLAY_STALLED, // Too far ahead of the other player, the frame is to be run again later
+    NES_NETPLAY_FAILED,  // A rollback could not load its state, the session cannot go on
+} nes_netplay_result_t;
+
+// Two-player session on one side. The remote input of a frame is predicted until it arrives, a
+// wrong prediction rolls the console back to that frame and runs the frames again up to the
+// present.
+typedef struct {
+    nes_t* nes;
+    nes_netplay_transport_t transport;
+    u8 port;        // Controller port of the local player, the remote player uses the other one
+    u32 frame;      // Frames run
+    u32 confirmed;  // Frames with the remote input received, all frames before it
+    u32 acked;      // Frames with the local input received by the remote player
+    u8 last_remote; // Remote input of the frame before confirmed
+    u8 local[NES_NETPLAY_HISTORY];        // Local input of each frame
+    u8 remote[NES_NETPLAY_HISTORY];       // Remote input of each frame, received or predicted
+    bool received[NES_NETPLAY_HISTORY];   // Remote input of the frame was received
+    size_t state_size;
+    u8* states; // [NES_NETPLAY_WINDOW][state_size] State before each frame not confirmed
+    bool failed; // A rollback could not load its state, the console no longer follows the input
+
+    u64 stalls;                // Frames not run for being too far ahead of the other player
+    u64 rollbacks;             // Wrong predictions
+    u64 replayed;              // Frames run again after wrong predictions
+    u32 max_replayed;          // Most frames run again by one rollback
+    double replay_seconds;     // Host time of all rollbacks
+    double max_replay_seconds; // Host time of the slowest rollback
+} nes_netplay_t;
+
+typedef struct nes_loopback nes_loopback_t;
+
+typedef struct {
+    nes_loopback_t* loopback;
+    u8 side;
+} nes_loopback_end_t;
+
+typedef struct {
+    u8 data[NES_NETPLAY_PACKET_SIZE];
+    u8 size;
+    u32 deliver; // Tick the packet arrives at
+} nes_loopback_packet_t;
+
+// Transport between two sessions in the same process, delaying every packet by the latency plus a
+// random jitter, both counted in ticks. Ticking once per frame simulates a network with a
+// latency of that many frames.
+struct nes_loopback {
+    u32 latency;
+    u32 jitter; // Most ticks added to the latency
+    u32 clock;  // Ticks so far
+    u32 seed;
+    nes_loopback_end_t end[2];
+    nes_loopback_packet_t queue[2][NES_LOOPBACK_QUEUE]; // Packets in flight to each side
+    size_t count[2];
+    u64 sent;
+    u64 dropped;
+};
+
+bool nes_netplay_init(
+  nes_netplay_t* np, nes_t* nes, nes_netplay_transport_t transport, u8 port);
+void nes_netplay_free(nes_netplay_t* np);
+nes_netplay_result_t nes_netplay_frame(nes_netplay_t* np, u8 buttons);
+bool nes_netplay_poll(nes_netplay_t* np);
+
+void nes_loopback_init(nes_loopback_t* lb, u32 latency, u32 jitter, u32 seed);
+nes_netplay_transport_t nes_loopback_transport(nes_loopback_t* lb, u8 side);
+void nes_loopback_tick(nes_loopback_t* lb);
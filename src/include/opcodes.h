@@ -0,0 +1,306 @@
+#pragma once
+
+/* 6502 opcode table
+ * One entry per opcode, in opcode order:
+ *   X(opcode, handler, addressing mode, base cycles, mnemonic)
+ * - handler:  instruction implementation, instr_<handler> in cpu.c
+ * - mode:     addressing mode, addr_<mode> in cpu.c
+ * - cycles:   cycles taken by the handler without a page crossing or a taken branch
+ * - mnemonic: assembler name, illegal opcodes use their common unofficial names
+ * Opcodes with the "ill" handler are not implemented and execute as a 2 cycle NOP.
+ */
+#define CPU_OPCODE_TABLE(X)                                                                        \
+    X(0x00, brk, impl, 6, "BRK")                                                                   \
+    X(0x01, ora, xind, 6, "ORA")                                                                   \
+    X(0x02, ill, impl, 2, "KIL")                                                                   \
+    X(0x03, slo, xind, 8, "SLO")                                                                   \
+    X(0x04, skb, zp, 3, "NOP")                                                                     \
+    X(0x05, ora, zp, 3, "ORA")                                                                     \
+    X(0x06, asl, zp, 5, "ASL")                                                                     \
+    X(0x07, slo, zp, 5, "SLO")                                                                     \
+    X(0x08, php, impl, 3, "PHP")                                                                   \
+    X(0x09, ora, imm, 2, "ORA")                                                                    \
+    X(0x0A, asl_a, impl, 2, "ASL")                                                                 \
+    X(0x0B, ill, impl, 2, "ANC")                                                                   \
+    X(0x0C, skb, absl, 4, "NOP")                                                                   \
+    X(0x0D, ora, absl, 4, "ORA")                                                                   \
+    X(0x0E, asl, absl, 6, "ASL")                                                                   \
+    X(0x0F, slo, absl, 6, "SLO")                                                                   \
+    X(0x10, bpl, rel, 2, "BPL")                                                                    \
+    X(0x11, ora, indy_rd, 5, "ORA")                                                                \
+    X(0x12, ill, impl, 2, "KIL")                                                                   \
+    X(0x13, slo, indy_rd, 7, "SLO")                                                                \
+    X(0x14, skb, zpx, 4, "NOP")                                                                    \
+    X(0x15, ora, zpx, 4, "ORA")                                                                    \
+    X(0x16, asl, zpx, 6, "ASL")                                                                    \
+    X(0x17, slo, zpx, 6, "SLO")                                                                    \
+    X(0x18, clc, impl, 2, "CLC")                                                                   \
+    X(0x19, ora, absy_rd, 4, "ORA")                                                                \
+    X(0x1A, nop, impl, 2, "NOP")                                                                   \
+    X(0x1B, slo, absy_rd, 6, "SLO")                                                                \
+    X(0x1C, skb, absx_rd, 4, "NOP")                                                                \
+    X(0x1D, ora, absx_rd, 4, "ORA")                                                                \
+    X(0x1E, asl, absx_wr, 7, "ASL")                                                                \
+    X(0x1F, slo, absx_rd, 6, "SLO")                                                                \
+    X(0x20, jsr, impl, 6, "JSR")                                                                   \
+    X(0x21, and, xind, 6, "AND")                                                                   \
+    X(0x22, ill, impl, 2, "KIL")                                                                   \
+    X(0x23, rla, xind, 8, "RLA")                                                                   \
+    X(0x24, bit, zp, 3, "BIT")                                                                     \
+    X(0x25, and, zp, 3, "AND")                                                                     \
+    X(0x26, rol, zp, 5, "ROL")                                                                     \
+    X(0x27, rla, zp, 5, "RLA")                                                                     \
+    X(0x28, plp, impl, 4, "PLP")                                                                   \
+    X(0x29, and, imm, 2, "AND")                                                                    \
+    X(0x2A, rol_a, impl, 2, "ROL")                                                                 \
+    X(0x2B, ill, impl, 2, "ANC")                                                                   \
+    X(0x2C, bit, absl, 4, "BIT")                                                                   \
+    X(0x2D, and, absl, 4, "AND")                                                                   \
+    X(0x2E, rol, absl, 6, "ROL")                                                                   \
+    X(0x2F, rla, absl, 6, "RLA")                                                                   \
+    X(0x30, bmi, rel, 2, "BMI")                                                                    \
+    X(0x31, and, indy_rd, 5, "AND")                                                                \
+    X(0x32, ill, impl, 2, "KIL")                                                                   \
+    X(0x33, rla, indy_rd, 7, "RLA")                                                                \
+    X(0x34, skb, zpx, 4, "NOP")                                                                    \
+    X(0x35, and, zpx, 4, "AND")                                                                    \
+    X(0x36, rol, zpx, 6, "ROL")                                                                    \
+    X(0x37, rla, zpx, 6, "RLA")                                                                    \
+    X(0x38, sec, impl, 2, "SEC")                                                                   \
+    X(0x39, and, absy_rd, 4, "AND")                                                                \
+    X(0x3A, nop, impl, 2, "NOP")                                                                   \
+    X(0x3B, rla, absy_rd, 6, "RLA")                                                                \
+    X(0x3C, skb, absx_rd, 4, "NOP")                                                                \
+    X(0x3D, and, absx_rd, 4, "AND")                                                                \
+    X(0x3E, rol, absx_wr, 7, "ROL")                                                                \
+    X(0x3F, rla, absx_rd, 6, "RLA")                                                                \
+    X(0x40, rti, impl, 6, "RTI")                                                                   \
+    X(0x41, eor, xind, 6, "EOR")                                                                   \
+    X(0x42, ill, impl, 2, "KIL")                                                                   \
+    X(0x43, sre, xind, 8, "SRE")                                                                   \
+    X(0x44, skb, zp, 3, "NOP")                                                                     \
+    X(0x45, eor, zp, 3, "EOR")                                                                     \
+    X(0x46, lsr, zp, 5, "LSR")                                                                     \
+    X(0x47, sre, zp, 5, "SRE")                                                                     \
+    X(0x48, pha, impl, 3, "PHA")                                                                   \
+    X(0x49, eor, imm, 2, "EOR")                                                                    \
+    X(0x4A, lsr_a, impl, 2, "LSR")                                                                 \
+    X(0x4B, ill, impl, 2, "ALR")                                                                   \
+    X(0x4C, jmp, absl, 3, "JMP")                                                                   \
+    X(0x4D, eor, absl, 4, "EOR")                                                                   \
+    X(0x4E, lsr, absl, 6, "LSR")                                                                   \
+    X(0x4F, sre, absl, 6, "SRE")                                                                   \
+    X(0x50, bvc, rel, 2, "BVC")                                                                    \
+    X(0x51, eor, indy_rd, 5, "EOR")                                                                \
+    X(0x52, ill, impl, 2, "KIL")                                                                   \
+    X(0x53, sre, indy_rd, 7, "SRE")                                                                \
+    X(0x54, skb, zpx, 4, "NOP")                                                                    \
+    X(0x55, eor, zpx, 4, "EOR")                                                                    \
+    X(0x56, lsr, zpx, 6, "LSR")                                                                    \
+    X(0x57, sre, zpx, 6, "SRE")                                                                    \
+    X(0x58, cli, impl, 2, "CLI")                                                                   \
+    X(0x59, eor, absy_rd, 4, "EOR")                                                                \
+    X(0x5A, nop, impl, 2, "NOP")                                                                   \
+    X(0x5B, sre, absy_rd, 6, "SRE")                                                                \
+    X(0x5C, skb, absx_rd, 4, "NOP")                                                                \
+    X(0x5D, eor, absx_rd, 4, "EOR")                                                                \
+    X(0x5E, lsr, absx_wr, 7, "LSR")                                                                \
+    X(0x5F, sre, absx_rd, 6, "SRE")                                                                \
+    X(0x60, rts, impl, 6, "RTS")                                                                   \
+    X(0x61, adc, xind, 6, "ADC")                                                                   \
+    X(0x62, ill, impl, 2, "KIL")                                                                   \
+    X(0x63, rra, xind, 8, "RRA")                                                                   \
+    X(0x64, skb, zp, 3, "NOP")                                                                     \
+    X(0x65, adc, zp, 3, "ADC")                                                                     \
+    X(0x66, ror, zp, 5, "ROR")                                                                     \
+    X(0x67, rra, zp, 5, "RRA")                                                                     \
+    X(0x68, pla, impl, 4, "PLA")                                                                   \
+    X(0x69, adc, imm, 2, "ADC")                                                                    \
+    X(0x6A, ror_a, impl, 2, "ROR")                                                                 \
+    X(0x6B, ill, impl, 2, "ARR")                                                                   \
+    X(0x6C, jmp, ind, 5, "JMP")                                                                    \
+    X(0x6D, adc, absl, 4, "ADC")                                                                   \
+    X(0x6E, ror, absl, 6, "ROR")                                                                   \
+    X(0x6F, rra, absl, 6, "RRA")                                                                   \
+    X(0x70, bvs, rel, 2, "BVS")                                                                    \
+    X(0x71, adc, indy_rd, 5, "ADC")                                                                \
+    X(0x72, ill, impl, 2, "KIL")                                                                   \
+    X(0x73, rra, indy_rd, 7, "RRA")                                                                \
+    X(0x74, skb, zpx, 4, "NOP")                                                                    \
+    X(0x75, adc, zpx, 4, "ADC")                                                                    \
+    X(0x76, ror, zpx, 6, "ROR")                                                                    \
+    X(0x77, rra, zpx, 6, "RRA")                                                                    \
+    X(0x78, sei, impl, 2, "SEI")                                                                   \
+    X(0x79, adc, absy_rd, 4, "ADC")                                                                \
+    X(0x7A, nop, impl, 2, "NOP")                                                                   \
+    X(0x7B, rra, absy_rd, 6, "RRA")                                                                \
+    X(0x7C, skb, absx_rd, 4, "NOP")                                                                \
+    X(0x7D, adc, absx_rd, 4, "ADC")                                                                \
+    X(0x7E, ror, absx_wr, 7, "ROR")                                                                \
+    X(0x7F, rra, absx_rd, 6, "RRA")                                                                \
+    X(0x80, skb, imm, 2, "NOP")                                                                    \
+    X(0x81, sta, xind, 6, "STA")                                                                   \
+    X(0x82, skb, imm, 2, "NOP")                                                                    \
+    X(0x83, sax, xind, 6, "SAX")                                                                   \
+    X(0x84, sty, zp, 3, "STY")                                                                     \
+    X(0x85, sta, zp, 3, "STA")                                                                     \
+    X(0x86, stx, zp, 3, "STX")                                                                     \
+    X(0x87, sax, zp, 3, "SAX")                                                                     \
+    X(0x88, dey, impl, 2, "DEY")                                                                   \
+    X(0x89, skb, imm, 2, "NOP")                                                                    \
+    X(0x8A, txa, impl, 2, "TXA")                                                                   \
+    X(0x8B, ill, impl, 2, "XAA")                                                                   \
+    X(0x8C, sty, absl, 4, "STY")                                                                   \
+    X(0x8D, sta, absl, 4, "STA")                                                                   \
+    X(0x8E, stx, absl, 4, "STX")                                                                   \
+    X(0x8F, sax, absl, 4, "SAX")                                                                   \
+    X(0x90, bcc, rel, 2, "BCC")                                                                    \
+    X(0x91, sta, indy_wr, 6, "STA")                                                                \
+    X(0x92, ill, impl, 2, "KIL")                                                                   \
+    X(0x93, ill, impl, 2, "AHX")                                                                   \
+    X(0x94, sty, zpx, 4, "STY")                                                                    \
+    X(0x95, sta, zpx, 4, "STA")                                                                    \
+    X(0x96, stx, zpy, 4, "STX")                                                                    \
+    X(0x97, sax, zpy, 4, "SAX")                                                                    \
+    X(0x98, tya, impl, 2, "TYA")                                                                   \
+    X(0x99, sta, absy_wr, 5, "STA")                                                                \
+    X(0x9A, txs, impl, 2, "TXS")                                                                   \
+    X(0x9B, ill, impl, 2, "TAS")                                                                   \
+    X(0x9C, ill, impl, 2, "SHY")                                                                   \
+    X(0x9D, sta, absx_wr, 5, "STA")                                                                \
+    X(0x9E, ill, impl, 2, "SHX")                                                                   \
+    X(0x9F, ill, impl, 2, "AHX")                                                                   \
+    X(0xA0, ldy, imm, 2, "LDY")                                                                    \
+    X(0xA1, lda, xind, 6, "LDA")                                                                   \
+    X(0xA2, ldx, imm, 2, "LDX")                                                                    \
+    X(0xA3, lax, xind, 6, "LAX")                                                                   \
+    X(0xA4, ldy, zp, 3, "LDY")                                                                     \
+    X(0xA5, lda, zp, 3, "LDA")                                                                     \
+    X(0xA6, ldx, zp, 3, "LDX")                                                                     \
+    X(0xA7, lax, zp, 3, "LAX")                                                                     \
+    X(0xA8, tay, impl, 2, "TAY")                                                                   \
+    X(0xA9, lda, imm, 2, "LDA")                                                                    \
+    X(0xAA, tax, impl, 2, "TAX")                                                                   \
+    X(0xAB, lax, imm, 2, "LAX")                                                                    \
+    X(0xAC, ldy, absl, 4, "LDY")                                                                   \
+    X(0xAD, lda, absl, 4, "LDA")                                                                   \
+    X(0xAE, ldx, absl, 4, "LDX")                                                                   \
+    X(0xAF, lax, absl, 4, "LAX")                                                                   \
+    X(0xB0, bcs, rel, 2, "BCS")                                                                    \
+    X(0xB1, lda, indy_rd, 5, "LDA")                                                                \
+    X(0xB2, ill, impl, 2, "KIL")                                                                   \
+    X(0xB3, lax, indy_rd, 5, "LAX")                                                                \
+    X(0xB4, ldy, zpx, 4, "LDY")                                                                    \
+    X(0xB5, lda, zpx, 4, "LDA")                                                                    \
+    X(0xB6, ldx, zpy, 4, "LDX")                                                                    \
+    X(0xB7, lax, zpy, 4, "LAX")                                                                    \
+    X(0xB8, clv, impl, 2, "CLV")                                                                   \
+    X(0xB9, lda, absy_rd, 4, "LDA")                                                                \
+    X(0xBA, tsx, impl, 2, "TSX")                                                                   \
+    X(0xBB, ill, impl, 2, "LAS")                                                                   \
+    X(0xBC, ldy, absx_rd, 4, "LDY")                                                                \
+    X(0xBD, lda, absx_rd, 4, "LDA")                                                                \
+    X(0xBE, ldx, absy_rd, 4, "LDX")                                                                \
+    X(0xBF, lax, absy_rd, 4, "LAX")                                                                \
+    X(0xC0, cpy, imm, 2, "CPY")                                                                    \
+    X(0xC1, cmp, xind, 6, "CMP")                                                                   \
+    X(0xC2, skb, imm, 2, "NOP")                                                                    \
+    X(0xC3, dcp, xind, 8, "DCP")                                                                   \
+    X(0xC4, cpy, zp, 3, "CPY")                                                                     \
+    X(0xC5, cmp, zp, 3, "CMP")                                                                     \
+    X(0xC6, dec, zp, 5, "DEC")                                                                     \
+    X(0xC7, dcp, zp, 5, "DCP")                                                                     \
+    X(0xC8, iny, impl, 2, "INY")                                                                   \
+    X(0xC9, cmp, imm, 2, "CMP")                                                                    \
+    X(0xCA, dex, impl, 2, "DEX")                                                                   \
+    X(0xCB, axs, imm, 2, "AXS")                                                                    \
+    X(0xCC, cpy, absl, 4, "CPY")                                                                   \
+    X(0xCD, cmp, absl, 4, "CMP")                                                                   \
+    X(0xCE, dec, absl, 6, "DEC")                                                                   \
+    X(0xCF, dcp, absl, 6, "DCP")                                                                   \
+    X(0xD0, bne, rel, 2, "BNE")                                                                    \
+    X(0xD1, cmp, indy_rd, 5, "CMP")                                                                \
+    X(0xD2, ill, impl, 2, "KIL")                                                                   \
+    X(0xD3, dcp, indy_rd, 7, "DCP")                                                                \
+    X(0xD4, skb, zpx, 4, "NOP")                                                                    \
+    X(0xD5, cmp, zpx, 4, "CMP")                                                                    \
+    X(0xD6, dec, zpx, 6, "DEC")                                                                    \
+    X(0xD7, dcp, zpx, 6, "DCP")                                                                    \
+    X(0xD8, cld, impl, 2, "CLD")                                                                   \
+    X(0xD9, cmp, absy_rd, 4, "CMP")                                                                \
+    X(0xDA, nop, impl, 2, "NOP")                                                                   \
+    X(0xDB, dcp, absy_rd, 6, "DCP")                                                                \
+    X(0xDC, skb, absx_rd, 4, "NOP")                                                                \
+    X(0xDD, cmp, absx_rd, 4, "CMP")                                                                \
+    X(0xDE, dec, absx_wr, 7, "DEC")                                                                \
+    X(0xDF, dcp, absx_rd, 6, "DCP")                                                                \
+    X(0xE0, cpx, imm, 2, "CPX")                                                                    \
+    X(0xE1, sbc, xind, 6, "SBC")                                                                   \
+    X(0xE2, skb, imm, 2, "NOP")                                                                    \
+    X(0xE3, isc, xind, 8, "ISC")                                                                   \
+    X(0xE4, cpx, zp, 3, "CPX")                                                                     \
+    X(0xE5, sbc, zp, 3, "SBC")                                                                     \
+    X(0xE6, inc, zp, 5, "INC")                                                                     \
+    X(0xE7, isc, zp, 5, "ISC")                                                                     \
+    X(0xE8, inx, impl, 2, "INX")                                                                   \
+    X(0xE9, sbc, imm, 2, "SBC")                                                                    \
+    X(0xEA, nop, impl, 2, "NOP")                                                                   \
+    X(0xEB, sbc, imm, 2, "SBC")                                                                    \
+    X(0xEC, cpx, absl, 4, "CPX")                                                                   \
+    X(0xED, sbc, absl, 4, "SBC")                                                                   \
+    X(0xEE, inc, absl, 6, "INC")                                                                   \
+    X(0xEF, isc, absl, 6, "ISC")                                                                   \
+    X(0xF0, beq, rel, 2, "BEQ")                                                                    \
+    X(0xF1, sbc, indy_rd, 5, "SBC")                                                                \
+    X(0xF2, ill, impl, 2, "KIL")                                                                   \
+    X(0xF3, isc, indy_rd, 7, "ISC")                                                                \
+    X(0xF4, skb, zpx, 4, "NOP")                                                                    \
+    X(0xF5, sbc, zpx, 4, "SBC")                                                                    \
+    X(0xF6, inc, zpx, 6, "INC")                                                                    \
+    X(0xF7, isc, zpx, 6, "ISC")                                                                    \
+    X(0xF8, sed, impl, 2, "SED")                                                                   \
+    X(0xF9, sbc, absy_rd, 4, "SBC")                                                                \
+    X(0xFA, nop, impl, 2, "NOP")                                                                   \
+    X(0xFB, isc, absy_rd, 6, "ISC")                                                                \
+    X(0xFC, skb, absx_rd, 4, "NOP")                                                                \
+    X(0xFD, sbc, absx_rd, 4, "SBC")                                                                \
+    X(0xFE, inc, absx_wr, 7, "INC")                                                                \
+    X(0xFF, isc, absx_rd, 6, "ISC")
+
+// Operand bytes per addressing mode
+enum {
+    OPERAND_impl = 0,
+    OPERAND_imm = 1,
+    OPERAND_zp = 1,
+    OPERAND_zpx = 1,
+    OPERAND_zpy = 1,
+    OPERAND_absl = 2,
+    OPERAND_absx_rd = 2,
+    OPERAND_absx_wr = 2,
+    OPERAND_absy_rd = 2,
+    OPERAND_absy_wr = 2,
+    OPERAND_ind = 2,
+    OPERAND_xind = 1,
+    OPERAND_indy_rd = 1,
+    OPERAND_indy_wr = 1,
+    OPERAND_rel = 1,
+};
+
+// Addressing modes
+typedef enum {
+    MODE_impl,
+    MODE_imm,
+    MODE_zp,
+    MODE_zpx,
+    MODE_zpy,
+    MODE_absl,
+    MODE_absx_rd,
+    MODE_absx_wr,
+    MODE_absy_rd,
+    MODE_absy_wr,
+    MODE_ind,
+    MODE_xind,
+    MODE_indy_rd,
+    MODE_indy_wr,
+    MODE_rel,
+} cpu_mode_t;
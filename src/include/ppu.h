@@ -1,21 +1,12 @@
 #pragma once
 
-#include "types.h"
-
-// typedef struct {
-
-// } ppu_state_t;
+#include "nes.h"
 
 typedef enum {
     WRITE,
     READ,
 } ppu_rw_t;
 
-typedef enum {
-    HORIZONTAL,
-    VERTICAL,
-} ppu_mirror_t;
-
 typedef enum {
     VISIBLE,
     POST,
@@ -23,23 +14,27 @@ typedef enum {
     PRE,
 } ppu_scanline_t;
 
-void ppu_set_mirror(ppu_mirror_t mode);
-u16 ppu_nt_mirror(u16 addr);
-u8 ppu_rd(u16 addr);
-void ppu_wr(u16 addr, u8 v);
-u8 ppu_reg_access(u16 index, u8 v, ppu_rw_t rw);
-u16 ppu_get_nt_addr();
-u16 ppu_get_at_addr();
-u16 ppu_get_bg_addr();
-void ppu_h_scroll();
-void ppu_v_scroll();
-void ppu_h_update();
-void ppu_v_update();
-void ppu_reload_shift();
-void ppu_clear_oam();
-void ppu_eval_sprites();
-void ppu_load_sprites();
-void ppu_update_pixels();
-void ppu_tick_scanline(ppu_scanline_t type);
-void ppu_tick();
-void ppu_reset();
+void ppu_set_mirror(nes_t* nes, ppu_mirror_t mode);
+u16 ppu_nt_mirror(nes_t* nes, u16 addr);
+u8 ppu_rd(nes_t* nes, u16 addr);
+void ppu_wr(nes_t* nes, u16 addr, u8 v);
+u8 ppu_reg_access(nes_t* nes, u16 index, u8 v, ppu_rw_t rw);
+u16 ppu_get_nt_addr(nes_t* nes);
+u16 ppu_get_at_addr(nes_t* nes);
+u16 ppu_get_bg_addr(nes_t* nes);
+void ppu_h_scroll(nes_t* nes);
+void ppu_v_scroll(nes_t* nes);
+void ppu_h_update(nes_t* nes);
+void ppu_v_update(nes_t* nes);
+void ppu_reload_shift(nes_t* nes);
+void ppu_clear_oam(nes_t* nes);
+void ppu_eval_sprites(nes_t* nes);
+void ppu_load_sprites(nes_t* nes);
+void ppu_decode_sprite(ppu_sprite_t* spr);
+void ppu_update_pixels(nes_t* nes);
+void ppu_tick_scanline(nes_t* nes, ppu_scanline_t type);
+void ppu_tick(nes_t* nes);
+void ppu_sync(nes_t* nes);
+void ppu_schedule(nes_t* nes);
+u64 ppu_status_change(nes_t* nes, u64 since);
+void ppu_reset(nes_t* nes);
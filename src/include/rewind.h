@@ -0,0 +1,37 @@
+#pragma once
+
+#include "nes.h"
+
+#include <stddef.h>
+
+typedef struct {
+    size_t offset; // Position in the ring
+    u32 size;      // Encoded size in bytes
+    u32 distance;  // Captures back to the keyframe, 0 for keyframes
+} nes_rewind_entry_t;
+
+// Ring of captured states, one per frame. Keyframes are stored whole, the captures between them as
+// differences to their keyframe, both run-length encoded. Restoring decodes at most two entries.
+typedef struct {
+    u32 frames;                  // Captures kept, as long as they fit the ring
+    u32 interval;                // Captures per keyframe
+    size_t capacity;             // Size of the ring in bytes
+    size_t used;                 // Bytes held by captures
+    u8* ring;                    // [capacity]
+    nes_rewind_entry_t* entries; // [frames + interval] Captures, oldest first from first
+    size_t first;                // Oldest capture
+    size_t count;                // Captures held
+    size_t tail;                 // Ring offset following the newest capture
+    u32 since_key;               // Captures since the newest keyframe, including it
+    size_t state_size;
+    bool current; // state holds the console's last capture or restore, captures update it
+    u8* state;    // [state_size] State being captured or restored
+    u8* keyframe; // [state_size] Keyframe the newest captures are relative to
+    u8* encoded;  // Capture being encoded, sized for the worst case
+} nes_rewind_t;
+
+bool nes_rewind_init(
+  nes_rewind_t* rw, nes_t const* nes, size_t capacity, u32 frames, u32 interval);
+void nes_rewind_free(nes_rewind_t* rw);
+bool nes_rewind_capture(nes_rewind_t* rw, nes_t* nes);
+bool nes_rewind_restore(nes_rewind_t* rw, nes_t* nes, size_t back);
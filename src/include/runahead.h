@@ -0,0 +1,23 @@
+#pragma once
+
+#include "nes.h"
+
+#include <stddef.h>
+
+// Shows every frame as it will look a number of frames later, hiding the input lag of the game.
+// Each frame is run, saved, followed by the frames run ahead with the same input and loaded again,
+// leaving the frame buffer with the last frame run ahead.
+typedef struct {
+    u32 frames; // Frames run ahead, 0 runs frames as usual
+    size_t state_size;
+    u8* state;            // [state_size] State after the last frame
+    double frame_seconds; // Host time of the last frame, including running ahead
+    double ahead_seconds; // Host time of the last frame spent running ahead
+    double total_seconds; // Host time of all frames, including running ahead
+    double total_ahead;   // Host time of all frames spent running ahead
+    u64 count;            // Frames run
+} nes_runahead_t;
+
+bool nes_runahead_init(nes_runahead_t* ra, nes_t const* nes, u32 frames);
+void nes_runahead_free(nes_runahead_t* ra);
+bool nes_runahead_frame(nes_runahead_t* ra, nes_t* nes);
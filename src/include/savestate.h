@@ -0,0 +1,12 @@
+#pragma once
+
+#include "nes.h"
+
+#include <stddef.h>
+
+#define NES_STATE_VERSION 1
+
+size_t nes_state_size(nes_t const* nes);
+size_t nes_state_save(nes_t* nes, void* buffer, size_t size);
+size_t nes_state_update(nes_t* nes, void* buffer, size_t size);
+bool nes_state_load(nes_t* nes, void const* buffer, size_t size);
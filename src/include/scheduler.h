@@ -0,0 +1,7 @@
+#pragma once
+
+#include "nes.h"
+
+void scheduler_init(nes_t* nes);
+void scheduler_set(nes_t* nes, nes_event_t event, u64 cycle);
+void scheduler_run(nes_t* nes);
@@ -0,0 +1,38 @@
+#pragma once
+
+#ifdef NES_CPU_LANES
+#include "lanes.h"
+#endif
+#include "nes.h"
+
+#include <stddef.h>
+
+#define NES_VEC_FRAME_SIZE (NES_DISPLAY_WIDTH * NES_DISPLAY_HEIGHT)
+
+struct nes_vec_pool;
+
+// Consoles running the same cartridge, stepped one frame at a time in lockstep. Buffers are struct
+// of arrays, console i owns element i of the per-console buffers and the i-th block of ram / frame.
+typedef struct {
+    size_t count;       // Number of consoles
+    u32 max_frames;     // Episode length in frames, 0 if episodes only end through reset
+    bool lanes;         // Run consoles through the lane-parallel core if built, see lanes.h
+    nes_t* consoles;    // [count]
+    nes_t* snapshot;    // State consoles return to when their episode ends
+    u8* input;          // [count] Controller 1 buttons for the next step, set by the caller
+    u8* reset;          // [count] Set by the caller to end the episode before the next step
+    u8* done;           // [count] Episode ended with the last step
+    u32* episode_frame; // [count] Frames run since the console was last reset
+    u8* ram;            // [count][NES_RAM_SIZE] RAM after the last step
+    u8* frame;          // [count][NES_VEC_FRAME_SIZE] Frame buffer after the last step
+    struct nes_vec_pool* pool;
+} nes_vec_t;
+
+bool nes_vec_init(nes_vec_t* vec, char const* rom, size_t count, unsigned workers, u32 warmup);
+void nes_vec_free(nes_vec_t* vec);
+void nes_vec_snapshot(nes_vec_t* vec, size_t index);
+void nes_vec_reset(nes_vec_t* vec);
+void nes_vec_step(nes_vec_t* vec);
+#ifdef NES_CPU_LANES
+void nes_vec_lanes_stats(nes_vec_t const* vec, nes_lanes_stats_t* stats);
+#endif
@@ -0,0 +1,760 @@
+// MAP_ANONYMOUS is not part of POSIX.1 under -std=c11
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "jit.h"
+
+#include "cartridge.h"
+#include "cpu.h"
+#include "nes.h"
+#include "opcodes.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* x86-64 block translator
+ * Translates the leading run of a cached block into native code working directly on nes_t.
+ * The generated function follows the System V ABI: the nes_t pointer arrives in rdi and the number
+ * of translated instructions executed is returned in eax. Registers and flags are loaded from and
+ * stored to nes_t around every instruction, only al, cl and dl are used as scratch registers.
+ *
+ * Translation stops before any instruction that is not supported or touches memory other than
+ * internal RAM or constant PRG-ROM from the block's own slot, so every I/O access ($2000 - $4017)
+ * and mapper access goes back through the interpreter. The cycles of all translated instructions
+ * are added once when the block exits, which is exact because nothing observable happens in
+ * between. CLI also ends translation so a pending IRQ is taken at the right instruction.
+ */
+
+#define JIT_MAX_BLOCK_SIZE 0x1000 // Upper bound for the code emitted for a single block
+
+// Scratch registers
+enum {
+    REG_AL,
+    REG_CL,
+    REG_DL,
+};
+
+// x86 condition codes
+enum {
+    CC_O = 0x0,
+    CC_C = 0x2,
+    CC_NC = 0x3,
+    CC_Z = 0x4,
+    CC_NZ = 0x5,
+    CC_S = 0x8,
+};
+
+#define OFF_A offsetof(nes_t, cpu.a)
+#define OFF_X offsetof(nes_t, cpu.x)
+#define OFF_Y offsetof(nes_t, cpu.y)
+#define OFF_S offsetof(nes_t, cpu.s)
+#define OFF_P offsetof(nes_t, cpu.p)
+#ifdef NES_CPU_LAZY_FLAGS
+#define OFF_C offsetof(nes_t, cpu.c)
+#define OFF_Z offsetof(nes_t, cpu.z)
+#define OFF_V offsetof(nes_t, cpu.v)
+#define OFF_N offsetof(nes_t, cpu.n)
+#endif
+#define OFF_PC offsetof(nes_t, cpu.pc)
+#define OFF_CYCLE offsetof(nes_t, cpu.cycle)
+#define OFF_RAM offsetof(nes_t, memory.ram)
+#ifdef NES_DIRTY_PAGES
+#define OFF_DIRTY offsetof(nes_t, dirty.map)
+#endif
+
+#define MODE_ENTRY(op, fn, m, cyc, mnemonic) [op] = MODE_##m,
+static u8 const modes[256] = { CPU_OPCODE_TABLE(MODE_ENTRY) };
+#undef MODE_ENTRY
+
+#define CYCLES_ENTRY(op, fn, m, cyc, mnemonic) [op] = cyc,
+static u8 const cycles[256] = { CPU_OPCODE_TABLE(CYCLES_ENTRY) };
+#undef CYCLES_ENTRY
+
+#define SIZE_ENTRY(op, fn, m, cyc, mnemonic) [op] = 1 + OPERAND_##m,
+static u8 const sizes[256] = { CPU_OPCODE_TABLE(SIZE_ENTRY) };
+#undef SIZE_ENTRY
+
+typedef struct {
+    u8* pos; // Next byte to emit
+    nes_t* nes;
+    nes_block_t const* block;
+} emitter_t;
+
+// Result of translating one instruction
+typedef enum {
+    JIT_UNSUPPORTED, // Nothing emitted, exit before the instruction
+    JIT_CONTINUE,    // Translated, continue with the next instruction
+    JIT_STOP,        // Translated, exit after the instruction
+    JIT_EXITED,      // Translated including the block exit
+} jit_result_t;
+
+/* Encoding */
+
+static void emit(emitter_t* e, u8 b) {
+    *e->pos++ = b;
+}
+
+static void emit16(emitter_t* e, u16 w) {
+    emit(e, w & 0xFF);
+    emit(e, w >> 8);
+}
+
+static void emit32(emitter_t* e, u32 d) {
+    emit16(e, d & 0xFFFF);
+    emit16(e, d >> 16);
+}
+
+// <opcode> r8, [rdi + disp32]
+static void emit_field(emitter_t* e, u8 opcode, u8 reg, u32 disp) {
+    emit(e, opcode);
+    emit(e, 0x87 | (reg << 3));
+    emit32(e, disp);
+}
+
+// <opcode> r8, [rdi + rax + disp32]
+static void emit_indexed(emitter_t* e, u8 opcode, u8 reg, u32 disp) {
+    emit(e, opcode);
+    emit(e, 0x84 | (reg << 3));
+    emit(e, 0x07);
+    emit32(e, disp);
+}
+
+// <opcode> byte [rdi + disp32], imm8
+static void emit_field_imm(emitter_t* e, u8 opcode, u8 ext, u32 disp, u8 imm) {
+    emit_field(e, opcode, ext, disp);
+    emit(e, imm);
+}
+
+static void load(emitter_t* e, u8 reg, u32 disp) {
+    emit_field(e, 0x8A, reg, disp);
+}
+
+static void store(emitter_t* e, u32 disp, u8 reg) {
+    emit_field(e, 0x88, reg, disp);
+}
+
+// mov r8, imm8
+static void load_imm(emitter_t* e, u8 reg, u8 imm) {
+    emit(e, 0xB0 + reg);
+    emit(e, imm);
+}
+
+// movzx eax, byte [rdi + disp32]
+static void load_index(emitter_t* e, u32 disp) {
+    emit(e, 0x0F);
+    emit_field(e, 0xB6, REG_AL, disp);
+}
+
+// <opcode> r/m8, r8 with both operands registers
+static void emit_rr(emitter_t* e, u8 opcode, u8 dst, u8 src) {
+    emit(e, opcode);
+    emit(e, 0xC0 | (src << 3) | dst);
+}
+
+#ifndef NES_CPU_LAZY_FLAGS
+// setcc r8
+static void emit_setcc(emitter_t* e, u8 cc, u8 reg) {
+    emit(e, 0x0F);
+    emit(e, 0x90 | cc);
+    emit(e, 0xC0 | reg);
+}
+#endif
+
+// Byte holding a flag and the bits of it to test, Z is set when they are all clear
+typedef struct {
+    u32 disp;
+    u8 mask;
+    bool inverted;
+} flag_loc_t;
+
+static flag_loc_t flag_loc(u8 flag) {
+#ifdef NES_CPU_LAZY_FLAGS
+    switch (flag) {
+        case STATUS_CARRY:
+            return (flag_loc_t) { OFF_C, 0x01, false };
+        case STATUS_ZERO:
+            return (flag_loc_t) { OFF_Z, 0xFF, true };
+        case STATUS_OVERFLOW:
+            return (flag_loc_t) { OFF_V, 0x01, false };
+        case STATUS_NEGATIVE:
+            return (flag_loc_t) { OFF_N, 0x80, false };
+    }
+#endif
+    return (flag_loc_t) { OFF_P, 1 << flag, false };
+}
+
+#ifdef NES_CPU_LAZY_FLAGS
+// setcc byte [rdi + disp32]
+static void store_setcc(emitter_t* e, u8 cc, u32 disp) {
+    emit(e, 0x0F);
+    emit_field(e, 0x90 | cc, 0, disp);
+}
+#else
+// Clear the status bits in mask and set them from cl
+static void merge_status(emitter_t* e, u8 mask) {
+    emit_field_imm(e, 0x80, 4, OFF_P, (u8)~mask); // and byte [p], ~mask
+    emit_field(e, 0x08, REG_CL, OFF_P);           // or [p], cl
+}
+#endif
+
+// Update N and Z from al
+static void update_nz(emitter_t* e) {
+#ifdef NES_CPU_LAZY_FLAGS
+    store(e, OFF_N, REG_AL);
+    store(e, OFF_Z, REG_AL);
+#else
+    emit_rr(e, 0x84, REG_AL, REG_AL); // test al, al
+    emit_setcc(e, CC_Z, REG_CL);
+    emit_setcc(e, CC_S, REG_DL);
+    emit(e, 0xD0); // shl cl, 1
+    emit(e, 0xE1);
+    emit(e, 0xC0); // shl dl, 7
+    emit(e, 0xE2);
+    emit(e, 7);
+    emit_rr(e, 0x08, REG_CL, REG_DL); // or cl, dl
+    merge_status(e, (1 << STATUS_ZERO) | (1 << STATUS_NEGATIVE));
+#endif
+}
+
+// Update C from the host carry, inverted for borrows
+static void update_c(emitter_t* e, u8 cc) {
+#ifdef NES_CPU_LAZY_FLAGS
+    store_setcc(e, cc, OFF_C);
+#else
+    emit_setcc(e, cc, REG_CL);
+    merge_status(e, 1 << STATUS_CARRY);
+#endif
+}
+
+// Load the 6502 carry into the host carry
+static void load_carry(emitter_t* e) {
+    load(e, REG_CL, flag_loc(STATUS_CARRY).disp);
+    emit(e, 0xD0); // shr cl, 1
+    emit(e, 0xE9);
+}
+
+// SEC, CLC and friends for flags other than Z and N
+static void assign_flag(emitter_t* e, u8 flag, bool set) {
+    flag_loc_t loc = flag_loc(flag);
+    if (loc.disp != OFF_P) {
+        emit_field_imm(e, 0xC6, 0, loc.disp, set); // mov byte [flag], set
+    } else if (set) {
+        emit_field_imm(e, 0x80, 1, OFF_P, loc.mask); // or byte [p], mask
+    } else {
+        emit_field_imm(e, 0x80, 4, OFF_P, (u8)~loc.mask); // and byte [p], ~mask
+    }
+}
+
+// Leave the block with PC set, cycles accounted and the instruction count returned
+static void emit_exit(emitter_t* e, u16 pc, u32 cycles, u8 count) {
+    // mov word [rdi + pc], imm16
+    emit(e, 0x66);
+    emit(e, 0xC7);
+    emit(e, 0x87);
+    emit32(e, OFF_PC);
+    emit16(e, pc);
+    // add qword [rdi + cycle], imm32
+    emit(e, 0x48);
+    emit(e, 0x81);
+    emit(e, 0x87);
+    emit32(e, OFF_CYCLE);
+    emit32(e, cycles);
+    // mov eax, count
+    emit(e, 0xB8);
+    emit32(e, count);
+    // ret
+    emit(e, 0xC3);
+}
+
+/* Operands */
+
+// Location of a memory operand
+typedef enum {
+    LOC_NONE,  // Not accessible from native code
+    LOC_RAM,   // Internal RAM at a fixed offset
+    LOC_ZP_X,  // Zero page indexed by X
+    LOC_ZP_Y,  // Zero page indexed by Y
+    LOC_CONST, // PRG-ROM in the block's slot, read as a constant
+} loc_kind_t;
+
+typedef struct {
+    loc_kind_t kind;
+    u32 disp; // Offset into nes_t, or the constant value
+} loc_t;
+
+static loc_t locate(emitter_t* e, nes_uop_t const* uop, bool write) {
+    loc_t loc = { LOC_NONE, 0 };
+    switch (modes[uop->op]) {
+        case MODE_zp:
+            loc.kind = LOC_RAM;
+            loc.disp = OFF_RAM + (uop->operand & 0xFF);
+            break;
+        case MODE_zpx:
+            loc.kind = LOC_ZP_X;
+            loc.disp = OFF_RAM;
+            break;
+        case MODE_zpy:
+            loc.kind = LOC_ZP_Y;
+            loc.disp = OFF_RAM;
+            break;
+        case MODE_absl:
+            if (uop->operand < 0x2000) {
+                loc.kind = LOC_RAM;
+                loc.disp = OFF_RAM + (uop->operand % NES_RAM_SIZE);
+            } else if (
+              !write && uop->operand >= NES_PRG_DATA_OFFSET &&
+              (uop->operand ^ e->block->pc) < NES_PRG_SLOT_SIZE) {
+                loc.kind = LOC_CONST;
+                loc.disp = cartridge_prg_rd(e->nes, uop->operand);
+            }
+            break;
+        default:
+            break;
+    }
+    return loc;
+}
+
+// Compute the zero page index of an indexed location into eax
+static void emit_zp_index(emitter_t* e, loc_t loc, nes_uop_t const* uop) {
+    load_index(e, loc.kind == LOC_ZP_X ? OFF_X : OFF_Y);
+    emit(e, 0x04); // add al, imm8
+    emit(e, uop->operand & 0xFF);
+}
+
+// mov|<opcode> reg, location
+static void emit_loc(emitter_t* e, u8 opcode, u8 reg, loc_t loc) {
+    if (loc.kind == LOC_RAM) {
+        emit_field(e, opcode, reg, loc.disp);
+    } else {
+        emit_indexed(e, opcode, reg, loc.disp);
+    }
+}
+
+// Flag the RAM block written through a location, indexed locations still have the index in eax
+static void mark_dirty(emitter_t* e, loc_t loc) {
+#ifdef NES_DIRTY_PAGES
+    if (loc.kind == LOC_RAM) {
+        u32 block = (loc.disp - OFF_RAM) >> NES_DIRTY_BLOCK_SHIFT;
+        emit_field_imm(e, 0xC6, 0, OFF_DIRTY + NES_DIRTY_RAM + block, 1); // mov byte [flag], 1
+    } else {
+        emit(e, 0xC1); // shr eax, shift
+        emit(e, 0xE8);
+        emit(e, NES_DIRTY_BLOCK_SHIFT);
+        emit_indexed(e, 0xC6, 0, OFF_DIRTY + NES_DIRTY_RAM); // mov byte [flag + rax], 1
+        emit(e, 1);
+    }
+#else
+    (void)e;
+    (void)loc;
+#endif
+}
+
+// Load the operand of a read instruction into dl
+static bool load_operand(emitter_t* e, nes_uop_t const* uop) {
+    if (modes[uop->op] == MODE_imm) {
+        load_imm(e, REG_DL, uop->operand & 0xFF);
+        return true;
+    }
+    loc_t loc = locate(e, uop, false);
+    switch (loc.kind) {
+        case LOC_NONE:
+            return false;
+        case LOC_CONST:
+            load_imm(e, REG_DL, loc.disp);
+            return true;
+        case LOC_ZP_X:
+        case LOC_ZP_Y:
+            emit_zp_index(e, loc, uop);
+            // fall through
+        case LOC_RAM:
+            emit_loc(e, 0x8A, REG_DL, loc);
+            return true;
+    }
+    return false;
+}
+
+/* Instructions */
+
+static jit_result_t translate_load(emitter_t* e, nes_uop_t const* uop, u32 reg_off) {
+    if (!load_operand(e, uop)) return JIT_UNSUPPORTED;
+    emit_rr(e, 0x88, REG_AL, REG_DL); // mov al, dl
+    store(e, reg_off, REG_AL);
+    update_nz(e);
+    return JIT_CONTINUE;
+}
+
+static jit_result_t translate_store(emitter_t* e, nes_uop_t const* uop, u32 reg_off) {
+    loc_t loc = locate(e, uop, true);
+    if (loc.kind == LOC_NONE) return JIT_UNSUPPORTED;
+    if (loc.kind != LOC_RAM) emit_zp_index(e, loc, uop);
+    load(e, REG_DL, reg_off);
+    emit_loc(e, 0x88, REG_DL, loc);
+    mark_dirty(e, loc);
+    return JIT_CONTINUE;
+}
+
+// AND, ORA, EOR: <opcode> al, dl
+static jit_result_t translate_logic(emitter_t* e, nes_uop_t const* uop, u8 opcode) {
+    if (!load_operand(e, uop)) return JIT_UNSUPPORTED;
+    load(e, REG_AL, OFF_A);
+    emit_rr(e, opcode, REG_AL, REG_DL);
+    store(e, OFF_A, REG_AL);
+    update_nz(e);
+    return JIT_CONTINUE;
+}
+
+static jit_result_t translate_compare(emitter_t* e, nes_uop_t const* uop, u32 reg_off) {
+    if (!load_operand(e, uop)) return JIT_UNSUPPORTED;
+    load(e, REG_AL, reg_off);
+    emit_rr(e, 0x28, REG_AL, REG_DL); // sub al, dl
+    update_c(e, CC_NC);
+    update_nz(e);
+    return JIT_CONTINUE;
+}
+
+// ADC, SBC as ADC of the inverted operand
+static jit_result_t translate_add(emitter_t* e, nes_uop_t const* uop, bool subtract) {
+    if (!load_operand(e, uop)) return JIT_UNSUPPORTED;
+    if (subtract) {
+        emit(e, 0xF6); // not dl
+        emit(e, 0xD2);
+    }
+    load_carry(e);
+    load(e, REG_AL, OFF_A);
+    emit_rr(e, 0x10, REG_AL, REG_DL); // adc al, dl
+#ifdef NES_CPU_LAZY_FLAGS
+    store_setcc(e, CC_C, OFF_C);
+    store_setcc(e, CC_O, OFF_V);
+    store(e, OFF_A, REG_AL);
+#else
+    emit_setcc(e, CC_C, REG_CL);
+    emit_setcc(e, CC_O, REG_DL);
+    store(e, OFF_A, REG_AL);
+    emit(e, 0xC0); // shl dl, 6
+    emit(e, 0xE2);
+    emit(e, STATUS_OVERFLOW);
+    emit_rr(e, 0x08, REG_CL, REG_DL); // or cl, dl
+    merge_status(e, (1 << STATUS_CARRY) | (1 << STATUS_OVERFLOW));
+#endif
+    update_nz(e);
+    return JIT_CONTINUE;
+}
+
+static jit_result_t translate_bit(emitter_t* e, nes_uop_t const* uop) {
+    if (!load_operand(e, uop)) return JIT_UNSUPPORTED;
+#ifdef NES_CPU_LAZY_FLAGS
+    store(e, OFF_N, REG_DL);
+    load(e, REG_AL, OFF_A);
+    emit_rr(e, 0x20, REG_AL, REG_DL); // and al, dl
+    store(e, OFF_Z, REG_AL);
+    emit(e, 0xF6); // test dl, 0x40
+    emit(e, 0xC2);
+    emit(e, 1 << STATUS_OVERFLOW);
+    store_setcc(e, CC_NZ, OFF_V);
+#else
+    load(e, REG_AL, OFF_A);
+    emit_rr(e, 0x20, REG_AL, REG_DL); // and al, dl
+    emit_setcc(e, CC_Z, REG_CL);
+    emit(e, 0xD0); // shl cl, 1
+    emit(e, 0xE1);
+    emit(e, 0x80); // and dl, 0xC0
+    emit(e, 0xE2);
+    emit(e, (1 << STATUS_NEGATIVE) | (1 << STATUS_OVERFLOW));
+    emit_rr(e, 0x08, REG_CL, REG_DL); // or cl, dl
+    merge_status(e, (1 << STATUS_ZERO) | (1 << STATUS_NEGATIVE) | (1 << STATUS_OVERFLOW));
+#endif
+    return JIT_CONTINUE;
+}
+
+// INC, DEC on memory: inc|dec dl, the index stays in eax until the result is stored
+static jit_result_t translate_rmw(emitter_t* e, nes_uop_t const* uop, u8 modrm) {
+    loc_t loc = locate(e, uop, true);
+    if (loc.kind == LOC_NONE) return JIT_UNSUPPORTED;
+    if (loc.kind != LOC_RAM) emit_zp_index(e, loc, uop);
+    emit_loc(e, 0x8A, REG_DL, loc);
+    emit(e, 0xFE);
+    emit(e, modrm | REG_DL);
+    emit_loc(e, 0x88, REG_DL, loc);
+    mark_dirty(e, loc);
+    emit_rr(e, 0x88, REG_AL, REG_DL); // mov al, dl
+    update_nz(e);
+    return JIT_CONTINUE;
+}
+
+// INX, INY, DEX, DEY: inc|dec al
+static jit_result_t translate_step(emitter_t* e, u32 reg_off, u8 modrm) {
+    load(e, REG_AL, reg_off);
+    emit(e, 0xFE);
+    emit(e, modrm);
+    store(e, reg_off, REG_AL);
+    update_nz(e);
+    return JIT_CONTINUE;
+}
+
+static jit_result_t translate_transfer(emitter_t* e, u32 from, u32 to, bool flags) {
+    load(e, REG_AL, from);
+    store(e, to, REG_AL);
+    if (flags) update_nz(e);
+    return JIT_CONTINUE;
+}
+
+// ASL, LSR, ROL, ROR on the accumulator: D0 /modrm
+static jit_result_t translate_shift(emitter_t* e, u8 modrm, bool rotate) {
+    if (rotate) load_carry(e);
+    load(e, REG_AL, OFF_A);
+    emit(e, 0xD0);
+    emit(e, modrm);
+    store(e, OFF_A, REG_AL);
+    update_c(e, CC_C);
+    update_nz(e);
+    return JIT_CONTINUE;
+}
+
+static jit_result_t translate_branch(
+  emitter_t* e, nes_uop_t const* uop, u8 flag, bool set, u32 cycles, u8 count) {
+    u16 next = uop->pc + 2;
+    u16 target = next + (s8)(uop->operand & 0xFF);
+    u32 taken = cycles + 1 + ((target & 0x100) != (next & 0x100));
+
+    flag_loc_t loc = flag_loc(flag);
+    // test byte [flag], mask
+    emit_field_imm(e, 0xF6, 0, loc.disp, loc.mask);
+    // Skip the taken exit if the condition does not hold
+    emit(e, 0x0F);
+    emit(e, 0x80 | (set != loc.inverted ? CC_Z : CC_NZ));
+    u8* rel = e->pos;
+    emit32(e, 0);
+    emit_exit(e, target, taken, count);
+    u32 offset = (u32)(e->pos - (rel + 4));
+    memcpy(rel, &offset, sizeof(offset));
+    emit_exit(e, next, cycles, count);
+    return JIT_EXITED;
+}
+
+static jit_result_t translate(emitter_t* e, nes_uop_t const* uop, u32 cycles, u8 count) {
+    switch (uop->op) {
+        // Load / Store operations
+        case 0xA9:
+        case 0xA5:
+        case 0xB5:
+        case 0xAD:
+            return translate_load(e, uop, OFF_A);
+        case 0xA2:
+        case 0xA6:
+        case 0xB6:
+        case 0xAE:
+            return translate_load(e, uop, OFF_X);
+        case 0xA0:
+        case 0xA4:
+        case 0xB4:
+        case 0xAC:
+            return translate_load(e, uop, OFF_Y);
+        case 0x85:
+        case 0x95:
+        case 0x8D:
+            return translate_store(e, uop, OFF_A);
+        case 0x86:
+        case 0x96:
+        case 0x8E:
+            return translate_store(e, uop, OFF_X);
+        case 0x84:
+        case 0x94:
+        case 0x8C:
+            return translate_store(e, uop, OFF_Y);
+        case 0xAA:
+            return translate_transfer(e, OFF_A, OFF_X, true);
+        case 0xA8:
+            return translate_transfer(e, OFF_A, OFF_Y, true);
+        case 0x8A:
+            return translate_transfer(e, OFF_X, OFF_A, true);
+        case 0x98:
+            return translate_transfer(e, OFF_Y, OFF_A, true);
+        case 0xBA:
+            return translate_transfer(e, OFF_S, OFF_X, true);
+        case 0x9A:
+            return translate_transfer(e, OFF_X, OFF_S, false);
+
+        // Arithmetic / Logical operations
+        case 0x29:
+        case 0x25:
+        case 0x35:
+        case 0x2D:
+            return translate_logic(e, uop, 0x20);
+        case 0x09:
+        case 0x05:
+        case 0x15:
+        case 0x0D:
+            return translate_logic(e, uop, 0x08);
+        case 0x49:
+        case 0x45:
+        case 0x55:
+        case 0x4D:
+            return translate_logic(e, uop, 0x30);
+        case 0x69:
+        case 0x65:
+        case 0x75:
+        case 0x6D:
+            return translate_add(e, uop, false);
+        case 0xE9:
+        case 0xE5:
+        case 0xF5:
+        case 0xED:
+            return translate_add(e, uop, true);
+        case 0x24:
+        case 0x2C:
+            return translate_bit(e, uop);
+
+        // Compares
+        case 0xC9:
+        case 0xC5:
+        case 0xD5:
+        case 0xCD:
+            return translate_compare(e, uop, OFF_A);
+        case 0xE0:
+        case 0xE4:
+        case 0xEC:
+            return translate_compare(e, uop, OFF_X);
+        case 0xC0:
+        case 0xC4:
+        case 0xCC:
+            return translate_compare(e, uop, OFF_Y);
+
+        // Increments / Decrements
+        case 0xE6:
+        case 0xF6:
+        case 0xEE:
+            return translate_rmw(e, uop, 0xC0);
+        case 0xC6:
+        case 0xD6:
+        case 0xCE:
+            return translate_rmw(e, uop, 0xC8);
+        case 0xE8:
+            return translate_step(e, OFF_X, 0xC0);
+        case 0xC8:
+            return translate_step(e, OFF_Y, 0xC0);
+        case 0xCA:
+            return translate_step(e, OFF_X, 0xC8);
+        case 0x88:
+            return translate_step(e, OFF_Y, 0xC8);
+
+        // Shifts
+        case 0x0A:
+            return translate_shift(e, 0xE0, false);
+        case 0x4A:
+            return translate_shift(e, 0xE8, false);
+        case 0x2A:
+            return translate_shift(e, 0xD0, true);
+        case 0x6A:
+            return translate_shift(e, 0xD8, true);
+
+        // Jumps / Branches
+        case 0x4C:
+            emit_exit(e, uop->operand, cycles, count);
+            return JIT_EXITED;
+        case 0x10:
+            return translate_branch(e, uop, STATUS_NEGATIVE, false, cycles, count);
+        case 0x30:
+            return translate_branch(e, uop, STATUS_NEGATIVE, true, cycles, count);
+        case 0x50:
+            return translate_branch(e, uop, STATUS_OVERFLOW, false, cycles, count);
+        case 0x70:
+            return translate_branch(e, uop, STATUS_OVERFLOW, true, cycles, count);
+        case 0x90:
+            return translate_branch(e, uop, STATUS_CARRY, false, cycles, count);
+        case 0xB0:
+            return translate_branch(e, uop, STATUS_CARRY, true, cycles, count);
+        case 0xD0:
+            return translate_branch(e, uop, STATUS_ZERO, false, cycles, count);
+        case 0xF0:
+            return translate_branch(e, uop, STATUS_ZERO, true, cycles, count);
+
+        // Status register operations
+        case 0x18:
+            assign_flag(e, STATUS_CARRY, false);
+            return JIT_CONTINUE;
+        case 0x38:
+            assign_flag(e, STATUS_CARRY, true);
+            return JIT_CONTINUE;
+        case 0x58:
+            // Give a pending IRQ the chance to be taken after CLI
+            assign_flag(e, STATUS_INT_DISABLE, false);
+            return JIT_STOP;
+        case 0x78:
+            assign_flag(e, STATUS_INT_DISABLE, true);
+            return JIT_CONTINUE;
+        case 0xB8:
+            assign_flag(e, STATUS_OVERFLOW, false);
+            return JIT_CONTINUE;
+        case 0xD8:
+            assign_flag(e, STATUS_DECIMAL, false);
+            return JIT_CONTINUE;
+        case 0xF8:
+            assign_flag(e, STATUS_DECIMAL, true);
+            return JIT_CONTINUE;
+        case 0xEA:
+            return JIT_CONTINUE;
+        default:
+            return JIT_UNSUPPORTED;
+    }
+}
+
+/* Code buffer */
+
+// Drop every translation and start over with an empty buffer
+static void jit_flush(nes_t* nes) {
+    for (size_t i = 0; i < NES_BLOCK_CACHE_SIZE; i++) {
+        nes->cache.blocks[i].code = NULL;
+        nes->cache.blocks[i].hits = 0;
+    }
+    nes->jit.used = 0;
+}
+
+bool jit_init(nes_t* nes) {
+    void* code = mmap(
+      NULL, NES_JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    nes->jit.code = (code == MAP_FAILED) ? NULL : code;
+    nes->jit.used = 0;
+    return nes->jit.code != NULL;
+}
+
+void jit_free(nes_t* nes) {
+    if (nes->jit.code) {
+        munmap(nes->jit.code, NES_JIT_BUFFER_SIZE);
+        nes->jit.code = NULL;
+    }
+}
+
+bool jit_compile(nes_t* nes, nes_block_t* block) {
+    if (!nes->jit.code) return false;
+    if (NES_JIT_BUFFER_SIZE - nes->jit.used < JIT_MAX_BLOCK_SIZE) jit_flush(nes);
+    if (mprotect(nes->jit.code, NES_JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE)) return false;
+
+    u8* start = nes->jit.code + nes->jit.used;
+    emitter_t e = { start, nes, block };
+    jit_result_t result = JIT_UNSUPPORTED;
+    u32 total = 0;
+    u8 count = 0;
+
+    while (count < block->count) {
+        nes_uop_t const* uop = &block->uops[count];
+        u32 next_total = total + cycles[uop->op];
+        result = translate(&e, uop, next_total, count + 1);
+        if (result == JIT_UNSUPPORTED) break;
+        total = next_total;
+        count++;
+        if (result != JIT_CONTINUE) break;
+    }
+    if (count && result != JIT_EXITED) {
+        nes_uop_t const* last = &block->uops[count - 1];
+        emit_exit(&e, last->pc + sizes[last->op], total, count);
+    }
+    if (count) {
+        nes->jit.used += e.pos - start;
+        block->code = (nes_jit_code_t)(uintptr_t)start;
+    }
+
+    mprotect(nes->jit.code, NES_JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC);
+    return count != 0;
+}
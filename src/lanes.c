@@ -0,0 +1,667 @@
+#include "lanes.h"
+
+#include "bitmask.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "memory.h"
+#include "nes.h"
+#include "opcodes.h"
+#include "scheduler.h"
+
+#include <string.h>
+
+/* Lane-parallel CPU core
+ * Runs a group of consoles of the same cartridge for a frame, keeping their registers side by
+ * side so that an instruction is decoded once and executed for all consoles at the same PC with
+ * vector operations. Memory operands are gathered from and scattered to each console's RAM.
+ *
+ * Each step picks the consoles at the lowest PC: consoles that branched ahead wait there until
+ * the others catch up, which is where structured code joins again. The vector path covers the
+ * same instructions as the JIT, whose cycle counts are the base counts of the opcode table. Any
+ * other instruction, I/O access or pending interrupt is run by the scalar core for each console
+ * in turn. Consoles are independent, so the order they are stepped in does not change results.
+ */
+
+// GCC vector extension holding one u8 register per lane
+typedef u8 lane_t __attribute__((vector_size(NES_LANES)));
+
+#define FLAGS_MASK                                                                                 \
+    ((1 << STATUS_CARRY) | (1 << STATUS_ZERO) | (1 << STATUS_OVERFLOW) | (1 << STATUS_NEGATIVE))
+
+#define MODE_ENTRY(op, fn, m, cyc, mnemonic) [op] = MODE_##m,
+static u8 const modes[256] = { CPU_OPCODE_TABLE(MODE_ENTRY) };
+#undef MODE_ENTRY
+
+#define CYCLES_ENTRY(op, fn, m, cyc, mnemonic) [op] = cyc,
+static u8 const cycles[256] = { CPU_OPCODE_TABLE(CYCLES_ENTRY) };
+#undef CYCLES_ENTRY
+
+#define SIZE_ENTRY(op, fn, m, cyc, mnemonic) [op] = 1 + OPERAND_##m,
+static u8 const sizes[256] = { CPU_OPCODE_TABLE(SIZE_ENTRY) };
+#undef SIZE_ENTRY
+
+// Registers of every lane, flags are kept as in lazy mode
+typedef struct {
+    nes_t* const* nes;
+    u8 count;
+    u8 a[NES_LANES];
+    u8 x[NES_LANES];
+    u8 y[NES_LANES];
+    u8 s[NES_LANES];
+    u8 p[NES_LANES]; // I, D, B and unused flags
+    u8 c[NES_LANES]; // C flag, 0 or 1
+    u8 z[NES_LANES]; // Zero if the Z flag is set
+    u8 v[NES_LANES]; // V flag, 0 or 1
+    u8 n[NES_LANES]; // Bit 7 is the N flag
+    u16 pc[NES_LANES];
+    u64 frame[NES_LANES]; // Frame the lane has to complete
+    bool done[NES_LANES];
+    nes_lanes_stats_t stats;
+} lanes_t;
+
+// Lanes at the same PC
+typedef struct {
+    u16 pc;
+    u8 count;
+    u8 lane[NES_LANES];
+    lane_t mask; // 0xFF for the lanes of the group
+} group_t;
+
+// Location of a memory operand
+typedef enum {
+    LOC_NONE,  // Needs the scalar core
+    LOC_CONST, // Immediate or PRG-ROM, the same for every lane
+    LOC_RAM,   // Internal RAM at a fixed offset
+    LOC_ZP_X,  // Zero page indexed by X
+    LOC_ZP_Y,  // Zero page indexed by Y
+} loc_kind_t;
+
+typedef struct {
+    loc_kind_t kind;
+    u16 addr; // RAM offset, or the constant value
+} loc_t;
+
+/* Lane vectors */
+
+static inline lane_t get(u8 const* reg) {
+    lane_t v;
+    memcpy(&v, reg, sizeof(v));
+    return v;
+}
+
+static inline void put(u8* reg, lane_t v) {
+    memcpy(reg, &v, sizeof(v));
+}
+
+static inline lane_t splat(u8 value) {
+    u8 data[NES_LANES];
+    memset(data, value, sizeof(data));
+    return get(data);
+}
+
+// Update the lanes of the group only
+static inline void set(u8* reg, group_t const* g, lane_t value) {
+    put(reg, (get(reg) & ~g->mask) | (value & g->mask));
+}
+
+static inline void set_nz(lanes_t* l, group_t const* g, lane_t value) {
+    set(l->z, g, value);
+    set(l->n, g, value);
+}
+
+/* Scalar core */
+
+static void pack(lanes_t* l, u8 k) {
+    nes_t* nes = l->nes[k];
+    u8 p = cpu_status(nes);
+    l->a[k] = nes->cpu.a;
+    l->x[k] = nes->cpu.x;
+    l->y[k] = nes->cpu.y;
+    l->s[k] = nes->cpu.s;
+    l->p[k] = p;
+    l->c[k] = NTH_BIT(p, STATUS_CARRY);
+    l->z[k] = !NTH_BIT(p, STATUS_ZERO);
+    l->v[k] = NTH_BIT(p, STATUS_OVERFLOW);
+    l->n[k] = p;
+    l->pc[k] = nes->cpu.pc;
+}
+
+static void unpack(lanes_t* l, u8 k) {
+    nes_t* nes = l->nes[k];
+    nes->cpu.a = l->a[k];
+    nes->cpu.x = l->x[k];
+    nes->cpu.y = l->y[k];
+    nes->cpu.s = l->s[k];
+    nes->cpu.pc = l->pc[k];
+    cpu_set_status(
+      nes,
+      (l->p[k] & ~FLAGS_MASK) | (l->c[k] << STATUS_CARRY) | (!l->z[k] << STATUS_ZERO) |
+        (l->v[k] << STATUS_OVERFLOW) | (l->n[k] & (1 << STATUS_NEGATIVE)));
+}
+
+// Runs one instruction, or the whole loop if the lane is in [start, end)
+static void scalar_step(lanes_t* l, u8 k, u16 start, u16 end) {
+    nes_t* nes = l->nes[k];
+    u64 instructions = nes->cpu.instructions;
+    unpack(l, k);
+    do {
+        nes_step(nes);
+        l->done[k] = nes->ppu.frame != l->frame[k];
+    } while (!l->done[k] && nes->cpu.pc >= start && nes->cpu.pc < end);
+    pack(l, k);
+    l->stats.scalar += nes->cpu.instructions - instructions;
+}
+
+/* Operands */
+
+static loc_t locate(nes_t* nes, u8 op, u16 operand, bool write) {
+    loc_t loc = { LOC_NONE, 0 };
+    switch (modes[op]) {
+        case MODE_imm:
+            loc.kind = LOC_CONST;
+            loc.addr = operand & 0xFF;
+            break;
+        case MODE_zp:
+            loc.kind = LOC_RAM;
+            loc.addr = operand & 0xFF;
+            break;
+        case MODE_zpx:
+            loc.kind = LOC_ZP_X;
+            loc.addr = operand & 0xFF;
+            break;
+        case MODE_zpy:
+            loc.kind = LOC_ZP_Y;
+            loc.addr = operand & 0xFF;
+            break;
+        case MODE_absl:
+            if (operand < 0x2000) {
+                loc.kind = LOC_RAM;
+                loc.addr = operand % NES_RAM_SIZE;
+            } else if (operand >= NES_PRG_DATA_OFFSET) {
+                // Lanes of a group share the PRG banks
+                loc.kind = LOC_CONST;
+                loc.addr = cartridge_prg_rd(nes, operand);
+            }
+            break;
+        default:
+            break;
+    }
+    if (write && loc.kind == LOC_CONST) loc.kind = LOC_NONE;
+    return loc;
+}
+
+static u16 ram_offset(lanes_t const* l, u8 k, loc_t loc) {
+    switch (loc.kind) {
+        case LOC_ZP_X:
+            return (loc.addr + l->x[k]) & 0xFF;
+        case LOC_ZP_Y:
+            return (loc.addr + l->y[k]) & 0xFF;
+        default:
+            return loc.addr;
+    }
+}
+
+static lane_t load(lanes_t* l, group_t const* g, loc_t loc) {
+    if (loc.kind == LOC_CONST) return splat(loc.addr);
+    u8 data[NES_LANES] = { 0 };
+    for (u8 i = 0; i < g->count; i++) {
+        u8 k = g->lane[i];
+        data[k] = l->nes[k]->memory.ram[ram_offset(l, k, loc)];
+    }
+    return get(data);
+}
+
+static void store(lanes_t* l, group_t const* g, loc_t loc, lane_t value) {
+    u8 data[NES_LANES];
+    put(data, value);
+    for (u8 i = 0; i < g->count; i++) {
+        u8 k = g->lane[i];
+        u16 offset = ram_offset(l, k, loc);
+        l->nes[k]->memory.ram[offset] = data[k];
+        memory_dirty(l->nes[k], NES_DIRTY_RAM, offset);
+    }
+}
+
+/* Instructions */
+// Each returns false before changing anything if the scalar core has to run the instruction
+
+static bool vector_load(lanes_t* l, group_t const* g, loc_t loc, u8* reg) {
+    if (loc.kind == LOC_NONE) return false;
+    lane_t d = load(l, g, loc);
+    set(reg, g, d);
+    set_nz(l, g, d);
+    return true;
+}
+
+static bool vector_store(lanes_t* l, group_t const* g, loc_t loc, u8 const* reg) {
+    if (loc.kind == LOC_NONE) return false;
+    store(l, g, loc, get(reg));
+    return true;
+}
+
+static void vector_transfer(lanes_t* l, group_t const* g, u8 const* from, u8* to, bool flags) {
+    lane_t d = get(from);
+    set(to, g, d);
+    if (flags) set_nz(l, g, d);
+}
+
+typedef enum {
+    LOGIC_AND,
+    LOGIC_ORA,
+    LOGIC_EOR,
+} logic_t;
+
+static bool vector_logic(lanes_t* l, group_t const* g, loc_t loc, logic_t op) {
+    if (loc.kind == LOC_NONE) return false;
+    lane_t a = get(l->a);
+    lane_t d = load(l, g, loc);
+    lane_t r = op == LOGIC_AND ? a & d : op == LOGIC_ORA ? a | d : a ^ d;
+    set(l->a, g, r);
+    set_nz(l, g, r);
+    return true;
+}
+
+// ADC, SBC as ADC of the inverted operand
+static bool vector_add(lanes_t* l, group_t const* g, loc_t loc, bool subtract) {
+    if (loc.kind == LOC_NONE) return false;
+    lane_t a = get(l->a);
+    lane_t d = load(l, g, loc);
+    if (subtract) d = ~d;
+    lane_t sum = a + d;
+    lane_t r = sum + get(l->c);
+    lane_t carry = ((lane_t)(sum < a) | (lane_t)(r < sum)) & splat(1);
+    set(l->c, g, carry);
+    set(l->v, g, (~(a ^ d) & (a ^ r)) >> 7);
+    set(l->a, g, r);
+    set_nz(l, g, r);
+    return true;
+}
+
+static bool vector_compare(lanes_t* l, group_t const* g, loc_t loc, u8 const* reg) {
+    if (loc.kind == LOC_NONE) return false;
+    lane_t r = get(reg);
+    lane_t d = load(l, g, loc);
+    set(l->c, g, (lane_t)(r >= d) & splat(1));
+    set_nz(l, g, r - d);
+    return true;
+}
+
+static bool vector_bit(lanes_t* l, group_t const* g, loc_t loc) {
+    if (loc.kind == LOC_NONE) return false;
+    lane_t d = load(l, g, loc);
+    set(l->n, g, d);
+    set(l->z, g, get(l->a) & d);
+    set(l->v, g, (d >> STATUS_OVERFLOW) & splat(1));
+    return true;
+}
+
+// INC, DEC on memory
+static bool vector_rmw(lanes_t* l, group_t const* g, loc_t loc, u8 delta) {
+    if (loc.kind == LOC_NONE) return false;
+    lane_t r = load(l, g, loc) + splat(delta);
+    store(l, g, loc, r);
+    set_nz(l, g, r);
+    return true;
+}
+
+// INX, INY, DEX, DEY
+static void vector_step(lanes_t* l, group_t const* g, u8* reg, u8 delta) {
+    lane_t r = get(reg) + splat(delta);
+    set(reg, g, r);
+    set_nz(l, g, r);
+}
+
+typedef enum {
+    SHIFT_ASL,
+    SHIFT_LSR,
+    SHIFT_ROL,
+    SHIFT_ROR,
+} shift_t;
+
+// Shifts of the accumulator
+static void vector_shift(lanes_t* l, group_t const* g, shift_t op) {
+    lane_t a = get(l->a);
+    lane_t c = get(l->c);
+    lane_t r;
+    switch (op) {
+        case SHIFT_ASL:
+            r = a << 1;
+            break;
+        case SHIFT_LSR:
+            r = a >> 1;
+            break;
+        case SHIFT_ROL:
+            r = (a << 1) | c;
+            break;
+        default:
+            r = (a >> 1) | (c << 7);
+            break;
+    }
+    set(l->c, g, (op == SHIFT_ASL || op == SHIFT_ROL ? a >> 7 : a) & splat(1));
+    set(l->a, g, r);
+    set_nz(l, g, r);
+}
+
+static void vector_flag(u8* flag, group_t const* g, u8 value) {
+    set(flag, g, splat(value));
+}
+
+static void vector_status(lanes_t* l, group_t const* g, u8 bit, bool value) {
+    lane_t p = get(l->p) & splat(~(1 << bit));
+    set(l->p, g, p | splat(value << bit));
+}
+
+/* Group execution */
+
+// Lanes that do not branch take the mask out of taken
+typedef struct {
+    bool branch;
+    lane_t taken;
+    u16 target;
+} flow_t;
+
+static bool vector_execute(lanes_t* l, group_t const* g, u8 op, u16 operand, flow_t* flow) {
+    nes_t* leader = l->nes[g->lane[0]];
+    loc_t rd = locate(leader, op, operand, false);
+    loc_t wr = locate(leader, op, operand, true);
+
+    switch (op) {
+        // Load / Store operations
+        case 0xA9:
+        case 0xA5:
+        case 0xB5:
+        case 0xAD:
+            return vector_load(l, g, rd, l->a);
+        case 0xA2:
+        case 0xA6:
+        case 0xB6:
+        case 0xAE:
+            return vector_load(l, g, rd, l->x);
+        case 0xA0:
+        case 0xA4:
+        case 0xB4:
+        case 0xAC:
+            return vector_load(l, g, rd, l->y);
+        case 0x85:
+        case 0x95:
+        case 0x8D:
+            return vector_store(l, g, wr, l->a);
+        case 0x86:
+        case 0x96:
+        case 0x8E:
+            return vector_store(l, g, wr, l->x);
+        case 0x84:
+        case 0x94:
+        case 0x8C:
+            return vector_store(l, g, wr, l->y);
+        case 0xAA:
+            vector_transfer(l, g, l->a, l->x, true);
+            return true;
+        case 0xA8:
+            vector_transfer(l, g, l->a, l->y, true);
+            return true;
+        case 0x8A:
+            vector_transfer(l, g, l->x, l->a, true);
+            return true;
+        case 0x98:
+            vector_transfer(l, g, l->y, l->a, true);
+            return true;
+        case 0xBA:
+            vector_transfer(l, g, l->s, l->x, true);
+            return true;
+        case 0x9A:
+            vector_transfer(l, g, l->x, l->s, false);
+            return true;
+
+        // Arithmetic / Logical operations
+        case 0x29:
+        case 0x25:
+        case 0x35:
+        case 0x2D:
+            return vector_logic(l, g, rd, LOGIC_AND);
+        case 0x09:
+        case 0x05:
+        case 0x15:
+        case 0x0D:
+            return vector_logic(l, g, rd, LOGIC_ORA);
+        case 0x49:
+        case 0x45:
+        case 0x55:
+        case 0x4D:
+            return vector_logic(l, g, rd, LOGIC_EOR);
+        case 0x69:
+        case 0x65:
+        case 0x75:
+        case 0x6D:
+            return vector_add(l, g, rd, false);
+        case 0xE9:
+        case 0xE5:
+        case 0xF5:
+        case 0xED:
+            return vector_add(l, g, rd, true);
+        case 0x24:
+        case 0x2C:
+            return vector_bit(l, g, rd);
+
+        // Compares
+        case 0xC9:
+        case 0xC5:
+        case 0xD5:
+        case 0xCD:
+            return vector_compare(l, g, rd, l->a);
+        case 0xE0:
+        case 0xE4:
+        case 0xEC:
+            return vector_compare(l, g, rd, l->x);
+        case 0xC0:
+        case 0xC4:
+        case 0xCC:
+            return vector_compare(l, g, rd, l->y);
+
+        // Increments / Decrements
+        case 0xE6:
+        case 0xF6:
+        case 0xEE:
+            return vector_rmw(l, g, wr, 1);
+        case 0xC6:
+        case 0xD6:
+        case 0xCE:
+            return vector_rmw(l, g, wr, 0xFF);
+        case 0xE8:
+            vector_step(l, g, l->x, 1);
+            return true;
+        case 0xC8:
+            vector_step(l, g, l->y, 1);
+            return true;
+        case 0xCA:
+            vector_step(l, g, l->x, 0xFF);
+            return true;
+        case 0x88:
+            vector_step(l, g, l->y, 0xFF);
+            return true;
+
+        // Shifts
+        case 0x0A:
+            vector_shift(l, g, SHIFT_ASL);
+            return true;
+        case 0x4A:
+            vector_shift(l, g, SHIFT_LSR);
+            return true;
+        case 0x2A:
+            vector_shift(l, g, SHIFT_ROL);
+            return true;
+        case 0x6A:
+            vector_shift(l, g, SHIFT_ROR);
+            return true;
+
+        // Jumps / Branches
+        case 0x4C:
+            flow->branch = true;
+            flow->taken = splat(0xFF);
+            flow->target = operand;
+            return true;
+        case 0x10:
+            flow->taken = (lane_t)((get(l->n) & splat(0x80)) == splat(0));
+            break;
+        case 0x30:
+            flow->taken = (lane_t)((get(l->n) & splat(0x80)) != splat(0));
+            break;
+        case 0x50:
+            flow->taken = (lane_t)(get(l->v) == splat(0));
+            break;
+        case 0x70:
+            flow->taken = (lane_t)(get(l->v) != splat(0));
+            break;
+        case 0x90:
+            flow->taken = (lane_t)(get(l->c) == splat(0));
+            break;
+        case 0xB0:
+            flow->taken = (lane_t)(get(l->c) != splat(0));
+            break;
+        case 0xD0:
+            flow->taken = (lane_t)(get(l->z) != splat(0));
+            break;
+        case 0xF0:
+            flow->taken = (lane_t)(get(l->z) == splat(0));
+            break;
+
+        // Status register operations
+        case 0x18:
+            vector_flag(l->c, g, 0);
+            return true;
+        case 0x38:
+            vector_flag(l->c, g, 1);
+            return true;
+        case 0x58:
+            vector_status(l, g, STATUS_INT_DISABLE, false);
+            return true;
+        case 0x78:
+            vector_status(l, g, STATUS_INT_DISABLE, true);
+            return true;
+        case 0xB8:
+            vector_flag(l->v, g, 0);
+            return true;
+        case 0xD8:
+            vector_status(l, g, STATUS_DECIMAL, false);
+            return true;
+        case 0xF8:
+            vector_status(l, g, STATUS_DECIMAL, true);
+            return true;
+        case 0xEA:
+            return true;
+        default:
+            return false;
+    }
+
+    // Relative branches
+    flow->branch = true;
+    flow->target = g->pc + 2 + (s8)(operand & 0xFF);
+    return true;
+}
+
+// Runs the instruction at the group's PC on all of its lanes, returns false if it was not run
+static bool vector_run(lanes_t* l, group_t const* g) {
+    nes_t* leader = l->nes[g->lane[0]];
+    if (g->pc < NES_PRG_DATA_OFFSET) return false;
+    for (u8 i = 0; i < g->count; i++) {
+        nes_t const* nes = l->nes[g->lane[i]];
+        // Interrupts are taken by the scalar core
+        if (nes->cpu.nmi || (nes->cpu.irq && !NTH_BIT(l->p[g->lane[i]], STATUS_INT_DISABLE))) {
+            return false;
+        }
+        if (memcmp(
+              nes->cartridge.prg_map, leader->cartridge.prg_map, sizeof(nes->cartridge.prg_map))) {
+            return false;
+        }
+    }
+
+    u8 op = cartridge_prg_rd(leader, g->pc);
+    u32 next = (u32)g->pc + sizes[op];
+    if (next > 0x10000) return false;
+    u16 operand = 0;
+    for (u8 i = 1; i < sizes[op]; i++) {
+        operand |= cartridge_prg_rd(leader, g->pc + i) << (8 * (i - 1));
+    }
+
+    flow_t flow = { false, splat(0), 0 };
+    if (!vector_execute(l, g, op, operand, &flow)) return false;
+
+    // Idle loops are left to the scalar core, which skips through them
+    u16 loop = 0;
+#ifdef NES_CPU_BLOCK_CACHE
+    if (flow.branch && flow.target <= g->pc) loop = cpu_idle_loop(leader, flow.target);
+#endif
+
+    u8 taken[NES_LANES];
+    put(taken, flow.taken);
+    // Taken branches cost a cycle more, and another one when crossing a page
+    u8 penalty = op == 0x4C ? 0 : 1 + ((flow.target & 0x100) != (next & 0x100));
+    for (u8 i = 0; i < g->count; i++) {
+        u8 k = g->lane[i];
+        nes_t* nes = l->nes[k];
+        bool branch = flow.branch && taken[k];
+        l->pc[k] = branch ? flow.target : next;
+        nes->cpu.cycle += cycles[op] + (branch ? penalty : 0);
+        nes->cpu.instructions++;
+#ifdef NES_CPU_BLOCK_CACHE
+        // The scalar core resumes from a fresh block
+        nes->cache.block = NULL;
+        nes->cache.uop = NULL;
+#endif
+        if (nes->cpu.cycle >= nes->scheduler.next) scheduler_run(nes);
+        l->done[k] = nes->ppu.frame != l->frame[k];
+        if (branch && loop && !l->done[k]) scalar_step(l, k, flow.target, loop);
+    }
+    l->stats.vector += g->count;
+    return true;
+}
+
+// Gathers the lanes still running at the lowest PC. Lanes that branched ahead wait there for the
+// others, which is where structured code joins again.
+static void next_group(lanes_t const* l, group_t* g) {
+    u32 pc = 0x10000;
+    for (u8 k = 0; k < l->count; k++) {
+        if (!l->done[k] && l->pc[k] < pc) pc = l->pc[k];
+    }
+
+    u8 mask[NES_LANES] = { 0 };
+    g->pc = pc;
+    g->count = 0;
+    for (u8 k = 0; k < l->count; k++) {
+        if (!l->done[k] && l->pc[k] == pc) {
+            g->lane[g->count++] = k;
+            mask[k] = 0xFF;
+        }
+    }
+    g->mask = get(mask);
+}
+
+// Runs up to NES_LANES consoles of the same cartridge until each has completed its current frame,
+// like nes_run_frame on each of them. Adds the instructions run by each core to stats if given.
+void nes_lanes_run_frame(nes_t* const* consoles, size_t count, nes_lanes_stats_t* stats) {
+    lanes_t l;
+    l.nes = consoles;
+    l.count = count < NES_LANES ? count : NES_LANES;
+    l.stats.vector = l.stats.scalar = 0;
+    for (u8 k = 0; k < l.count; k++) {
+        pack(&l, k);
+        l.frame[k] = consoles[k]->ppu.frame;
+        l.done[k] = false;
+    }
+
+    group_t g;
+    for (next_group(&l, &g); g.count; next_group(&l, &g)) {
+        if (g.count > 1 && vector_run(&l, &g)) continue;
+        for (u8 i = 0; i < g.count; i++) {
+            scalar_step(&l, g.lane[i], 0, 0);
+        }
+    }
+
+    for (u8 k = 0; k < l.count; k++) {
+        unpack(&l, k);
+    }
+    if (stats) {
+        stats->vector += l.stats.vector;
+        stats->scalar += l.stats.scalar;
+    }
+}
@@ -12,7 +12,7 @@ int main() {
     }
 
     while (1) {
-        nes_step(&nes);
+        nes_run_frame(&nes);
     }
 
     return 0;
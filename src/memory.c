@@ -1,42 +1,102 @@
 #include "memory.h"
 
 #include "cartridge.h"
+#include "controller.h"
+#include "ppu.h"
 
 void memory_init(nes_t* state) {
     for (size_t i = 0; i < NES_RAM_SIZE; i++) {
         state->memory.ram[i] = 0x00;
     }
+    for (size_t i = 0; i < NES_PAGE_COUNT; i++) {
+        state->memory.read_map[i] = NULL;
+        state->memory.write_map[i] = NULL;
+    }
+    // Internal RAM and its mirrors
+    for (size_t i = 0; i < 0x2000 / NES_PAGE_SIZE; i++) {
+        u8* page = state->memory.ram + (i * NES_PAGE_SIZE) % NES_RAM_SIZE;
+        state->memory.read_map[i] = page;
+        state->memory.write_map[i] = page;
+#ifdef NES_DIRTY_PAGES
+        state->dirty.page[i] = NES_DIRTY_RAM + (page - state->memory.ram) / NES_DIRTY_BLOCK_SIZE;
+#endif
+    }
+    memory_map_prg_ram(state);
+    memory_map_prg(state);
+    memory_dirty_all(state);
+}
+
+// Point the PRG-RAM pages at the cartridge's PRG-RAM, only the first 8kB unit is addressable.
+// Writes stay unmapped while it is shared with a fork so the first one reaches the cartridge.
+void memory_map_prg_ram(nes_t* state) {
+    if (!state->cartridge.config.has_prg_ram) return;
+    for (size_t i = 0; i < NES_PRG_RAM_UNIT_SIZE / NES_PAGE_SIZE; i++) {
+        u8* page = state->cartridge.prg_ram + i * NES_PAGE_SIZE;
+        state->memory.read_map[NES_PRG_RAM_OFFSET / NES_PAGE_SIZE + i] = page;
+        state->memory.write_map[NES_PRG_RAM_OFFSET / NES_PAGE_SIZE + i] =
+          state->cartridge.shared ? NULL : page;
+#ifdef NES_DIRTY_PAGES
+        state->dirty.page[NES_PRG_RAM_OFFSET / NES_PAGE_SIZE + i] =
+          NES_DIRTY_PRG_RAM + i * NES_PAGE_SIZE / NES_DIRTY_BLOCK_SIZE;
+#endif
+    }
+}
+
+// Flags all tracked memory the cartridge has as written, for changes made without going through
+// the bus
+void memory_dirty_all(nes_t* state) {
+#ifdef NES_DIRTY_PAGES
+    bool prg_ram = state->cartridge.config.has_prg_ram;
+    bool chr_ram = state->cartridge.config.has_chr_ram;
+    for (size_t i = 0; i < NES_DIRTY_COUNT; i++) {
+        state->dirty.map[i] = (i < NES_DIRTY_PRG_RAM || i >= NES_DIRTY_VRAM) ||
+                              (i < NES_DIRTY_CHR_RAM ? prg_ram : chr_ram);
+    }
+#else
+    (void)state;
+#endif
+}
+
+// Point the PRG-ROM pages at the banks in prg_map, mappers call this after switching banks.
+// Writes stay unmapped so they reach the mapper.
+void memory_map_prg(nes_t* state) {
+    for (size_t i = 0; i < (0x10000 - NES_PRG_DATA_OFFSET) / NES_PAGE_SIZE; i++) {
+        size_t offset = i * NES_PAGE_SIZE;
+        u32 bank = state->cartridge.prg_map[offset / NES_PRG_SLOT_SIZE];
+        state->memory.read_map[NES_PRG_DATA_OFFSET / NES_PAGE_SIZE + i] =
+          state->cartridge.prg + bank + offset % NES_PRG_SLOT_SIZE;
+    }
 }
 
-u8 memory_read(nes_t* state, u16 addr) {
+u8 memory_io_read(nes_t* state, u16 addr) {
     if (addr < 0x2000) {
         return state->memory.ram[addr % NES_RAM_SIZE];
     } else if (addr < 0x4000) {
-        // TODO: return ppu_reg_access(addr % 0x100, 0, READ);
-        return 0;
+        ppu_sync(state);
+        return ppu_reg_access(state, addr % 8, 0, READ);
     } else if (addr <= 0x4015) {
         // TODO: APU, Peripherals..
         return 0;
     } else if (addr == 0x4016) {
-        // TODO: return controller_rd(0);
-        return 0;
+        return controller_rd(state, 0);
     } else if (addr == 0x4017) {
-        // TODO: return controller_rd(1);
-        return 0;
+        return controller_rd(state, 1);
     } else {
         return cartridge_prg_rd(state, addr);
     }
 }
 
-void memory_write(nes_t* state, u16 addr, u8 data) {
+void memory_io_write(nes_t* state, u16 addr, u8 data) {
     if (addr < 0x2000) {
         state->memory.ram[addr % NES_RAM_SIZE] = data;
+        memory_dirty(state, NES_DIRTY_RAM, addr % NES_RAM_SIZE);
     } else if (addr < 0x4000) {
-        // TODO: ppu_reg_access(addr % 0x100, 0, WRITE);
+        ppu_sync(state);
+        ppu_reg_access(state, addr % 8, data, WRITE);
     } else if (addr <= 0x4015) {
         // TODO: APU, Peripherals..
     } else if (addr == 0x4016) {
-        // TODO: controller_wr(data);
+        controller_wr(state, data);
     } else if (addr == 0x4017) {
         // TODO
     } else {
@@ -1,19 +1,139 @@
 #include "nes.h"
 
 #include "cartridge.h"
+#include "controller.h"
 #include "cpu.h"
+#ifdef NES_CPU_JIT
+#include "jit.h"
+#endif
 #include "memory.h"
+#include "ppu.h"
+#include "scheduler.h"
+
+#include <stddef.h>
+#include <string.h>
 
 bool nes_init(nes_t* nes, char const* file) {
     if (cartridge_init(nes, file) != CARTRIDGE_SUCCESS) {
         return false;
     }
     memory_init(nes);
+    controller_init(nes);
+    scheduler_init(nes);
+#ifdef NES_CPU_JIT
+    // Without executable memory everything is interpreted
+    jit_init(nes);
+#endif
     cpu_init(nes);
+    ppu_reset(nes);
 
     return true;
 }
 
+void nes_free(nes_t* nes) {
+#ifdef NES_CPU_JIT
+    jit_free(nes);
+#endif
+    reset(nes);
+}
+
 void nes_step(nes_t* nes) {
     cpu_step(nes);
+    if (nes->cpu.cycle >= nes->scheduler.next) scheduler_run(nes);
+}
+
+// Runs whole instructions until at least the given number of cycles have passed, returns the
+// cycles run. Overshoots the budget by at most the rest of the last instruction.
+u64 nes_run_cycles(nes_t* nes, u64 cycles) {
+    u64 start = nes->cpu.cycle;
+    u64 end = start + cycles;
+    // Keeps skipped idle loops and translated blocks from running past the budget
+    scheduler_set(nes, NES_EVENT_RUN_END, end);
+    while (nes->cpu.cycle < end) {
+        nes_step(nes);
+    }
+    scheduler_set(nes, NES_EVENT_RUN_END, NES_EVENT_NEVER);
+    return nes->cpu.cycle - start;
+}
+
+// Runs whole instructions until the PPU has finished the current frame, entering vblank, returns
+// the cycles run
+u64 nes_run_frame(nes_t* nes) {
+    u64 start = nes->cpu.cycle;
+    u64 frame = nes->ppu.frame;
+    while (nes->ppu.frame == frame) {
+        nes_step(nes);
+    }
+    return nes->cpu.cycle - start;
+}
+
+// Runs a frame like nes_run_frame without drawing it, for frames nobody looks at. The frame buffer
+// keeps the last frame drawn. The PPU still fetches, evaluates sprites and finds sprite 0 hits, so
+// the machine runs exactly as it would have.
+u64 nes_skip_frame(nes_t* nes) {
+    nes->ppu.skip = true;
+    u64 cycles = nes_run_frame(nes);
+    nes->ppu.skip = false;
+    return cycles;
+}
+
+// Copies the machine state of another console running the same cartridge, so that both continue
+// identically. Host resources are kept: decoded blocks and translations only depend on the ROM.
+// Returns false and leaves the console untouched if it shares memory with a fork and there is no
+// memory for its own copy.
+bool nes_copy(nes_t* nes, nes_t const* from) {
+    if (!cartridge_own(nes)) return false;
+    nes->cpu = from->cpu;
+    memcpy(nes->memory.ram, from->memory.ram, sizeof(nes->memory.ram));
+    nes->ppu = from->ppu;
+    nes->controller = from->controller;
+    nes->scheduler = from->scheduler;
+
+    memcpy(nes->cartridge.prg_map, from->cartridge.prg_map, sizeof(nes->cartridge.prg_map));
+    memcpy(nes->cartridge.chr_map, from->cartridge.chr_map, sizeof(nes->cartridge.chr_map));
+    if (nes->cartridge.config.has_prg_ram) {
+        memcpy(
+          nes->cartridge.prg_ram,
+          from->cartridge.prg_ram,
+          nes->cartridge.config.prg_ram_size * NES_PRG_RAM_UNIT_SIZE);
+    }
+    if (nes->cartridge.config.has_chr_ram) {
+        cartridge_chr_load(nes, from->cartridge.chr);
+    }
+    memory_map_prg(nes);
+    memory_dirty_all(nes);
+#ifdef NES_CPU_BLOCK_CACHE
+    // The block being executed belongs to the previous state
+    nes->cache.block = NULL;
+    nes->cache.uop = NULL;
+#endif
+    return true;
+}
+
+// Starts a console in the state of another, for searching from the same state. The child shares
+// the ROM with its parent as well as PRG-RAM and CHR-RAM until either console writes to them. RAM
+// and nametables are copied, decoded blocks and translations are not and the frame buffer is left
+// out, it is complete again after the next frame. Consoles are freed with nes_free, in any
+// order.
+void nes_fork(nes_t* child, nes_t* parent) {
+    cartridge_fork(child, parent);
+    memory_init(child);
+    memcpy(child->memory.ram, parent->memory.ram, sizeof(child->memory.ram));
+    child->cpu = parent->cpu;
+    // All of the PPU around the frame buffer
+    size_t gram = offsetof(nes_t, ppu.GRAM) - offsetof(nes_t, ppu);
+    size_t rest = gram + sizeof(parent->ppu.GRAM);
+    memcpy(&child->ppu, &parent->ppu, gram);
+    memcpy((u8*)&child->ppu + rest, (u8 const*)&parent->ppu + rest, sizeof(parent->ppu) - rest);
+    child->controller = parent->controller;
+    child->scheduler = parent->scheduler;
+#ifdef NES_CPU_JIT
+    // Translations live in the parent's buffer, forks interpret
+    child->jit.code = NULL;
+    child->jit.used = 0;
+#endif
+#ifdef NES_CPU_BLOCK_CACHE
+    // Blocks are decoded again rather than copied, forks are cheaper that way
+    cpu_cache_reset(child);
+#endif
 }
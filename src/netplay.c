@@ -0,0 +1,234 @@
+#include "netplay.h"
+
+#include "clock.h"
+#include "controller.h"
+#include "nes.h"
+#include "savestate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Rollback netplay
+ * Both players run the whole game. Every frame is run at once with the local input and a
+ * prediction of the remote input: the last remote input received, held. Each side sends the local
+ * input of every frame the other side has not acknowledged yet, so lost packets are covered by the
+ * next one. When remote input arrives for a frame already run and differs from its prediction, the
+ * state saved before that frame is loaded and the frames up to the present are run again.
+ *
+ * States are only saved before frames run on a prediction, so a session with every input on time
+ * never saves. A side that gets NES_NETPLAY_WINDOW frames ahead of the input it received, or of
+ * the input the other side acknowledged, waits instead, bounding rollbacks to that many frames.
+ *
+ * A packet holds, little-endian: the frames of remote input received (u32), the first frame of the
+ * input sent (u32), the number of frames sent (u8) and the input of each.
+ */
+
+static void put32(u8* p, u32 v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static u32 get32(u8 const* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (u32)p[3] << 24;
+}
+
+static u8* state(nes_netplay_t* np, u32 frame) {
+    return np->states + frame % NES_NETPLAY_WINDOW * np->state_size;
+}
+
+// Last remote input received before the frame
+static u8 predict(nes_netplay_t const* np, u32 frame) {
+    for (u32 f = frame; f-- > np->confirmed;) {
+        if (np->received[f % NES_NETPLAY_HISTORY]) return np->remote[f % NES_NETPLAY_HISTORY];
+    }
+    return np->last_remote;
+}
+
+// Runs a frame, saving the state before it if it runs on a prediction. Frames run again are not
+// drawn, the present one is.
+static void run(nes_netplay_t* np, u32 frame, bool save) {
+    u32 slot = frame % NES_NETPLAY_HISTORY;
+    if (frame >= np->confirmed && !np->received[slot]) {
+        np->remote[slot] = predict(np, frame);
+        if (save) nes_state_save(np->nes, state(np, frame), np->state_size);
+    }
+    controller_set(np->nes, np->port, np->local[slot]);
+    controller_set(np->nes, !np->port, np->remote[slot]);
+    if (frame < np->frame) {
+        nes_skip_frame(np->nes);
+    } else {
+        nes_run_frame(np->nes);
+    }
+}
+
+// Loads the state before the frame and runs the frames up to the present again, returns false if
+// the state could not be loaded
+static bool rollback(nes_netplay_t* np, u32 frame) {
+    double start = clock_now();
+    if (!nes_state_load(np->nes, state(np, frame), np->state_size)) return false;
+    for (u32 f = frame; f < np->frame; f++) {
+        run(np, f, f != frame);
+    }
+    double seconds = clock_now() - start;
+
+    u32 replayed = np->frame - frame;
+    np->rollbacks++;
+    np->replayed += replayed;
+    np->replay_seconds += seconds;
+    if (replayed > np->max_replayed) np->max_replayed = replayed;
+    if (seconds > np->max_replay_seconds) np->max_replay_seconds = seconds;
+    return true;
+}
+
+// Sends the local input of the frames before end not acknowledged yet
+static void send_input(nes_netplay_t* np, u32 end) {
+    u8 packet[NES_NETPLAY_PACKET_SIZE];
+    u32 count = end - np->acked;
+    put32(packet, np->confirmed);
+    put32(packet + 4, np->acked);
+    packet[8] = count;
+    for (u32 i = 0; i < count; i++) {
+        packet[9 + i] = np->local[(np->acked + i) % NES_NETPLAY_HISTORY];
+    }
+    np->transport.send(np->transport.context, packet, 9 + count);
+}
+
+// Takes the remote input of a packet, returns the first frame run on a wrong prediction or the
+// current frame if there is none
+static u32 receive_input(nes_netplay_t* np, u8 const* packet, size_t size) {
+    u32 wrong = np->frame;
+    if (size < 9 || size < 9u + packet[8]) return wrong;
+    u32 acked = get32(packet);
+    if (acked > np->acked && acked <= np->frame) np->acked = acked;
+
+    u32 first = get32(packet + 4);
+    for (u32 i = 0; i < packet[8]; i++) {
+        u32 frame = first + i;
+        u32 slot = frame % NES_NETPLAY_HISTORY;
+        if (frame < np->confirmed || frame - np->confirmed >= NES_NETPLAY_HISTORY) continue;
+        if (np->received[slot]) continue;
+        if (frame < np->frame && np->remote[slot] != packet[9 + i] && frame < wrong) wrong = frame;
+        np->remote[slot] = packet[9 + i];
+        np->received[slot] = true;
+    }
+    while (np->received[np->confirmed % NES_NETPLAY_HISTORY]) {
+        np->last_remote = np->remote[np->confirmed % NES_NETPLAY_HISTORY];
+        np->received[np->confirmed % NES_NETPLAY_HISTORY] = false;
+        np->confirmed++;
+    }
+    return wrong;
+}
+
+// Starts a session for the local player on the given controller port of a console, in the same
+// state as the console of the other player. Returns false if memory is missing.
+bool nes_netplay_init(
+  nes_netplay_t* np, nes_t* nes, nes_netplay_transport_t transport, u8 port) {
+    memset(np, 0, sizeof(nes_netplay_t));
+    np->nes = nes;
+    np->transport = transport;
+    np->port = port;
+    np->state_size = nes_state_size(nes);
+    np->states = malloc(NES_NETPLAY_WINDOW * np->state_size);
+    return np->states != NULL;
+}
+
+void nes_netplay_free(nes_netplay_t* np) {
+    free(np->states);
+    memset(np, 0, sizeof(nes_netplay_t));
+}
+
+// Receives the remote input that arrived and rolls back if a prediction was wrong. Returns false
+// if the rollback failed, the session is then over.
+bool nes_netplay_poll(nes_netplay_t* np) {
+    if (np->failed) return false;
+    u8 packet[NES_NETPLAY_PACKET_SIZE];
+    u32 wrong = np->frame;
+    size_t size;
+    while ((size = np->transport.receive(np->transport.context, packet, sizeof(packet)))) {
+        u32 frame = receive_input(np, packet, size);
+        if (frame < wrong) wrong = frame;
+    }
+    if (wrong < np->frame && !rollback(np, wrong)) np->failed = true;
+    return !np->failed;
+}
+
+// Runs the next frame with the buttons of the local player, see nes_netplay_result_t
+nes_netplay_result_t nes_netplay_frame(nes_netplay_t* np, u8 buttons) {
+    if (!nes_netplay_poll(np)) return NES_NETPLAY_FAILED;
+    // The remote input received can be ahead of the frame
+    if (
+      np->frame >= np->confirmed + NES_NETPLAY_WINDOW ||
+      np->frame >= np->acked + NES_NETPLAY_WINDOW) {
+        send_input(np, np->frame);
+        np->stalls++;
+        return NES_NETPLAY_STALLED;
+    }
+    np->local[np->frame % NES_NETPLAY_HISTORY] = buttons;
+    send_input(np, np->frame + 1);
+    run(np, np->frame, true);
+    np->frame++;
+    return NES_NETPLAY_RAN;
+}
+
+/* Loopback */
+
+static u32 next_random(nes_loopback_t* lb) {
+    lb->seed = lb->seed * 1103515245 + 12345;
+    return lb->seed >> 16;
+}
+
+static void loopback_send(void* context, u8 const* data, size_t size) {
+    nes_loopback_end_t* end = context;
+    nes_loopback_t* lb = end->loopback;
+    u8 to = !end->side;
+    lb->sent++;
+    if (lb->count[to] == NES_LOOPBACK_QUEUE || size > NES_NETPLAY_PACKET_SIZE) {
+        lb->dropped++;
+        return;
+    }
+    nes_loopback_packet_t* packet = &lb->queue[to][lb->count[to]++];
+    memcpy(packet->data, data, size);
+    packet->size = size;
+    packet->deliver = lb->clock + lb->latency + next_random(lb) % (lb->jitter + 1);
+}
+
+// Receives the packet that arrived first, packets sent later can arrive sooner with jitter
+static size_t loopback_receive(void* context, u8* data, size_t size) {
+    nes_loopback_end_t* end = context;
+    nes_loopback_t* lb = end->loopback;
+    nes_loopback_packet_t* queue = lb->queue[end->side];
+    size_t first = lb->count[end->side];
+    for (size_t i = 0; i < lb->count[end->side]; i++) {
+        if (queue[i].deliver > lb->clock) continue;
+        if (first == lb->count[end->side] || queue[i].deliver < queue[first].deliver) first = i;
+    }
+    if (first == lb->count[end->side] || queue[first].size > size) return 0;
+
+    size_t received = queue[first].size;
+    memcpy(data, queue[first].data, received);
+    // Keeps the order of the rest, packets with the same delivery tick arrive in order
+    memmove(
+      &queue[first], &queue[first + 1], (--lb->count[end->side] - first) * sizeof(*queue));
+    return received;
+}
+
+void nes_loopback_init(nes_loopback_t* lb, u32 latency, u32 jitter, u32 seed) {
+    memset(lb, 0, sizeof(nes_loopback_t));
+    lb->latency = latency;
+    lb->jitter = jitter;
+    lb->seed = seed;
+    for (u8 i = 0; i < 2; i++) {
+        lb->end[i] = (nes_loopback_end_t){ lb, i };
+    }
+}
+
+// Transport of one side, side 0 sends to side 1 and the other way around
+nes_netplay_transport_t nes_loopback_transport(nes_loopback_t* lb, u8 side) {
+    return (nes_netplay_transport_t){ &lb->end[side], loopback_send, loopback_receive };
+}
+
+void nes_loopback_tick(nes_loopback_t* lb) {
+    lb->clock++;
+}
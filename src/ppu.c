@@ -4,89 +4,17 @@
 #include "cartridge.h"
 #include "cpu.h"
 #include "log.h"
+#include "memory.h"
 #include "nes.h"
+#include "scheduler.h"
 
 #include <string.h>
 
-#define PPU_RENDERING (PPUMASK.bg || PPUMASK.spr)
-#define PPU_SPRITE_H (PPUCTRL.sprSz ? 16 : 8)
-
-typedef struct {
-    u8 id;    // Index in OAM
-    u8 x;     // X position
-    u8 y;     // Y position
-    u8 tile;  // Tile index
-    u8 attr;  // Attributes
-    u8 dataL; // Tile data (low)
-    u8 dataH; // Tile data (high)
-} ppu_sprite_t;
-
-/* Register File */
-// PPUCTRL ($2000) register
-union {
-    struct {
-        unsigned nt : 2;     // Nametable ($2000 / $2400 / $2800 / $2C00).
-        unsigned incr : 1;   // Address increment (1 / 32).
-        unsigned sprTbl : 1; // Sprite pattern table ($0000 / $1000).
-        unsigned bgTbl : 1;  // BG pattern table ($0000 / $1000).
-        unsigned sprSz : 1;  // Sprite size (8x8 / 8x16).
-        unsigned slave : 1;  // PPU master/slave.
-        unsigned nmi : 1;    // Enable NMI.
-    };
-    u8 r;
-} PPUCTRL;
-
-// PPUMASK ($2001) register
-union {
-    struct {
-        unsigned gray : 1;    // Grayscale.
-        unsigned bgLeft : 1;  // Show background in leftmost 8 pixels.
-        unsigned sprLeft : 1; // Show sprite in leftmost 8 pixels.
-        unsigned bg : 1;      // Show background.
-        unsigned spr : 1;     // Show sprites.
-        unsigned red : 1;     // Intensify reds.
-        unsigned green : 1;   // Intensify greens.
-        unsigned blue : 1;    // Intensify blues.
-    };
-    u8 r;
-} PPUMASK;
-
-// PPUSTATUS ($2002) register
-union {
-    struct {
-        unsigned bus : 5;    // Not significant.
-        unsigned sprOvf : 1; // Sprite overflow.
-        unsigned sprHit : 1; // Sprite 0 Hit.
-        unsigned vBlank : 1; // In VBlank?
-    };
-    u8 r;
-} PPUSTATUS;
-
-// PPUSCROLL ($2005) and PPUADDR ($2006)
-typedef union ADDR {
-    struct {
-        unsigned cX : 5; // Coarse X.
-        unsigned cY : 5; // Coarse Y.
-        unsigned nt : 2; // Nametable.
-        unsigned fY : 3; // Fine Y.
-    };
-    struct {
-        unsigned l : 8;
-        unsigned h : 7;
-    };
-    unsigned addr : 14;
-    unsigned r : 15;
-} PPUADDR;
-
-struct {
-    PPUADDR vAddr;
-    PPUADDR tAddr;
-    unsigned fX : 3;
-    unsigned w : 1;
-} PPUINTER = { .w = 0 };
+#define PPU_RENDERING (nes->ppu.mask.bg || nes->ppu.mask.spr)
+#define PPU_SPRITE_H (nes->ppu.ctrl.sprSz ? 16 : 8)
 
 /* Registers Declaration
- * Register files that are defined in ppu.h
+ * Register files that are defined in nes.h
  * - PPUCTRL					$2000
  * - PPUMASK					$2001
  * - PPUSATUS					$2002
@@ -118,45 +46,19 @@ struct {
  *	- Supports 64 sprites in total.
  */
 
-u8 ciRam[0x800];
-u8 cgRam[0x20]; // [?] palettes may be replaced using hardware solution
-u8 oamMem[0x100];
-ppu_sprite_t oam[8],
-  secOam[8]; // [?] why need two? [?] Second OAM functions like a buffer
-
-u8 oamAddr;
-
-// Background latches:
-u8 nt, at, bgL, bgH;
-// Background shift registers:
-u8 atShiftL, atShiftH;
-u16 bgShiftL, bgShiftH;
-u8 atLatchL, atLatchH;
-
-u8 frameOdd;
-u16 scanline, dot;
-
-/* Graphic Memory (LCD) */
-// Width: 240 Height: 320
-u8 GRAM[NES_DISPLAY_WIDTH * NES_DISPLAY_HEIGHT]; // [!] Can be moved to
-                                                 // external memory
-
-/* Configurations */
-ppu_mirror_t mirroring;
-
 /* Configurations Access */
-void ppu_set_mirror(ppu_mirror_t mode) {
-    mirroring = mode;
+void ppu_set_mirror(nes_t* nes, ppu_mirror_t mode) {
+    nes->ppu.mirroring = mode;
 }
 
-u16 ppu_nt_mirror(u16 addr) {
+u16 ppu_nt_mirror(nes_t* nes, u16 addr) {
     // [?] Should the input address be 0x0XXX instead of 0x2XXX
     // [!] Horizontal Implementation != LaiNES
-    switch (mirroring) {
+    switch (nes->ppu.mirroring) {
         case VERTICAL:
             return addr % 0x800; // Use the top two ($2000 and $2400)
         case HORIZONTAL:
-            return ((addr & 0x800) + addr % 0x400); // Use the left two ($2000 and $2800)
+            return ((addr & 0x800) >> 1) + addr % 0x400; // Use the left two ($2000 and $2800)
         default:
             return addr - 0x2000; // [?] Why need this
     }
@@ -174,420 +76,777 @@ u16 ppu_nt_mirror(u16 addr) {
  * - $3F00 - $3F1F		Palette RAM indexes
  * - $3F20 - $3FFF		Mirrors of $3F00 - $3F1F
  * */
-u8 ppu_rd(u16 addr) {
-    switch (addr) {
-        case 0x0000 ... 0x1FFF:
-            return cartridge_chr_rd(addr);
-        case 0x2000 ... 0x3EFF:
-            return ciRam[ppu_nt_mirror(addr)];
-        case 0x3F00 ... 0x3FFF:
-            // 0x3F10 0x3F14 ... 0x3F1C are the mirrors of 0x3F00 ... 0x3F0C
-            if ((addr & 0x13) == 0x10) addr &= ~0x10;
-            return cgRam[addr & 0x1F] & (PPUMASK.gray ? 0x30 : 0xFF);
-        default:
-            return 0x00;
+u8 ppu_rd(nes_t* nes, u16 addr) {
+    if (addr < 0x2000) {
+        return cartridge_chr_rd(nes, addr);
+    } else if (addr < 0x3F00) {
+        return nes->ppu.ciRam[ppu_nt_mirror(nes, addr)];
+    } else if (addr < 0x4000) {
+        // 0x3F10 0x3F14 ... 0x3F1C are the mirrors of 0x3F00 ... 0x3F0C
+        if ((addr & 0x13) == 0x10) addr &= ~0x10;
+        return nes->ppu.cgRam[addr & 0x1F] & (nes->ppu.mask.gray ? 0x30 : 0xFF);
+    } else {
+        return 0x00;
     }
 }
 
-void ppu_wr(u16 addr, u8 v) {
-    switch (addr) {
-        case 0x0000 ... 0x1FFF:
-            cartridge_chr_wr(addr, v);
-            break;
-        case 0x2000 ... 0x3EFF:
-            ciRam[ppu_nt_mirror(addr)] = v;
-            break;
-        case 0x3F00 ... 0x3FFF:
-            if ((addr & 0x13) == 0x10) addr &= ~0x10;
-            cgRam[addr & 0x1F] = v;
-            break;
+void ppu_wr(nes_t* nes, u16 addr, u8 v) {
+    if (addr < 0x2000) {
+        cartridge_chr_wr(nes, addr, v);
+    } else if (addr < 0x3F00) {
+        u16 index = ppu_nt_mirror(nes, addr);
+        nes->ppu.ciRam[index] = v;
+        memory_dirty(nes, NES_DIRTY_VRAM, index);
+    } else if (addr < 0x4000) {
+        if ((addr & 0x13) == 0x10) addr &= ~0x10;
+        nes->ppu.cgRam[addr & 0x1F] = v;
     }
 }
 
 /* PPU Registers Access */
-u8 ppu_reg_access(u16 index, u8 v, ppu_rw_t rw) {
-    static u8 res = 0;    // Result of the operation
-    static u8 buffer = 0; // VRAM read buffer
+u8 ppu_reg_access(nes_t* nes, u16 index, u8 v, ppu_rw_t rw) {
     if (rw == WRITE) {
-        res = v;
+        nes->ppu.bus = v;
         switch (index) {
             case 0: // PPUCTRL	($2000)
-                PPUCTRL.r = v;
-                PPUINTER.tAddr.nt = PPUCTRL.nt;
+                if ((nes->ppu.ctrl.r ^ v) & 0x20) nes->ppu.linesFound = false;
+                nes->ppu.ctrl.r = v;
+                nes->ppu.tAddr.nt = nes->ppu.ctrl.nt;
                 break;
             case 1: // PPUMASK	($2001)
-                PPUMASK.r = v;
+                nes->ppu.mask.r = v;
                 break;
             case 3: // OAMADDR	($2003)
-                oamAddr = v;
+                nes->ppu.oamAddr = v;
                 break;
             case 4: // OAMDATA	($2004)
-                oamMem[oamAddr++] = v;
+                nes->ppu.oamMem[nes->ppu.oamAddr++] = v;
+                nes->ppu.linesFound = false;
                 break;
             case 5: // PPUSCROLL	($2005)
-                if (!PPUINTER.w) {
-                    PPUINTER.fX = v & 0x07;
-                    PPUINTER.tAddr.cX = v >> 3;
+                if (!nes->ppu.w) {
+                    nes->ppu.fX = v & 0x07;
+                    nes->ppu.tAddr.cX = v >> 3;
                 } else {
-                    PPUINTER.tAddr.fY = v & 0x07;
-                    PPUINTER.tAddr.cY = v >> 3;
+                    nes->ppu.tAddr.fY = v & 0x07;
+                    nes->ppu.tAddr.cY = v >> 3;
                 }
-                PPUINTER.w = !PPUINTER.w;
+                nes->ppu.w = !nes->ppu.w;
                 break;
             case 6: // PPUADDR 	($2006)
-                if (!PPUINTER.w) {
-                    PPUINTER.tAddr.h = v & 0x3F;
+                if (!nes->ppu.w) {
+                    nes->ppu.tAddr.h = v & 0x3F;
                 } else {
-                    PPUINTER.tAddr.l = v;
-                    PPUINTER.vAddr.r = PPUINTER.tAddr.r;
+                    nes->ppu.tAddr.l = v;
+                    nes->ppu.vAddr.r = nes->ppu.tAddr.r;
                 }
-                PPUINTER.w = !PPUINTER.w;
+                nes->ppu.w = !nes->ppu.w;
                 break;
             case 7:
-                ppu_wr(PPUINTER.vAddr.addr, v);
-                PPUINTER.vAddr.addr += PPUCTRL.incr ? 32 : 1;
+                ppu_wr(nes, nes->ppu.vAddr.addr, v);
+                nes->ppu.vAddr.addr += nes->ppu.ctrl.incr ? 32 : 1;
         }
+        // Writes may move the next vblank or sprite 0 line
+        ppu_schedule(nes);
     } else {
         switch (index) {
             case 2:
-                res = (res & 0x1F) | PPUSTATUS.r;
-                PPUSTATUS.vBlank = 0;
-                PPUINTER.w = 0;
+                nes->ppu.bus = (nes->ppu.bus & 0x1F) | nes->ppu.status.r;
+                nes->ppu.status.vBlank = 0;
+                nes->ppu.w = 0;
                 break;
             case 4:
-                res = oamMem[oamAddr];
+                nes->ppu.bus = nes->ppu.oamMem[nes->ppu.oamAddr];
                 break;
             case 7:
-                if (PPUINTER.vAddr.addr <= 0x3EFF) {
-                    res = buffer;
-                    buffer = ppu_rd(PPUINTER.vAddr.addr);
+                if (nes->ppu.vAddr.addr <= 0x3EFF) {
+                    nes->ppu.bus = nes->ppu.buffer;
+                    nes->ppu.buffer = ppu_rd(nes, nes->ppu.vAddr.addr);
                 } else
-                    res = buffer = ppu_rd(PPUINTER.vAddr.addr);
-                PPUINTER.vAddr.addr += PPUCTRL.incr ? 32 : 1;
+                    nes->ppu.bus = nes->ppu.buffer = ppu_rd(nes, nes->ppu.vAddr.addr);
+                nes->ppu.vAddr.addr += nes->ppu.ctrl.incr ? 32 : 1;
         }
     }
-    return res;
+    return nes->ppu.bus;
 }
 
 /* Calculate graphics addresses */
 // Get PPU nametable address
-u16 ppu_get_nt_addr() {
-    return 0x2000 | (PPUINTER.vAddr.r & 0xFFF);
+u16 ppu_get_nt_addr(nes_t* nes) {
+    return 0x2000 | (nes->ppu.vAddr.r & 0xFFF);
 }
 // Get PPU Attribute table address
-u16 ppu_get_at_addr() {
+u16 ppu_get_at_addr(nes_t* nes) {
     // [?] Why coarse X and Y are divided by 4
-    return 0x23C0 | (PPUINTER.vAddr.nt << 10) | ((PPUINTER.vAddr.cY / 4) << 3) |
-           (PPUINTER.vAddr.cX / 4);
+    return 0x23C0 | (nes->ppu.vAddr.nt << 10) | ((nes->ppu.vAddr.cY / 4) << 3) |
+           (nes->ppu.vAddr.cX / 4);
 }
 // Get Background Tile Address
-u16 ppu_get_bg_addr() {
-    return (PPUCTRL.bgTbl * 0x1000) + (nt * 16) + PPUINTER.vAddr.fY;
+u16 ppu_get_bg_addr(nes_t* nes) {
+    return (nes->ppu.ctrl.bgTbl * 0x1000) + (nes->ppu.nt * 16) + nes->ppu.vAddr.fY;
 }
 
 /*
- * ppu_h_scroll()
+ * ppu_h_scroll(nes)
  * Horizontal Scroll
  *
- * ppu_v_scroll()
+ * ppu_v_scroll(nes)
  * Vertical Scroll happens if rendering is enabled. It's called @ dot 256
  * */
-void ppu_h_scroll() {
+void ppu_h_scroll(nes_t* nes) {
     if (!PPU_RENDERING) return;
-    if (PPUINTER.vAddr.cX == 31)
-        PPUINTER.vAddr.r ^= 0x41F; // Switch horizontal nametable and wrap coarse X.
+    if (nes->ppu.vAddr.cX == 31)
+        nes->ppu.vAddr.r ^= 0x41F; // Switch horizontal nametable and wrap coarse X.
     else
-        PPUINTER.vAddr.cX++;
+        nes->ppu.vAddr.cX++;
 }
 
-void ppu_v_scroll() {
+void ppu_v_scroll(nes_t* nes) {
     if (!PPU_RENDERING) return;
-    if (PPUINTER.vAddr.fY < 7) // Check if still in the same tile after scroll
-        PPUINTER.vAddr.fY++;
+    if (nes->ppu.vAddr.fY < 7) // Check if still in the same tile after scroll
+        nes->ppu.vAddr.fY++;
     else {
-        PPUINTER.vAddr.fY = 0; // Wrap if move to the next tile.
-        if (PPUINTER.vAddr.cY == 31)
-            PPUINTER.vAddr.cY = 0; // Wrap the tile to the top row if needed
-        else if (PPUINTER.vAddr.cY == 29) {
-            PPUINTER.vAddr.cY = 0;
-            PPUINTER.vAddr.nt ^= 0b10;
+        nes->ppu.vAddr.fY = 0; // Wrap if move to the next tile.
+        if (nes->ppu.vAddr.cY == 31)
+            nes->ppu.vAddr.cY = 0; // Wrap the tile to the top row if needed
+        else if (nes->ppu.vAddr.cY == 29) {
+            nes->ppu.vAddr.cY = 0;
+            nes->ppu.vAddr.nt ^= 0x2;
         } else
-            PPUINTER.vAddr.cY++;
+            nes->ppu.vAddr.cY++;
     }
 }
 
 /*
- * ppu_h_update()
+ * ppu_h_update(nes)
  * Load the horizontal location from temporary address to current address.
  *
  * PPU_Vupdate()
  * Load the vertical location from temporary address to current address.
  * */
-void ppu_h_update() {
+void ppu_h_update(nes_t* nes) {
     if (!PPU_RENDERING) return;
-    PPUINTER.vAddr.r = (PPUINTER.vAddr.r & ~0x041F) |
-                       (PPUINTER.tAddr.r & 0x041F); // Set the NT and the coarse X from tAddr
+    nes->ppu.vAddr.r = (nes->ppu.vAddr.r & ~0x041F) |
+                       (nes->ppu.tAddr.r & 0x041F); // Set the NT and the coarse X from tAddr
 }
 
-void ppu_v_update() {
+void ppu_v_update(nes_t* nes) {
     if (!PPU_RENDERING) return;
-    PPUINTER.vAddr.r = (PPUINTER.vAddr.r & ~0x7BE0) |
-                       (PPUINTER.tAddr.r & 0x7BE0); // Set the NT and fine and coarse X from tAddr
+    nes->ppu.vAddr.r = (nes->ppu.vAddr.r & ~0x7BE0) |
+                       (nes->ppu.tAddr.r & 0x7BE0); // Set the NT and fine and coarse X from tAddr
 }
 
-void ppu_reload_shift() {
-    bgShiftL = (bgShiftL & 0xFF00) | bgL;
-    bgShiftH = (bgShiftH & 0xFF00) | bgH;
-    atLatchH = (at & 1);
-    atLatchH = (at & 2);
+void ppu_reload_shift(nes_t* nes) {
+    nes->ppu.bgShiftL = (nes->ppu.bgShiftL & 0xFF00) | nes->ppu.bgL;
+    nes->ppu.bgShiftH = (nes->ppu.bgShiftH & 0xFF00) | nes->ppu.bgH;
+    nes->ppu.atLatchL = (nes->ppu.at & 1);
+    nes->ppu.atLatchH = (nes->ppu.at & 2) >> 1;
 }
 
 /* Clear Secondary OAM */
-void ppu_clear_oam() {
+void ppu_clear_oam(nes_t* nes) {
     for (int i = 0; i < 8; i++) {
-        secOam[i].id = 64;
-        secOam[i].y = 0xFF;
-        secOam[i].tile = 0xFF;
-        secOam[i].attr = 0xFF;
-        secOam[i].x = 0xFF;
-        secOam[i].dataL = 0;
-        secOam[i].dataH = 0;
+        nes->ppu.secOam[i].id = 64;
+        nes->ppu.secOam[i].y = 0xFF;
+        nes->ppu.secOam[i].tile = 0xFF;
+        nes->ppu.secOam[i].attr = 0xFF;
+        nes->ppu.secOam[i].x = 0xFF;
+        nes->ppu.secOam[i].dataL = 0;
+        nes->ppu.secOam[i].dataH = 0;
     }
 }
 
-/* Fill secondary OAM with the sprite info for the next scanline */
-void ppu_eval_sprites() {
-    int n = 0;
+/* Sprite lines
+ * OAM rarely changes during a frame, so rather than scanning all 64 sprites on every line, the
+ * sprites covering each line are listed once, in OAM order, and evaluation reads the list of the
+ * line. The lists are found again on the next evaluation after an OAMDATA write or a change of the
+ * sprite height. A line keeps the first 8 sprites and counts a 9th for the overflow flag.
+ */
+static void ppu_find_lines(nes_t* nes) {
+    memset(nes->ppu.lineCount, 0, sizeof(nes->ppu.lineCount));
     for (int i = 0; i < 64; i++) {
-        /*
-         * - Starting from -1 because sprite cannot be drawn on the first line.
-         * - Here is measures if the current scanline will across any sprite
-         * */
-        int line = (scanline == 261 ? -1 : scanline) -
-                   oamMem[i * 4 + 0]; // Each sprite takes 4 bytes in oamMem
-        if (line >= 0 && line < PPU_SPRITE_H) {
-            secOam[n].id = i;
-            secOam[n].y = oamMem[i * 4 + 0];
-            secOam[n].tile = oamMem[i * 4 + 1];
-            secOam[n].attr = oamMem[i * 4 + 2];
-            secOam[n].x = oamMem[i * 4 + 3];
-
-            /* Max number of sprites in a scanline is 8.
-             * If more than 8 sprites are founded in one line, sprites overflow
-             * interrupt is triggered.
-             * */
-            if (++n > 8) {
-                PPUSTATUS.sprOvf = 1;
-                break;
-            }
+        int y = nes->ppu.oamMem[i * 4 + 0]; // Each sprite takes 4 bytes in oamMem
+        int end = y + PPU_SPRITE_H < NES_DISPLAY_HEIGHT ? y + PPU_SPRITE_H : NES_DISPLAY_HEIGHT;
+        for (int line = y; line < end; line++) {
+            u8 n = nes->ppu.lineCount[line];
+            if (n < 8) nes->ppu.lineSprites[line][n] = i;
+            if (n < 9) nes->ppu.lineCount[line] = n + 1;
         }
     }
+    nes->ppu.linesFound = true;
+}
+
+/* Fill secondary OAM with the sprite info for the next scanline */
+void ppu_eval_sprites(nes_t* nes) {
+    // Sprite cannot be drawn on the first line, none is found on the pre-render line
+    if (nes->ppu.scanline >= NES_DISPLAY_HEIGHT) return;
+    if (!nes->ppu.linesFound) ppu_find_lines(nes);
+
+    int count = nes->ppu.lineCount[nes->ppu.scanline];
+    /* Max number of sprites in a scanline is 8.
+     * If more than 8 sprites are founded in one line, sprites overflow
+     * interrupt is triggered.
+     * */
+    if (count > 8) {
+        nes->ppu.status.sprOvf = 1;
+        count = 8;
+    }
+    for (int n = 0; n < count; n++) {
+        int i = nes->ppu.lineSprites[nes->ppu.scanline][n];
+        nes->ppu.secOam[n].id = i;
+        nes->ppu.secOam[n].y = nes->ppu.oamMem[i * 4 + 0];
+        nes->ppu.secOam[n].tile = nes->ppu.oamMem[i * 4 + 1];
+        nes->ppu.secOam[n].attr = nes->ppu.oamMem[i * 4 + 2];
+        nes->ppu.secOam[n].x = nes->ppu.oamMem[i * 4 + 3];
+    }
 }
 
 /* Load the sprite info into primary OAM and fetch their tile data */
-void ppu_load_sprites() {
+void ppu_load_sprites(nes_t* nes) {
     u16 addr;
     for (int i = 0; i < 8; i++) {
-        oam[i] = secOam[i]; // Load sprite data
+        nes->ppu.oam[i] = nes->ppu.secOam[i]; // Load sprite data
+        // Empty slots stay transparent, their fetches are not used
+        if (nes->ppu.oam[i].id == 64) {
+            memset(nes->ppu.oam[i].pixels, 0, sizeof(nes->ppu.oam[i].pixels));
+            continue;
+        }
         // Sprite height setting
         if (PPU_SPRITE_H == 16)
-            addr = ((oam[i].tile & 1) * 0x1000) +
-                   ((oam[i].tile & ~1) * 16); // Bit 0 determined the bank index.
+            addr = ((nes->ppu.oam[i].tile & 1) * 0x1000) +
+                   ((nes->ppu.oam[i].tile & ~1) * 16); // Bit 0 determined the bank index.
         else
-            addr =
-              (PPUCTRL.sprTbl * 0x1000) + (oam[i].tile * 16); // Each tile is 16B in pattern table.
+            addr = (nes->ppu.ctrl.sprTbl * 0x1000) +
+                   (nes->ppu.oam[i].tile * 16); // Each tile is 16B in pattern table.
 
-        u8 sprY = (scanline - oam[i].y) % PPU_SPRITE_H;
-        if (oam[i].attr & 0x80)
+        u8 sprY = (nes->ppu.scanline - nes->ppu.oam[i].y) % PPU_SPRITE_H;
+        if (nes->ppu.oam[i].attr & 0x80)
             sprY ^= PPU_SPRITE_H - 1; // [?] Why veritical flip can be achieved in this way?
         addr += sprY + (sprY & 8);    // Check if the addr is on the second part of
                                       // the tile. Add the offset if it is
-        oam[i].dataL = ppu_rd(addr + 0);
-        oam[i].dataH = ppu_rd(addr + 8);
+        nes->ppu.oam[i].dataL = ppu_rd(nes, addr + 0);
+        nes->ppu.oam[i].dataH = ppu_rd(nes, addr + 8);
+        u8 const* row = cartridge_chr_row(nes, addr, nes->ppu.oam[i].attr & 0x40);
+        memcpy(nes->ppu.oam[i].pixels, row, 8);
     }
 }
 
+/* Decode the tile data of a loaded sprite, as ppu_load_sprites does from the cartridge */
+void ppu_decode_sprite(ppu_sprite_t* spr) {
+    for (int i = 0; i < 8; i++) {
+        u8 bit = spr->attr & 0x40 ? i : 7 - i;
+        spr->pixels[i] = (NTH_BIT(spr->dataH, bit) << 1) | NTH_BIT(spr->dataL, bit);
+    }
+}
+
+// Sprite 0 is on the current line and may still hit, lines of skipped frames are only checked then
+static bool ppu_hit_pending(nes_t* nes) {
+    return nes->ppu.mask.bg && nes->ppu.mask.spr && !nes->ppu.status.sprHit &&
+           nes->ppu.oam[0].id == 0;
+}
+
 /* Process a pixel, draw it if it's on screen */
-void ppu_update_pixels() {
+void ppu_update_pixels(nes_t* nes) {
     u8 palette = 0;
     u8 objPalette = 0;
     u8 objPriority = 0;
-    int x = dot - 2; // [?] Why need to decrement by 2?
+    int x = nes->ppu.dot - 2; // [?] Why need to decrement by 2?
+    bool draw = !nes->ppu.skip || ppu_hit_pending(nes);
 
-    if (scanline < 240 && x >= 0 && x < 256) {
+    if (draw && nes->ppu.scanline < 240 && x >= 0 && x < 256) {
         // Background
-        if (PPUMASK.bg && !(!PPUMASK.bgLeft && x < 8)) {
+        if (nes->ppu.mask.bg && !(!nes->ppu.mask.bgLeft && x < 8)) {
             // Background:
-            palette =
-              (NTH_BIT(bgShiftH, 15 - PPUINTER.fX) << 1) | NTH_BIT(bgShiftL, 15 - PPUINTER.fX);
+            palette = (NTH_BIT(nes->ppu.bgShiftH, 15 - nes->ppu.fX) << 1) |
+                      NTH_BIT(nes->ppu.bgShiftL, 15 - nes->ppu.fX);
             if (palette)
-                palette |=
-                  ((NTH_BIT(atShiftH, 7 - PPUINTER.fX) << 1) | NTH_BIT(atShiftL, 7 - PPUINTER.fX))
-                  << 2;
+                palette |= ((NTH_BIT(nes->ppu.atShiftH, 7 - nes->ppu.fX) << 1) |
+                            NTH_BIT(nes->ppu.atShiftL, 7 - nes->ppu.fX))
+                           << 2;
         }
 
         // Sprites
-        if (PPUMASK.spr && !(!PPUMASK.sprLeft && x < 8)) {
+        if (nes->ppu.mask.spr && !(!nes->ppu.mask.sprLeft && x < 8)) {
             for (int i = 7; i >= 0; i--) // [?] Why start from i = 7
             {
-                if (oam[i].id == 64) continue;
-                u8 sprX = x - oam[i].x;
+                if (nes->ppu.oam[i].id == 64) continue;
+                u8 sprX = x - nes->ppu.oam[i].x;
                 if (sprX >= 8) continue;
-                if (oam[i].attr & 0x40) sprX ^= 7; // Horizontal flip
-                u8 sprPalette =
-                  (NTH_BIT(oam[i].dataH, 7 - sprX) << 1) | NTH_BIT(oam[i].dataL, 7 - sprX);
+                if (nes->ppu.oam[i].attr & 0x40) sprX ^= 7; // Horizontal flip
+                u8 sprPalette = (NTH_BIT(nes->ppu.oam[i].dataH, 7 - sprX) << 1) |
+                                NTH_BIT(nes->ppu.oam[i].dataL, 7 - sprX);
                 if (sprPalette == 0) continue;
-                if (oam[i].id == 0 && palette && x != 255) // check palette is
-                                                           // not transparent &&
-                                                           // hit the first
-                                                           // pixel.
-                    PPUSTATUS.sprHit = 1;
-                sprPalette |= (oam[i].attr & 3) << 2; // Add color to sprite pixel
-                objPalette = sprPalette + 0x10;       // [?] Why add 16 to sprPalette
-                objPriority = oam[i].attr & 0x20;
+                if (nes->ppu.oam[i].id == 0 && palette && x != 255) // check palette is
+                                                                    // not transparent &&
+                                                                    // hit the first
+                                                                    // pixel.
+                    nes->ppu.status.sprHit = 1;
+                sprPalette |= (nes->ppu.oam[i].attr & 3) << 2; // Add color to sprite pixel
+                objPalette = sprPalette + 0x10;                // [?] Why add 16 to sprPalette
+                objPriority = nes->ppu.oam[i].attr & 0x20;
             }
         }
 
         // Evaluate Priority
         if (objPalette && (palette == 0 || objPriority == 0)) palette = objPalette;
-        GRAM[(x + 32) * 240 + 239 - scanline] = palette % 256; // load the CLUP index
+        // load the CLUP index
+        if (!nes->ppu.skip) {
+            nes->ppu.GRAM[nes->ppu.scanline * NES_DISPLAY_WIDTH + x] = palette % 256;
+        }
     }
     // Perform background shifts;
-    bgShiftL <<= 1;
-    bgShiftH <<= 1;
-    atShiftL = (atShiftL << 1) | (atLatchL & 0x01);
-    atShiftH = (atShiftH << 1) | (atLatchH & 0x01);
+    nes->ppu.bgShiftL <<= 1;
+    nes->ppu.bgShiftH <<= 1;
+    nes->ppu.atShiftL = (nes->ppu.atShiftL << 1) | (nes->ppu.atLatchL & 0x01);
+    nes->ppu.atShiftH = (nes->ppu.atShiftH << 1) | (nes->ppu.atLatchH & 0x01);
 }
 
-void ppu_tick_scanline(ppu_scanline_t type) {
-    static u16 addr;
-
-    if (type == NMI && dot == 1) {
-        PPUSTATUS.vBlank = 1;
-        if (PPUCTRL.nmi) {
-            cpu_set_nmi(1);
+void ppu_tick_scanline(nes_t* nes, ppu_scanline_t type) {
+    if (type == NMI && nes->ppu.dot == 1) {
+        nes->ppu.frame++;
+        nes->ppu.status.vBlank = 1;
+        if (nes->ppu.ctrl.nmi) {
+            cpu_set_nmi(nes, 1);
         }
-    } else if (type == POST && dot == 0) {
+    } else if (type == POST && nes->ppu.dot == 0) {
         // [!] Bascially we do nothing on our platform
         // int updateGui = 0;
     } else if (type == VISIBLE || type == PRE) {
         // Sprites
-        switch (dot) {
+        switch (nes->ppu.dot) {
             case 1:
-                ppu_clear_oam();
-                if (type == PRE) PPUSTATUS.sprOvf = PPUSTATUS.sprHit = 0;
+                ppu_clear_oam(nes);
+                if (type == PRE) nes->ppu.status.sprOvf = nes->ppu.status.sprHit = 0;
                 break;
             case 257:
-                ppu_eval_sprites();
+                ppu_eval_sprites(nes);
                 break;
             case 321:
-                ppu_load_sprites();
+                ppu_load_sprites(nes);
         }
         // Background
-        switch (dot) {
-            case 2 ... 255:
-            case 322 ... 337:
-                ppu_update_pixels();
-                switch (dot % 8) {
-                    // Nametable
-                    case 1:
-                        addr = ppu_get_nt_addr();
-                        ppu_reload_shift();
-                        break;
-                    case 2:
-                        nt = ppu_rd(addr);
-                        break;
-                    // Attribute table
-                    case 3:
-                        addr = ppu_get_at_addr();
-                        break;
-                    case 4:
-                        at = ppu_rd(addr);
-                        if (PPUINTER.vAddr.cY & 2) at >>= 4;
-                        if (PPUINTER.vAddr.cX & 2) at >>= 2;
-                        break;
-                    case 5:
-                        addr = ppu_get_bg_addr();
-                        break;
-                    case 6:
-                        bgL = ppu_rd(addr);
-                        break;
-                    case 7:
-                        addr += 8;
-                    case 0:
-                        bgH = ppu_rd(addr);
-                        ppu_h_scroll();
-                        break;
-                }
-                break;
-            case 256:
-                ppu_update_pixels();
-                bgH = ppu_rd(addr);
-                ppu_v_scroll();
-                break;
-            case 257:
-                ppu_update_pixels();
-                ppu_reload_shift();
-                ppu_h_update();
-                break;
-            case 280 ... 304:
-                if (type == PRE) ppu_v_update();
-                break;
-
-            // No shift reloading
-            case 1:
-                addr = ppu_get_nt_addr();
-                if (type == PRE) PPUSTATUS.vBlank = 0;
-                break;
-            case 321:
-            case 339:
-                addr = ppu_get_nt_addr();
-                break;
-            case 338:
-                nt = ppu_rd(addr);
-                break;
-            case 340:
-                nt = ppu_rd(addr);
-                if (type == PRE && PPU_RENDERING && frameOdd) dot++;
+        if ((nes->ppu.dot >= 2 && nes->ppu.dot <= 255) ||
+            (nes->ppu.dot >= 322 && nes->ppu.dot <= 337)) {
+            ppu_update_pixels(nes);
+            switch (nes->ppu.dot % 8) {
+                // Nametable
+                case 1:
+                    nes->ppu.addr = ppu_get_nt_addr(nes);
+                    ppu_reload_shift(nes);
+                    break;
+                case 2:
+                    nes->ppu.nt = ppu_rd(nes, nes->ppu.addr);
+                    break;
+                // Attribute table
+                case 3:
+                    nes->ppu.addr = ppu_get_at_addr(nes);
+                    break;
+                case 4:
+                    nes->ppu.at = ppu_rd(nes, nes->ppu.addr);
+                    if (nes->ppu.vAddr.cY & 2) nes->ppu.at >>= 4;
+                    if (nes->ppu.vAddr.cX & 2) nes->ppu.at >>= 2;
+                    break;
+                case 5:
+                    nes->ppu.addr = ppu_get_bg_addr(nes);
+                    break;
+                case 6:
+                    nes->ppu.bgL = ppu_rd(nes, nes->ppu.addr);
+                    break;
+                case 7:
+                    nes->ppu.addr += 8;
+                    break;
+                case 0:
+                    nes->ppu.bgH = ppu_rd(nes, nes->ppu.addr);
+                    ppu_h_scroll(nes);
+                    break;
+            }
+        } else if (nes->ppu.dot >= 280 && nes->ppu.dot <= 304) {
+            if (type == PRE) ppu_v_update(nes);
+        } else {
+            switch (nes->ppu.dot) {
+                case 256:
+                    ppu_update_pixels(nes);
+                    nes->ppu.bgH = ppu_rd(nes, nes->ppu.addr);
+                    ppu_v_scroll(nes);
+                    break;
+                case 257:
+                    ppu_update_pixels(nes);
+                    ppu_reload_shift(nes);
+                    ppu_h_update(nes);
+                    break;
+
+                // No shift reloading
+                case 1:
+                    nes->ppu.addr = ppu_get_nt_addr(nes);
+                    if (type == PRE) nes->ppu.status.vBlank = 0;
+                    break;
+                case 321:
+                case 339:
+                    nes->ppu.addr = ppu_get_nt_addr(nes);
+                    break;
+                case 338:
+                    nes->ppu.nt = ppu_rd(nes, nes->ppu.addr);
+                    break;
+                case 340:
+                    nes->ppu.nt = ppu_rd(nes, nes->ppu.addr);
+                    if (type == PRE && PPU_RENDERING && nes->ppu.frameOdd) nes->ppu.dot++;
+            }
         }
-        if (dot == 260 && PPU_RENDERING) {
+        if (nes->ppu.dot == 260 && PPU_RENDERING) {
             // [!] Signal scanline to cartridge
             // int cartrige_int = 0;
         }
     }
 }
 
+#ifdef NES_PPU_SCANLINE
+/* Scanline renderer
+ * ppu_sync only stops mid-line when a register is accessed or an event is due, so no register
+ * changes during the lines it runs from their start to their end. Such lines are run at once with
+ * the same fetches, scroll updates and sprite steps the dots would make, in the same order. The
+ * background is drawn a tile at a time from the decoded rows of the cartridge, after the two tiles
+ * the previous line left in the shift registers, and composited with the sprites of the line in one
+ * pass. Lines a register access stops in the middle of are run dot by dot.
+ */
+
+// Dots 2 to 8 of a tile: nametable, attribute and pattern fetches
+static void ppu_fetch_tile(nes_t* nes) {
+    nes->ppu.nt = ppu_rd(nes, nes->ppu.addr);
+    nes->ppu.addr = ppu_get_at_addr(nes);
+    nes->ppu.at = ppu_rd(nes, nes->ppu.addr);
+    if (nes->ppu.vAddr.cY & 2) nes->ppu.at >>= 4;
+    if (nes->ppu.vAddr.cX & 2) nes->ppu.at >>= 2;
+    nes->ppu.addr = ppu_get_bg_addr(nes);
+    nes->ppu.bgL = ppu_rd(nes, nes->ppu.addr);
+    nes->ppu.addr += 8;
+    nes->ppu.bgH = ppu_rd(nes, nes->ppu.addr);
+}
+
+// Shifts the background registers by the 8 pixels of a tile and reloads them
+static void ppu_shift_tile(nes_t* nes) {
+    nes->ppu.bgShiftL <<= 8;
+    nes->ppu.bgShiftH <<= 8;
+    // The attribute shift registers fill with their latch
+    nes->ppu.atShiftL = nes->ppu.atLatchL ? 0xFF : 0x00;
+    nes->ppu.atShiftH = nes->ppu.atLatchH ? 0xFF : 0x00;
+    ppu_reload_shift(nes);
+}
+
+// Background palette indices of the 16 pixels in the shift registers, ignoring the fine scroll
+static void ppu_draw_shift(nes_t* nes, u8* line) {
+    for (int i = 0; i < 16; i++) {
+        int bit = 15 - i;
+        u8 palette = (NTH_BIT(nes->ppu.bgShiftH, bit) << 1) | NTH_BIT(nes->ppu.bgShiftL, bit);
+        if (palette) {
+            // Bits past the attribute shift registers come from the latch shifted in
+            int at = bit - 8;
+            u8 attr = (nes->ppu.atLatchH << 1) | nes->ppu.atLatchL;
+            if (at >= 0) {
+                attr = (NTH_BIT(nes->ppu.atShiftH, at) << 1) | NTH_BIT(nes->ppu.atShiftL, at);
+            }
+            palette |= attr << 2;
+        }
+        line[i] = palette;
+    }
+}
+
+// Background palette indices of the tile just fetched, 8 pixels at a time
+static void ppu_draw_tile(nes_t* nes, u8* line) {
+    u64 pixels;
+    memcpy(&pixels, cartridge_chr_row(nes, nes->ppu.addr - 8, false), 8);
+    // The attribute only goes to opaque pixels, bytes of 1 where either bit is set
+    u64 opaque = (pixels | pixels >> 1) & 0x0101010101010101;
+    pixels |= opaque * (u64)((nes->ppu.at & 3) << 2);
+    memcpy(line, &pixels, 8);
+}
+
+#ifdef NES_PPU_SIMD
+// GCC vector extension holding a run of pixels, one SSE2 or NEON register
+typedef u8 pixels_t __attribute__((vector_size(16)));
+
+static inline pixels_t ppu_pixels(u8 const* line) {
+    pixels_t v;
+    memcpy(&v, line, sizeof(v));
+    return v;
+}
+
+static inline pixels_t ppu_splat(u8 value) {
+    u8 data[sizeof(pixels_t)];
+    memset(data, value, sizeof(data));
+    return ppu_pixels(data);
+}
+
+// Composites a line 16 pixels at a time, the same way as the scalar loop
+static void ppu_composite(nes_t* nes, u8 const* bg, u8 const* obj, u8* out) {
+    // Lanes drawn in the first run and in the others, the mask bits may hide the left column
+    u8 left[sizeof(pixels_t)];
+    memset(left, 0xFF, sizeof(left));
+    memset(left, 0x00, 8);
+    pixels_t bgFirst = nes->ppu.mask.bgLeft ? ppu_splat(0xFF) : ppu_pixels(left);
+    pixels_t bgRest = ppu_splat(0xFF);
+    if (!nes->ppu.mask.bg) bgFirst = bgRest = ppu_splat(0x00);
+    pixels_t sprFirst = nes->ppu.mask.sprLeft ? ppu_splat(0xFF) : ppu_pixels(left);
+
+    pixels_t hit = ppu_splat(0);
+    for (int x = 0; x < NES_DISPLAY_WIDTH; x += sizeof(pixels_t)) {
+        pixels_t palette = ppu_pixels(bg + x) & (x ? bgRest : bgFirst);
+        pixels_t sprite = ppu_pixels(obj + x);
+        if (!x) sprite &= sprFirst;
+        pixels_t color = sprite & ppu_splat(0x1F);
+        pixels_t blank = (pixels_t)(palette == 0);
+        hit |= (pixels_t)((sprite & ppu_splat(0x40)) != 0) & ~blank;
+        pixels_t above = (pixels_t)((sprite & ppu_splat(0x20)) == 0);
+        pixels_t front = (pixels_t)(color != 0) & (blank | above);
+        palette = (color & front) | (palette & ~front);
+        memcpy(out + x, &palette, sizeof(pixels_t));
+    }
+
+    u64 lanes[sizeof(pixels_t) / 8];
+    memcpy(lanes, &hit, sizeof(lanes));
+    for (size_t i = 0; i < sizeof(pixels_t) / 8; i++) {
+        if (lanes[i]) nes->ppu.status.sprHit = 1;
+    }
+}
+#endif
+
+// Composites the background of a visible line with its sprites into the frame buffer
+static void ppu_draw_line(nes_t* nes, u8 const* bg) {
+    // Sprite pixel palette index, 0x20 if behind the background, 0x40 if sprite 0 is opaque
+    u8 obj[NES_DISPLAY_WIDTH] = { 0 };
+    if (nes->ppu.mask.spr) {
+        // Lower slots are drawn last and win
+        for (int i = 7; i >= 0; i--) {
+            ppu_sprite_t const* spr = &nes->ppu.oam[i];
+            if (spr->id == 64) continue;
+            for (u8 sprX = 0; sprX < 8; sprX++) {
+                u8 x = spr->x + sprX; // Wraps around to the left edge like the dot path
+                u8 palette = spr->pixels[sprX];
+                if (!palette) continue;
+                palette |= 0x10 | (spr->attr & 3) << 2;
+                obj[x] = (obj[x] & 0x40) | (spr->attr & 0x20) | palette;
+                if (spr->id == 0) obj[x] |= 0x40;
+            }
+        }
+    }
+
+    // Sprite 0 never hits at the last pixel
+    obj[NES_DISPLAY_WIDTH - 1] &= ~0x40;
+
+    u8* out = nes->ppu.GRAM + nes->ppu.scanline * NES_DISPLAY_WIDTH;
+#ifdef NES_PPU_SIMD
+    ppu_composite(nes, bg, obj, out);
+#else
+    for (int x = 0; x < NES_DISPLAY_WIDTH; x++) {
+        u8 palette = nes->ppu.mask.bg && (nes->ppu.mask.bgLeft || x >= 8) ? bg[x] : 0;
+        u8 sprite = nes->ppu.mask.sprLeft || x >= 8 ? obj[x] : 0;
+        if (sprite & 0x40 && palette) nes->ppu.status.sprHit = 1;
+        if (sprite & 0x1F && (palette == 0 || !(sprite & 0x20))) palette = sprite & 0x1F;
+        out[x] = palette;
+    }
+#endif
+}
+
+// Finds a sprite 0 hit on a line that is not drawn, like ppu_draw_line
+static void ppu_hit_line(nes_t* nes, u8 const* bg) {
+    ppu_sprite_t const* spr = &nes->ppu.oam[0];
+    for (u8 sprX = 0; sprX < 8; sprX++) {
+        u8 x = spr->x + sprX;
+        if (x == 255 || !spr->pixels[sprX] || !bg[x]) continue;
+        if (x < 8 && !(nes->ppu.mask.bgLeft && nes->ppu.mask.sprLeft)) continue;
+        nes->ppu.status.sprHit = 1;
+    }
+}
+
+// Runs a visible or pre-render line from dot 0 or 1 to its end
+static void ppu_run_line(nes_t* nes) {
+    bool pre = nes->ppu.scanline == 261;
+    // Lines of skipped frames only draw the background for a sprite 0 hit
+    bool draw = !pre && (!nes->ppu.skip || ppu_hit_pending(nes));
+    // The 2 tiles in the shift registers and the 32 fetched, the line starts fine X into them
+    u8 bg[34 * 8];
+    if (draw) ppu_draw_shift(nes, bg);
+
+    // Dot 1
+    ppu_clear_oam(nes);
+    if (pre) nes->ppu.status.sprOvf = nes->ppu.status.sprHit = nes->ppu.status.vBlank = 0;
+    nes->ppu.addr = ppu_get_nt_addr(nes);
+
+    // Dots 2 to 257, the scroll moves down a line and back to the left at the last tile
+    for (int tile = 0; tile < 32; tile++) {
+        ppu_fetch_tile(nes);
+        if (draw) ppu_draw_tile(nes, bg + (tile + 2) * 8);
+        if (tile < 31) {
+            ppu_h_scroll(nes);
+            ppu_shift_tile(nes);
+            nes->ppu.addr = ppu_get_nt_addr(nes);
+        } else {
+            ppu_v_scroll(nes);
+            ppu_eval_sprites(nes);
+            ppu_shift_tile(nes);
+            ppu_h_update(nes);
+        }
+    }
+    if (draw && nes->ppu.skip) {
+        ppu_hit_line(nes, bg + nes->ppu.fX);
+    } else if (draw) {
+        ppu_draw_line(nes, bg + nes->ppu.fX);
+    }
+
+    // Dots 280 to 304
+    if (pre) ppu_v_update(nes);
+
+    // Dots 321 to 337, sprites and the first two tiles of the next line
+    ppu_load_sprites(nes);
+    nes->ppu.addr = ppu_get_nt_addr(nes);
+    for (int tile = 0; tile < 2; tile++) {
+        ppu_fetch_tile(nes);
+        ppu_h_scroll(nes);
+        ppu_shift_tile(nes);
+        nes->ppu.addr = ppu_get_nt_addr(nes);
+    }
+
+    // Dots 338 to 340
+    nes->ppu.nt = ppu_rd(nes, nes->ppu.addr);
+    nes->ppu.addr = ppu_get_nt_addr(nes);
+    nes->ppu.nt = ppu_rd(nes, nes->ppu.addr);
+}
+
+// Runs the rest of a line starting at dot 0 or 1, moving on to the next line
+static void ppu_line(nes_t* nes) {
+    bool skip = false;
+    if (nes->ppu.scanline < 240 || nes->ppu.scanline == 261) {
+        ppu_run_line(nes);
+        skip = nes->ppu.scanline == 261 && PPU_RENDERING && nes->ppu.frameOdd;
+    } else if (nes->ppu.scanline == 241 && nes->ppu.dot <= 1) {
+        // Only vblank starts outside the frame
+        nes->ppu.dot = 1;
+        ppu_tick_scanline(nes, NMI);
+    }
+
+    // Dot 0 of the first line is skipped on odd frames while rendering
+    nes->ppu.dot = skip ? 1 : 0;
+    if (++nes->ppu.scanline > 261) {
+        nes->ppu.scanline = 0;
+        nes->ppu.frameOdd = !nes->ppu.frameOdd;
+    }
+}
+#endif // NES_PPU_SCANLINE
+
 /* Execute a PPU cycle */
-void ppu_tick() {
-    switch (scanline) {
-        case 0 ... 239:
-            ppu_tick_scanline(VISIBLE);
-            break;
-        case 240:
-            ppu_tick_scanline(POST);
-            break;
-        case 241:
-            ppu_tick_scanline(NMI);
-            break;
-        case 261:
-            ppu_tick_scanline(PRE);
-            break;
+void ppu_tick(nes_t* nes) {
+    if (nes->ppu.scanline < 240) {
+        ppu_tick_scanline(nes, VISIBLE);
+    } else if (nes->ppu.scanline == 240) {
+        ppu_tick_scanline(nes, POST);
+    } else if (nes->ppu.scanline == 241) {
+        ppu_tick_scanline(nes, NMI);
+    } else if (nes->ppu.scanline == 261) {
+        ppu_tick_scanline(nes, PRE);
     }
 
-    if (++dot > 340) {
-        dot %= 341;
-        if (++scanline > 261) {
-            scanline = 0;
-            frameOdd = (frameOdd & 0x01) ^ 1;
+    if (++nes->ppu.dot > 340) {
+        nes->ppu.dot %= 341;
+        if (++nes->ppu.scanline > 261) {
+            nes->ppu.scanline = 0;
+            nes->ppu.frameOdd = !nes->ppu.frameOdd;
         }
     }
 }
 
-void ppu_reset() {
-    frameOdd = 0x00;
-    scanline = dot = 0;
-    PPUCTRL.r = PPUMASK.r = PPUSTATUS.r = 0;
-    memset(GRAM, 0x00, NES_DISPLAY_WIDTH * NES_DISPLAY_HEIGHT);
-    memset(ciRam, 0xFF, sizeof(ciRam));
-    memset(oamMem, 0x00, sizeof(oamMem));
+/* Catch-up
+ * The PPU is not stepped along with the CPU. It runs 3 dots per CPU cycle up to the current cycle
+ * whenever one of its registers is accessed or one of its scheduled events is due, whole lines at
+ * once with the scanline renderer.
+ */
+void ppu_sync(nes_t* nes) {
+    u64 dots = (nes->cpu.cycle - nes->ppu.cycle) * 3;
+    nes->ppu.cycle = nes->cpu.cycle;
+#ifdef NES_PPU_SCANLINE
+    // Whole lines at once, dot 0 does nothing on any line
+    while (dots) {
+        u16 rest = 341 - nes->ppu.dot;
+        if (nes->ppu.dot <= 1 && dots >= rest) {
+            ppu_line(nes);
+            dots -= rest;
+        } else {
+            ppu_tick(nes);
+            dots--;
+        }
+    }
+#else
+    while (dots--) {
+        ppu_tick(nes);
+    }
+#endif
+}
+
+// CPU cycle by which the PPU has run the given dot of this frame, NES_EVENT_NEVER if it already has
+static u64 ppu_cycle_at(nes_t* nes, u16 line, u16 target) {
+    u32 next = nes->ppu.scanline * 341 + nes->ppu.dot;
+    u32 at = line * 341 + target;
+    if (at < next) return NES_EVENT_NEVER;
+    return nes->ppu.cycle + (at - next + 3) / 3;
+}
+
+// Like ppu_cycle_at, but wraps around to the next frame if the dot has already passed
+static u64 ppu_cycle_next(nes_t* nes, u16 line, u16 target) {
+    u64 cycle = ppu_cycle_at(nes, line, target);
+    if (cycle == NES_EVENT_NEVER) {
+        // Next frame, one dot shorter on odd frames while rendering
+        u32 dots = 262 * 341 - (nes->ppu.scanline * 341 + nes->ppu.dot) + line * 341 + target;
+        if (PPU_RENDERING && nes->ppu.frameOdd) dots--;
+        cycle = nes->ppu.cycle + (dots + 3) / 3;
+    }
+    return cycle;
+}
+
+// Predict the next vblank and sprite 0 line from the current position
+void ppu_schedule(nes_t* nes) {
+    scheduler_set(nes, NES_EVENT_PPU_VBLANK, ppu_cycle_next(nes, 241, 1));
+
+    // Sprite 0 cannot hit before the first line it covers
+    u64 sprite0 = NES_EVENT_NEVER;
+    if (nes->ppu.mask.bg && nes->ppu.mask.spr && nes->ppu.oamMem[0] < 239) {
+        sprite0 = ppu_cycle_at(nes, nes->ppu.oamMem[0] + 1, 1);
+    }
+    scheduler_set(nes, NES_EVENT_PPU_SPRITE0, sprite0);
+}
+
+// Dots the PPU has run since it was at the given dot, wrapping around to the previous frame
+static u32 ppu_dots_since(nes_t* nes, u16 line, u16 target) {
+    u32 now = nes->ppu.scanline * 341 + nes->ppu.dot;
+    u32 at = line * 341 + target;
+    return now >= at ? now - at : now + 262 * 341 - at;
+}
+
+// Earliest CPU cycle at which PPUSTATUS may read differently than it did at the given cycle,
+// other than through the read itself. Not after the current cycle if it already changed since.
+u64 ppu_status_change(nes_t* nes, u64 since) {
+    ppu_sync(nes);
+    // Sprite 0 hit and overflow may be set anywhere on a rendered line
+    bool rendered = PPU_RENDERING && !(nes->ppu.status.sprHit && nes->ppu.status.sprOvf);
+    if (rendered && nes->ppu.scanline < 240) return nes->ppu.cycle;
+
+    // One dot of slack for the dot skipped on odd frames
+    u32 back = (nes->ppu.cycle - since) * 3 + 1;
+    if (ppu_dots_since(nes, 241, 1) <= back || ppu_dots_since(nes, 261, 1) <= back) return since;
+    if (rendered && ppu_dots_since(nes, 240, 0) <= back) return since;
+
+    u64 vblank = ppu_cycle_next(nes, 241, 1);
+    u64 pre = ppu_cycle_next(nes, 261, 1);
+    u64 change = vblank < pre ? vblank : pre;
+    if (rendered) {
+        u64 visible = ppu_cycle_next(nes, 0, 0);
+        if (visible < change) change = visible;
+    }
+    return change;
+}
+
+void ppu_reset(nes_t* nes) {
+    // Powers on together with the CPU with everything cleared but the cartridge's mirroring
+    ppu_mirror_t mirroring = nes->ppu.mirroring;
+    memset(&nes->ppu, 0x00, sizeof(nes->ppu));
+    nes->ppu.mirroring = mirroring;
+    memset(nes->ppu.ciRam, 0xFF, sizeof(nes->ppu.ciRam));
+    ppu_schedule(nes);
 }
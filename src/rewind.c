@@ -0,0 +1,217 @@
+#include "rewind.h"
+
+#include "nes.h"
+#include "savestate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Rewind
+ * Every capture brings the last captured state up to date, copying only the memory written since
+ * then when dirty pages are tracked, and XORs it with the newest keyframe. Most of the state is
+ * unchanged from frame to frame, so the difference is mostly zeros. Captures are encoded as
+ * tokens of a 16-bit zero run length, a 16-bit literal length and the literal bytes. Keyframes are
+ * encoded the same way against an all-zero state. Runs of fewer than four zeros stay in the
+ * literal, so an encoding is never more than a few token headers larger than the state.
+ *
+ * Captures are stored back to back in a byte ring, wrapping to the start when the next one does not
+ * fit at the end. Room is made by dropping the oldest keyframe together with the captures relative
+ * to it, so the oldest capture is always a keyframe.
+ */
+
+#define RUN_MAX 0xFFFF
+#define RUN_MIN 4
+#define TOKEN_SIZE 4
+
+// Largest encoding of a state: a token per maximum run plus the first and last one
+static size_t encoded_bound(size_t size) {
+    return size + TOKEN_SIZE * (size / RUN_MAX + 2);
+}
+
+static inline u8 difference(u8 const* state, u8 const* reference, size_t i) {
+    return reference ? state[i] ^ reference[i] : state[i];
+}
+
+// Encodes state XOR reference, or the state itself without a reference, returns the bytes written
+static size_t encode(u8* out, u8 const* state, u8 const* reference, size_t size) {
+    u8* start = out;
+    size_t i = 0;
+    while (i < size) {
+        size_t skip = 0;
+        while (i + skip < size && skip < RUN_MAX && !difference(state, reference, i + skip)) {
+            skip++;
+        }
+        i += skip;
+
+        // Literal up to the next run worth skipping, its zeros are left to the next token
+        size_t length = 0;
+        size_t zeros = 0;
+        while (i + length < size && length < RUN_MAX) {
+            zeros = difference(state, reference, i + length) ? 0 : zeros + 1;
+            length++;
+            if (zeros == RUN_MIN) break;
+        }
+        length -= zeros;
+
+        out[0] = skip;
+        out[1] = skip >> 8;
+        out[2] = length;
+        out[3] = length >> 8;
+        out += TOKEN_SIZE;
+        for (size_t j = 0; j < length; j++) {
+            out[j] = difference(state, reference, i + j);
+        }
+        out += length;
+        i += length;
+    }
+    return out - start;
+}
+
+// Decodes an encoding into state, which holds its reference or zeros for a keyframe
+static void decode(u8* state, u8 const* in, size_t size) {
+    u8 const* end = in + size;
+    size_t i = 0;
+    while (in < end) {
+        i += in[0] | in[1] << 8;
+        size_t length = in[2] | in[3] << 8;
+        in += TOKEN_SIZE;
+        for (size_t j = 0; j < length; j++) {
+            state[i + j] ^= in[j];
+        }
+        in += length;
+        i += length;
+    }
+}
+
+static nes_rewind_entry_t* entry(nes_rewind_t* rw, size_t index) {
+    return &rw->entries[(rw->first + index) % (rw->frames + rw->interval)];
+}
+
+// Drops the oldest keyframe and the captures relative to it
+static void drop_oldest(nes_rewind_t* rw) {
+    do {
+        rw->used -= entry(rw, 0)->size;
+        rw->first = (rw->first + 1) % (rw->frames + rw->interval);
+        rw->count--;
+    } while (rw->count && entry(rw, 0)->distance);
+    if (!rw->count) {
+        rw->tail = 0;
+        rw->since_key = 0;
+    }
+}
+
+// Finds room for size bytes without touching held captures, returns false if there is none.
+// Captures never end right at the oldest one, so tail == oldest only when the ring is empty.
+static bool find_room(nes_rewind_t* rw, size_t size, size_t* offset) {
+    if (!rw->count) {
+        *offset = 0;
+        return size <= rw->capacity;
+    }
+    size_t oldest = entry(rw, 0)->offset;
+    if (rw->tail > oldest) {
+        if (rw->tail + size <= rw->capacity) {
+            *offset = rw->tail;
+            return true;
+        }
+        *offset = 0;
+        return size < oldest;
+    }
+    *offset = rw->tail;
+    return rw->tail + size < oldest;
+}
+
+// Allocates the buffers for a ring of capacity bytes keeping up to frames captures, with a keyframe
+// every interval captures. Returns false if memory is missing or a keyframe could not fit.
+bool nes_rewind_init(
+  nes_rewind_t* rw, nes_t const* nes, size_t capacity, u32 frames, u32 interval) {
+    memset(rw, 0, sizeof(nes_rewind_t));
+    rw->frames = frames;
+    rw->interval = interval ? interval : 1;
+    rw->capacity = capacity;
+    rw->state_size = nes_state_size(nes);
+    if (!frames || encoded_bound(rw->state_size) > capacity) return false;
+
+    rw->ring = malloc(capacity);
+    rw->entries = malloc((rw->frames + rw->interval) * sizeof(nes_rewind_entry_t));
+    rw->state = malloc(rw->state_size);
+    rw->keyframe = malloc(rw->state_size);
+    rw->encoded = malloc(encoded_bound(rw->state_size));
+    if (!rw->ring || !rw->entries || !rw->state || !rw->keyframe || !rw->encoded) {
+        nes_rewind_free(rw);
+        return false;
+    }
+    return true;
+}
+
+void nes_rewind_free(nes_rewind_t* rw) {
+    free(rw->ring);
+    free(rw->entries);
+    free(rw->state);
+    free(rw->keyframe);
+    free(rw->encoded);
+    memset(rw, 0, sizeof(nes_rewind_t));
+}
+
+// Captures the state of the console as the newest entry, dropping the oldest ones to make room.
+// Returns false if the state could not be saved.
+bool nes_rewind_capture(nes_rewind_t* rw, nes_t* nes) {
+    size_t saved = rw->current ? nes_state_update(nes, rw->state, rw->state_size)
+                               : nes_state_save(nes, rw->state, rw->state_size);
+    if (saved != rw->state_size) return false;
+    rw->current = true;
+
+    bool key = !rw->count || rw->since_key >= rw->interval;
+    size_t size = encode(rw->encoded, rw->state, key ? NULL : rw->keyframe, rw->state_size);
+    if (rw->count == rw->frames + rw->interval) drop_oldest(rw);
+    size_t offset;
+    while (!find_room(rw, size, &offset)) {
+        // Dropping the keyframe of this capture, it becomes the next keyframe itself
+        if (!key && rw->count == rw->since_key) {
+            key = true;
+            size = encode(rw->encoded, rw->state, NULL, rw->state_size);
+        }
+        drop_oldest(rw);
+    }
+
+    if (key) {
+        memcpy(rw->keyframe, rw->state, rw->state_size);
+        rw->since_key = 0;
+    }
+    memcpy(rw->ring + offset, rw->encoded, size);
+    *entry(rw, rw->count) = (nes_rewind_entry_t){ offset, size, rw->since_key };
+    rw->count++;
+    rw->since_key++;
+    rw->used += size;
+    rw->tail = offset + size;
+    return true;
+}
+
+// Loads the capture taken back captures before the newest one, 0 being the newest, and drops the
+// captures after it so that capturing continues from there. Returns false if there is no such
+// capture.
+bool nes_rewind_restore(nes_rewind_t* rw, nes_t* nes, size_t back) {
+    if (back >= rw->count) return false;
+    size_t index = rw->count - 1 - back;
+    nes_rewind_entry_t const* capture = entry(rw, index);
+    nes_rewind_entry_t const* key = entry(rw, index - capture->distance);
+
+    memset(rw->keyframe, 0, rw->state_size);
+    decode(rw->keyframe, rw->ring + key->offset, key->size);
+    memcpy(rw->state, rw->keyframe, rw->state_size);
+    if (capture->distance) decode(rw->state, rw->ring + capture->offset, capture->size);
+    if (!nes_state_load(nes, rw->state, rw->state_size)) {
+        // The keyframe buffer was overwritten, start the next capture from a new one
+        rw->since_key = rw->interval;
+        rw->current = false;
+        return false;
+    }
+
+    for (size_t i = index + 1; i < rw->count; i++) {
+        rw->used -= entry(rw, i)->size;
+    }
+    rw->count = index + 1;
+    rw->since_key = capture->distance + 1;
+    rw->tail = capture->offset + capture->size;
+    rw->current = true;
+    return true;
+}
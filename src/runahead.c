@@ -0,0 +1,65 @@
+#include "runahead.h"
+
+#include "clock.h"
+#include "nes.h"
+#include "savestate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Run-ahead
+ * A game reacts to input a frame or more after it is read, so the input is also run through the
+ * frames that follow before the frame is shown. The frames run ahead are thrown away by loading the
+ * state saved after the frame, the machine only advances one frame per call. The frame buffer is
+ * output only and is not part of a state, so it keeps the last frame run ahead.
+ *
+ * The controllers keep the buttons set before the frame, the frames run ahead assume they are
+ * still held. Only the last frame run ahead is drawn, the others are skipped.
+ */
+
+// Allocates the state buffer for running the given number of frames ahead, returns false if memory
+// is missing
+bool nes_runahead_init(nes_runahead_t* ra, nes_t const* nes, u32 frames) {
+    memset(ra, 0, sizeof(nes_runahead_t));
+    ra->frames = frames;
+    ra->state_size = nes_state_size(nes);
+    ra->state = malloc(ra->state_size);
+    return ra->state != NULL;
+}
+
+void nes_runahead_free(nes_runahead_t* ra) {
+    free(ra->state);
+    memset(ra, 0, sizeof(nes_runahead_t));
+}
+
+// Runs one frame of the machine, leaving the frame buffer with the frame ra->frames later. Returns
+// false if the state could not be saved or loaded, the machine is then left ahead.
+bool nes_runahead_frame(nes_runahead_t* ra, nes_t* nes) {
+    double start = clock_now();
+    if (ra->frames) {
+        nes_skip_frame(nes);
+    } else {
+        nes_run_frame(nes);
+    }
+    double ahead = clock_now();
+    bool ok = true;
+    if (ra->frames) {
+        ok = nes_state_save(nes, ra->state, ra->state_size) == ra->state_size;
+        for (u32 i = 0; ok && i < ra->frames; i++) {
+            if (i + 1 < ra->frames) {
+                nes_skip_frame(nes);
+            } else {
+                nes_run_frame(nes);
+            }
+        }
+        ok = ok && nes_state_load(nes, ra->state, ra->state_size);
+    }
+    double end = clock_now();
+
+    ra->frame_seconds = end - start;
+    ra->ahead_seconds = end - ahead;
+    ra->total_seconds += ra->frame_seconds;
+    ra->total_ahead += ra->ahead_seconds;
+    ra->count++;
+    return ok;
+}
@@ -0,0 +1,380 @@
+#include "savestate.h"
+
+#include "cartridge.h"
+#include "cpu.h"
+#include "memory.h"
+#include "nes.h"
+#include "ppu.h"
+#include "scheduler.h"
+
+#include <string.h>
+
+/* Savestates
+ * A state is a flat little-endian record of everything that decides how the machine continues:
+ * CPU, RAM, PPU, controllers, pending events, mapper registers, PRG-RAM and CHR-RAM. It holds no
+ * host pointers, banks are offsets into the cartridge, so a state loads into any console running
+ * the same cartridge, in any build. The status register is stored whole, whatever the flag mode.
+ *
+ * The frame buffer is output only and is left out, it is complete again after the next frame.
+ * Host caches (decoded blocks, translations) only depend on the ROM and stay valid.
+ *
+ * With dirty page tracking, a buffer holding an earlier state of the console can be updated in
+ * place, copying only the blocks of RAM, nametables, PRG-RAM and CHR-RAM written since then.
+ *
+ * Layout:
+ * [header][mapper][cpu][ram][ppu][controller][scheduler][prg ram][chr ram]
+ */
+
+#define STATE_MAGIC "NESS"
+
+// Events saved with the state, the run budget belongs to the caller of nes_run_cycles
+#define STATE_EVENTS NES_EVENT_RUN_END
+// The vblank event catches the PPU up once a frame, plus the instruction and interrupt past it
+#define STATE_PPU_LAG (262 * 341 / 3 + 16)
+
+enum {
+    STATE_HEADER_SIZE = 16,
+    STATE_MAPPER_SIZE = 4 * 4 + 8 * 4 + 1,
+    STATE_CPU_SIZE = 25,
+    STATE_PPU_SIZE = 47 + 0x800 + 0x20 + 0x100 + 2 * 8 * 7,
+    STATE_CONTROLLER_SIZE = 5,
+    STATE_SCHEDULER_SIZE = STATE_EVENTS * 8,
+    STATE_FIXED_SIZE = STATE_HEADER_SIZE + STATE_MAPPER_SIZE + STATE_CPU_SIZE + NES_RAM_SIZE +
+                       STATE_PPU_SIZE + STATE_CONTROLLER_SIZE + STATE_SCHEDULER_SIZE,
+};
+
+static inline void put8(u8** p, u8 v) {
+    *(*p)++ = v;
+}
+
+static inline void put16(u8** p, u16 v) {
+    put8(p, v);
+    put8(p, v >> 8);
+}
+
+static inline void put32(u8** p, u32 v) {
+    put16(p, v);
+    put16(p, v >> 16);
+}
+
+static inline void put64(u8** p, u64 v) {
+    put32(p, v);
+    put32(p, v >> 32);
+}
+
+// Sections of size 0 may have no memory behind them
+static inline void put_bytes(u8** p, void const* data, size_t size) {
+    if (size) memcpy(*p, data, size);
+    *p += size;
+}
+
+static inline u8 get8(u8 const** p) {
+    return *(*p)++;
+}
+
+static inline u16 get16(u8 const** p) {
+    u16 v = get8(p);
+    return v | get8(p) << 8;
+}
+
+static inline u32 get32(u8 const** p) {
+    u32 v = get16(p);
+    return v | (u32)get16(p) << 16;
+}
+
+static inline u64 get64(u8 const** p) {
+    u64 v = get32(p);
+    return v | (u64)get32(p) << 32;
+}
+
+static inline void get_bytes(u8 const** p, void* data, size_t size) {
+    if (size) memcpy(data, *p, size);
+    *p += size;
+}
+
+static size_t prg_ram_size(nes_t const* nes) {
+    return nes->cartridge.config.has_prg_ram
+             ? (size_t)nes->cartridge.config.prg_ram_size * NES_PRG_RAM_UNIT_SIZE
+             : 0;
+}
+
+static size_t chr_ram_size(nes_t const* nes) {
+    return nes->cartridge.config.has_chr_ram ? NES_CHR_DATA_UNIT_SIZE : 0;
+}
+
+// Saves a tracked memory, the first bytes of which are covered by dirty flags. An update only
+// copies the blocks written since the last one and clears their flags.
+static void put_memory(
+  u8** p, nes_t* nes, u8 const* data, size_t size, u16 first, size_t tracked, bool update) {
+#ifdef NES_DIRTY_PAGES
+    if (update && tracked) {
+        u8* flags = nes->dirty.map + first;
+        for (size_t i = 0; i < tracked >> NES_DIRTY_BLOCK_SHIFT; i++) {
+            if (!flags[i]) continue;
+            flags[i] = 0;
+            size_t offset = i * NES_DIRTY_BLOCK_SIZE;
+            memcpy(*p + offset, data + offset, NES_DIRTY_BLOCK_SIZE);
+        }
+        *p += tracked;
+        data += tracked;
+        size -= tracked;
+    }
+#else
+    (void)nes;
+    (void)first;
+    (void)tracked;
+    (void)update;
+#endif
+    put_bytes(p, data, size);
+}
+
+// Identifies the cartridge layout, states only load into consoles with the same one
+static void put_header(u8** p, nes_t const* nes, size_t size) {
+    put_bytes(p, STATE_MAGIC, 4);
+    put16(p, NES_STATE_VERSION);
+    put8(p, nes->cartridge.config.mapper);
+    put8(p, nes->cartridge.config.prg_size);
+    put8(p, nes->cartridge.config.chr_size);
+    put8(p, nes->cartridge.config.has_prg_ram ? nes->cartridge.config.prg_ram_size : 0);
+    put8(p, nes->cartridge.config.has_chr_ram);
+    put8(p, 0);
+    put32(p, size);
+}
+
+static void put_sprites(u8** p, ppu_sprite_t const* sprites) {
+    for (int i = 0; i < 8; i++) {
+        put8(p, sprites[i].id);
+        put8(p, sprites[i].x);
+        put8(p, sprites[i].y);
+        put8(p, sprites[i].tile);
+        put8(p, sprites[i].attr);
+        put8(p, sprites[i].dataL);
+        put8(p, sprites[i].dataH);
+    }
+}
+
+static void get_sprites(u8 const** p, ppu_sprite_t* sprites) {
+    for (int i = 0; i < 8; i++) {
+        sprites[i].id = get8(p);
+        sprites[i].x = get8(p);
+        sprites[i].y = get8(p);
+        sprites[i].tile = get8(p);
+        sprites[i].attr = get8(p);
+        sprites[i].dataL = get8(p);
+        sprites[i].dataH = get8(p);
+        ppu_decode_sprite(&sprites[i]);
+    }
+}
+
+// Bytes needed to save the state of a console
+size_t nes_state_size(nes_t const* nes) {
+    return STATE_FIXED_SIZE + prg_ram_size(nes) + chr_ram_size(nes);
+}
+
+static size_t save(nes_t* nes, void* buffer, size_t size, bool update) {
+    size_t state_size = nes_state_size(nes);
+    if (size < state_size) return 0;
+    u8* p = buffer;
+
+    put_header(&p, nes, state_size);
+
+    for (int i = 0; i < 4; i++) {
+        put32(&p, nes->cartridge.prg_map[i]);
+    }
+    for (int i = 0; i < 8; i++) {
+        put32(&p, nes->cartridge.chr_map[i]);
+    }
+    put8(&p, nes->ppu.mirroring);
+
+    put16(&p, nes->cpu.pc);
+    put8(&p, nes->cpu.s);
+    put8(&p, nes->cpu.a);
+    put8(&p, nes->cpu.x);
+    put8(&p, nes->cpu.y);
+    put8(&p, cpu_status(nes));
+    put8(&p, nes->cpu.nmi);
+    put8(&p, nes->cpu.irq);
+    put64(&p, nes->cpu.cycle);
+    put64(&p, nes->cpu.instructions);
+
+    put_memory(&p, nes, nes->memory.ram, NES_RAM_SIZE, NES_DIRTY_RAM, NES_RAM_SIZE, update);
+
+    put8(&p, nes->ppu.ctrl.r);
+    put8(&p, nes->ppu.mask.r);
+    put8(&p, nes->ppu.status.r);
+    put16(&p, nes->ppu.vAddr.r);
+    put16(&p, nes->ppu.tAddr.r);
+    put8(&p, nes->ppu.fX);
+    put8(&p, nes->ppu.w);
+    put8(&p, nes->ppu.bus);
+    put8(&p, nes->ppu.buffer);
+    put_memory(&p, nes, nes->ppu.ciRam, NES_VRAM_SIZE, NES_DIRTY_VRAM, NES_VRAM_SIZE, update);
+    put_bytes(&p, nes->ppu.cgRam, sizeof(nes->ppu.cgRam));
+    put_bytes(&p, nes->ppu.oamMem, sizeof(nes->ppu.oamMem));
+    put_sprites(&p, nes->ppu.oam);
+    put_sprites(&p, nes->ppu.secOam);
+    put8(&p, nes->ppu.oamAddr);
+    put16(&p, nes->ppu.addr);
+    put8(&p, nes->ppu.nt);
+    put8(&p, nes->ppu.at);
+    put8(&p, nes->ppu.bgL);
+    put8(&p, nes->ppu.bgH);
+    put8(&p, nes->ppu.atShiftL);
+    put8(&p, nes->ppu.atShiftH);
+    put16(&p, nes->ppu.bgShiftL);
+    put16(&p, nes->ppu.bgShiftH);
+    put8(&p, nes->ppu.atLatchL);
+    put8(&p, nes->ppu.atLatchH);
+    put8(&p, nes->ppu.frameOdd);
+    put16(&p, nes->ppu.scanline);
+    put16(&p, nes->ppu.dot);
+    put64(&p, nes->ppu.cycle);
+    put64(&p, nes->ppu.frame);
+
+    put8(&p, nes->controller.buttons[0]);
+    put8(&p, nes->controller.buttons[1]);
+    put8(&p, nes->controller.shift[0]);
+    put8(&p, nes->controller.shift[1]);
+    put8(&p, nes->controller.strobe);
+
+    for (int i = 0; i < STATE_EVENTS; i++) {
+        put64(&p, nes->scheduler.at[i]);
+    }
+
+    // Only the first PRG-RAM unit is addressable and tracked
+    size_t prg_ram = prg_ram_size(nes);
+    size_t prg_ram_tracked = prg_ram < NES_PRG_RAM_UNIT_SIZE ? prg_ram : NES_PRG_RAM_UNIT_SIZE;
+    put_memory(
+      &p, nes, nes->cartridge.prg_ram, prg_ram, NES_DIRTY_PRG_RAM, prg_ram_tracked, update);
+    size_t chr_ram = chr_ram_size(nes);
+    put_memory(&p, nes, nes->cartridge.chr, chr_ram, NES_DIRTY_CHR_RAM, chr_ram, update);
+    return state_size;
+}
+
+// Saves the state of a console into a buffer, returns the bytes written or 0 if the buffer is too
+// small
+size_t nes_state_save(nes_t* nes, void* buffer, size_t size) {
+    return save(nes, buffer, size, false);
+}
+
+// Brings a state saved from the console up to date, copying only the memory written since the
+// last update when dirty pages are tracked. Every memory written since the buffer was last saved
+// or updated must still be flagged, so only one buffer per console can be kept up to date this
+// way. Returns the size of the state or 0 if the buffer is too small.
+size_t nes_state_update(nes_t* nes, void* buffer, size_t size) {
+    return save(nes, buffer, size, true);
+}
+
+// Loads a state saved from a console running the same cartridge. Returns false and leaves the
+// console untouched if the state is from another version, another cartridge or is damaged.
+bool nes_state_load(nes_t* nes, void const* buffer, size_t size) {
+    size_t state_size = nes_state_size(nes);
+    if (size < state_size) return false;
+    u8 header[STATE_HEADER_SIZE];
+    u8* h = header;
+    put_header(&h, nes, state_size);
+    if (memcmp(buffer, header, STATE_HEADER_SIZE)) return false;
+    u8 const* p = (u8 const*)buffer + STATE_HEADER_SIZE;
+
+    // Banks are used as offsets without further checks, reject any outside the cartridge
+    u32 prg_last = nes->cartridge.config.prg_size * NES_PRG_DATA_UNIT_SIZE - NES_PRG_SLOT_SIZE;
+    u32 chr_last = nes->cartridge.config.chr_size * NES_CHR_DATA_UNIT_SIZE - NES_CHR_SLOT_SIZE;
+    u32 prg_map[4];
+    u32 chr_map[8];
+    for (int i = 0; i < 4; i++) {
+        prg_map[i] = get32(&p);
+        if (prg_map[i] > prg_last) return false;
+    }
+    for (int i = 0; i < 8; i++) {
+        chr_map[i] = get32(&p);
+        if (chr_map[i] > chr_last) return false;
+    }
+    u8 mirroring = get8(&p);
+    if (mirroring != HORIZONTAL && mirroring != VERTICAL) return false;
+    // The PPU catches up from its cycle to the CPU's, reject one off the frame, ahead of the CPU or
+    // more than a frame behind it
+    u8 const* timing = p + STATE_CPU_SIZE - 16;
+    u64 cpu_cycle = get64(&timing);
+    timing = p + STATE_CPU_SIZE + NES_RAM_SIZE + STATE_PPU_SIZE - 20;
+    u16 scanline = get16(&timing);
+    u16 dot = get16(&timing);
+    u64 ppu_cycle = get64(&timing);
+    if (ppu_cycle > cpu_cycle || cpu_cycle - ppu_cycle > STATE_PPU_LAG) return false;
+    if (scanline > 261 || dot > 340) return false;
+    // Memory shared with a fork is copied before it is overwritten
+    if (!cartridge_own(nes)) return false;
+    memcpy(nes->cartridge.prg_map, prg_map, sizeof(prg_map));
+    memcpy(nes->cartridge.chr_map, chr_map, sizeof(chr_map));
+    nes->ppu.mirroring = mirroring;
+
+    nes->cpu.pc = get16(&p);
+    nes->cpu.s = get8(&p);
+    nes->cpu.a = get8(&p);
+    nes->cpu.x = get8(&p);
+    nes->cpu.y = get8(&p);
+    cpu_set_status(nes, get8(&p));
+    nes->cpu.nmi = get8(&p);
+    nes->cpu.irq = get8(&p);
+    nes->cpu.cycle = get64(&p);
+    nes->cpu.instructions = get64(&p);
+
+    get_bytes(&p, nes->memory.ram, NES_RAM_SIZE);
+
+    nes->ppu.ctrl.r = get8(&p);
+    nes->ppu.mask.r = get8(&p);
+    nes->ppu.status.r = get8(&p);
+    nes->ppu.vAddr.r = get16(&p);
+    nes->ppu.tAddr.r = get16(&p);
+    nes->ppu.fX = get8(&p);
+    nes->ppu.w = get8(&p);
+    nes->ppu.bus = get8(&p);
+    nes->ppu.buffer = get8(&p);
+    get_bytes(&p, nes->ppu.ciRam, sizeof(nes->ppu.ciRam));
+    get_bytes(&p, nes->ppu.cgRam, sizeof(nes->ppu.cgRam));
+    get_bytes(&p, nes->ppu.oamMem, sizeof(nes->ppu.oamMem));
+    nes->ppu.linesFound = false;
+    get_sprites(&p, nes->ppu.oam);
+    get_sprites(&p, nes->ppu.secOam);
+    nes->ppu.oamAddr = get8(&p);
+    nes->ppu.addr = get16(&p);
+    nes->ppu.nt = get8(&p);
+    nes->ppu.at = get8(&p);
+    nes->ppu.bgL = get8(&p);
+    nes->ppu.bgH = get8(&p);
+    nes->ppu.atShiftL = get8(&p);
+    nes->ppu.atShiftH = get8(&p);
+    nes->ppu.bgShiftL = get16(&p);
+    nes->ppu.bgShiftH = get16(&p);
+    nes->ppu.atLatchL = get8(&p);
+    nes->ppu.atLatchH = get8(&p);
+    nes->ppu.frameOdd = get8(&p);
+    nes->ppu.scanline = get16(&p);
+    nes->ppu.dot = get16(&p);
+    nes->ppu.cycle = get64(&p);
+    nes->ppu.frame = get64(&p);
+
+    nes->controller.buttons[0] = get8(&p);
+    nes->controller.buttons[1] = get8(&p);
+    nes->controller.shift[0] = get8(&p);
+    nes->controller.shift[1] = get8(&p);
+    nes->controller.strobe = get8(&p);
+
+    for (int i = 0; i < STATE_EVENTS; i++) {
+        nes->scheduler.at[i] = get64(&p);
+    }
+    // The PPU's events follow from its loaded position and are predicted again instead of trusted.
+    // This recomputes the earliest event, keeping the budget of a running nes_run_cycles.
+    ppu_schedule(nes);
+
+    get_bytes(&p, nes->cartridge.prg_ram, prg_ram_size(nes));
+    if (nes->cartridge.config.has_chr_ram) cartridge_chr_load(nes, p);
+
+    memory_map_prg(nes);
+    memory_dirty_all(nes);
+#ifdef NES_CPU_BLOCK_CACHE
+    // The block being executed belongs to the previous state
+    nes->cache.block = NULL;
+    nes->cache.uop = NULL;
+#endif
+    return true;
+}
@@ -0,0 +1,70 @@
+#include "scheduler.h"
+
+#include "cpu.h"
+#include "nes.h"
+#include "ppu.h"
+
+/* Event scheduler
+ * The CPU runs freely until the earliest pending event instead of stepping every device on each
+ * bus cycle. Devices keep the cycle they have caught up to and run the missing time lazily, either
+ * when their event is due or when the CPU accesses one of their registers. Devices reschedule
+ * their events whenever a register write changes when they happen.
+ */
+
+// Bring the PPU up to date, it sets the vblank flag and NMI itself, then predict its next events
+static void event_ppu(nes_t* nes) {
+    ppu_sync(nes);
+    ppu_schedule(nes);
+}
+
+// One-shot IRQ sources, the device reschedules the event when it rearms its counter
+static void event_irq(nes_t* nes) {
+    cpu_set_irq(nes, true);
+}
+
+// Only bounds how far the CPU runs ahead, the caller stops once it is reached
+static void event_run_end(nes_t* nes) {
+    (void)nes;
+}
+
+static void (*const handlers[NES_EVENT_COUNT])(nes_t* nes) = {
+    [NES_EVENT_PPU_VBLANK] = event_ppu,
+    [NES_EVENT_PPU_SPRITE0] = event_ppu,
+    [NES_EVENT_MAPPER_IRQ] = event_irq,
+    [NES_EVENT_APU_FRAME] = event_irq,
+    [NES_EVENT_RUN_END] = event_run_end,
+};
+
+static void update_next(nes_t* nes) {
+    nes->scheduler.next = NES_EVENT_NEVER;
+    for (int i = 0; i < NES_EVENT_COUNT; i++) {
+        if (nes->scheduler.at[i] < nes->scheduler.next) {
+            nes->scheduler.next = nes->scheduler.at[i];
+        }
+    }
+}
+
+void scheduler_init(nes_t* nes) {
+    for (int i = 0; i < NES_EVENT_COUNT; i++) {
+        nes->scheduler.at[i] = NES_EVENT_NEVER;
+    }
+    nes->scheduler.next = NES_EVENT_NEVER;
+}
+
+void scheduler_set(nes_t* nes, nes_event_t event, u64 cycle) {
+    nes->scheduler.at[event] = cycle;
+    update_next(nes);
+}
+
+// Handle every event that is due at the current cycle
+void scheduler_run(nes_t* nes) {
+    while (nes->scheduler.next <= nes->cpu.cycle) {
+        for (int i = 0; i < NES_EVENT_COUNT; i++) {
+            if (nes->scheduler.at[i] <= nes->cpu.cycle) {
+                nes->scheduler.at[i] = NES_EVENT_NEVER;
+                handlers[i](nes);
+            }
+        }
+        update_next(nes);
+    }
+}
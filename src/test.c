@@ -1,6 +1,16 @@
 #include "cartridge.h"
+#include "controller.h"
+#include "cpu.h"
+#ifdef NES_CPU_JIT
+#include "jit.h"
+#endif
 #include "log.h"
 #include "nes.h"
+#include "netplay.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "savestate.h"
+#include "scheduler.h"
 
 #include <assert.h>
 #include <stdbool.h>
@@ -16,7 +26,7 @@ static void parse_cpu_state(nes_t* nes, char* s, int len) {
       nes->cpu.a,
       nes->cpu.x,
       nes->cpu.y,
-      nes->cpu.p,
+      cpu_status(nes),
       nes->cpu.s,
       nes->cpu.cycle);
 }
@@ -48,24 +58,502 @@ static bool test_cpu(void) {
     // nestest should start at 0xC000 instead of 0xC004 for emulators with no GUI
     nes.cpu.pc &= ~0x0F;
 
+#ifdef NES_CPU_JIT
+    // Translated blocks run several instructions in one step, so the trace is checked against an
+    // interpreted console. The translated one must match it wherever both stop at the same cycle.
+    nes_t ref;
+    if (!nes_init(&ref, "test/nestest.nes")) {
+        LOG("CPU TEST FAILURE\nVerification files not found.\n");
+        return false;
+    }
+    jit_free(&ref);
+    ref.cpu.pc &= ~0x0F;
+    nes_t* trace = &ref;
+    char jit_state[100];
+#else
+    nes_t* trace = &nes;
+#endif
+
     char cpu_state[100];
     char line[100];
 
     // Run test
     while (fgets(line, sizeof(line), test)) {
-        parse_cpu_state(&nes, cpu_state, sizeof(cpu_state));
+        parse_cpu_state(trace, cpu_state, sizeof(cpu_state));
         parse_verification_state(line);
         if (strcmp(cpu_state, line)) {
             LOG("CPU TEST FAILURE\nExpected %s\nGot      %s\n", line, cpu_state);
             return false;
         }
-        nes_step(&nes);
+        nes_step(trace);
+#ifdef NES_CPU_JIT
+        while (nes.cpu.cycle < ref.cpu.cycle) nes_step(&nes);
+        if (nes.cpu.cycle != ref.cpu.cycle) continue;
+        parse_cpu_state(&ref, cpu_state, sizeof(cpu_state));
+        parse_cpu_state(&nes, jit_state, sizeof(jit_state));
+        if (strcmp(cpu_state, jit_state) || memcmp(nes.memory.ram, ref.memory.ram, NES_RAM_SIZE)) {
+            LOG("CPU TEST FAILURE\nExpected %s\nGot      %s (JIT)\n", cpu_state, jit_state);
+            return false;
+        }
+#endif
+    }
+    if (!feof(test)) {
+        LOG("CPU TEST FAILURE\nVerification file could not be read.\n");
+        return false;
     }
 
+#ifdef NES_CPU_JIT
+    nes_free(&ref);
+#endif
+    nes_free(&nes);
+    fclose(test);
     LOG("CPU TEST SUCCESS\n");
     return true;
 }
 
+// A state loaded into another console continues exactly like the console it was saved from
+static bool test_savestate(void) {
+    static nes_t nes, copy;
+    static u8 state[0x10000];
+    if (!nes_init(&nes, "test/nestest.nes") || !nes_init(&copy, "test/nestest.nes")) {
+        LOG("SAVESTATE TEST FAILURE\nTest ROM not found.\n");
+        return false;
+    }
+    for (int i = 0; i < 30; i++) {
+        nes_run_frame(&nes);
+    }
+
+    size_t size = nes_state_save(&nes, state, sizeof(state));
+    if (!size || size != nes_state_size(&nes)) {
+        LOG("SAVESTATE TEST FAILURE\nSave failed.\n");
+        return false;
+    }
+    if (nes_state_load(&copy, state, size - 1) || !nes_state_load(&copy, state, size)) {
+        LOG("SAVESTATE TEST FAILURE\nLoad failed.\n");
+        return false;
+    }
+    // The frame buffer is not part of the state, it is complete again after one frame
+    for (int i = 0; i < 30; i++) {
+        nes_run_frame(&nes);
+        nes_run_frame(&copy);
+        if (
+          nes.cpu.cycle != copy.cpu.cycle || nes.cpu.pc != copy.cpu.pc ||
+          memcmp(nes.memory.ram, copy.memory.ram, NES_RAM_SIZE) ||
+          memcmp(nes.ppu.GRAM, copy.ppu.GRAM, sizeof(nes.ppu.GRAM))) {
+            LOG("SAVESTATE TEST FAILURE\nConsoles differ %d frames after loading.\n", i + 1);
+            return false;
+        }
+    }
+
+    // Updating a saved state in place gives the same state as saving it again
+    static u8 full[0x10000];
+    for (int i = 0; i < 3; i++) {
+        nes_run_frame(&nes);
+        if (
+          nes_state_update(&nes, state, sizeof(state)) != size ||
+          nes_state_save(&nes, full, sizeof(full)) != size || memcmp(state, full, size)) {
+            LOG("SAVESTATE TEST FAILURE\nUpdated state differs.\n");
+            return false;
+        }
+    }
+
+    // Damaged timing is rejected and leaves the console untouched
+    static u8 damaged[0x10000];
+    for (int i = 0; i < 4; i++) {
+        nes_state_load(&copy, state, size);
+        if (i == 0) copy.ppu.cycle = copy.cpu.cycle + 1;
+        if (i == 1) copy.ppu.scanline = 262;
+        if (i == 2) copy.ppu.dot = 341;
+        if (i == 3) copy.ppu.cycle = copy.cpu.cycle - 2 * 29781;
+        nes_state_save(&copy, damaged, sizeof(damaged));
+        if (
+          nes_state_load(&nes, damaged, size) || nes_state_save(&nes, full, sizeof(full)) != size ||
+          memcmp(state, full, size)) {
+            LOG("SAVESTATE TEST FAILURE\nDamaged state %d loaded.\n", i);
+            return false;
+        }
+    }
+
+    // Saved event times are predicted again, a lost vblank event still ends the frame
+    nes_state_load(&copy, state, size);
+    scheduler_set(&copy, NES_EVENT_PPU_VBLANK, NES_EVENT_NEVER);
+    nes_state_save(&copy, damaged, sizeof(damaged));
+    if (
+      !nes_state_load(&copy, damaged, size) ||
+      memcmp(copy.scheduler.at, nes.scheduler.at, sizeof(nes.scheduler.at))) {
+        LOG("SAVESTATE TEST FAILURE\nEvent times loaded from the state.\n");
+        return false;
+    }
+
+    // A load made during nes_run_cycles keeps its budget
+    u64 end = nes.cpu.cycle + 100;
+    scheduler_set(&copy, NES_EVENT_RUN_END, end);
+    if (
+      !nes_state_load(&copy, state, size) || copy.scheduler.at[NES_EVENT_RUN_END] != end ||
+      copy.scheduler.next > end) {
+        LOG("SAVESTATE TEST FAILURE\nRun budget lost.\n");
+        return false;
+    }
+
+    nes_free(&nes);
+    nes_free(&copy);
+    LOG("SAVESTATE TEST SUCCESS\n");
+    return true;
+}
+
+// Restored captures match the frames they were taken at, also after the ring has wrapped
+static bool test_rewind(void) {
+    static nes_t nes;
+    static u64 cycle[200];
+    nes_rewind_t rw;
+    if (!nes_init(&nes, "test/nestest.nes") || !nes_rewind_init(&rw, &nes, 0x8000, 100, 8)) {
+        LOG("REWIND TEST FAILURE\nSetup failed.\n");
+        return false;
+    }
+    for (int i = 0; i < 200; i++) {
+        nes_run_frame(&nes);
+        cycle[i] = nes.cpu.cycle;
+        if (!nes_rewind_capture(&rw, &nes)) {
+            LOG("REWIND TEST FAILURE\nCapture failed.\n");
+            return false;
+        }
+    }
+
+    // Steps back 5 frames at a time, then captures again from the oldest frame left
+    int frame = 199;
+    while (nes_rewind_restore(&rw, &nes, 5)) {
+        frame -= 5;
+        if (nes.cpu.cycle != cycle[frame]) {
+            LOG("REWIND TEST FAILURE\nFrame %d restored at cycle %lu.\n", frame, nes.cpu.cycle);
+            return false;
+        }
+    }
+    nes_run_frame(&nes);
+    if (!nes_rewind_capture(&rw, &nes) || !nes_rewind_restore(&rw, &nes, 1) ||
+        nes.cpu.cycle != cycle[frame]) {
+        LOG("REWIND TEST FAILURE\nCapturing after a restore failed.\n");
+        return false;
+    }
+
+    nes_rewind_free(&rw);
+    nes_free(&nes);
+    LOG("REWIND TEST SUCCESS\n");
+    return true;
+}
+
+static u64 frame_hash(nes_t const* nes) {
+    u64 h = 0xCBF29CE484222325;
+    for (size_t i = 0; i < sizeof(nes->ppu.GRAM); i++) {
+        h = (h ^ nes->ppu.GRAM[i]) * 0x100000001B3;
+    }
+    return h;
+}
+
+// Frames of the test menu and the test results match those of the dot-accurate renderer
+static bool test_frames(void) {
+    static nes_t nes;
+    // The menu, the results of the first page of tests, the second page and its results
+    static u8 const press[] = { 0, CONTROLLER_START, CONTROLLER_SELECT, CONTROLLER_START };
+    static u64 const expected[] = {
+        0x6ED6DE9C21AFEFC8,
+        0x2A71E2E5B5DBFF48,
+        0xFDBC8DEA46347D13,
+        0x1B8E5462595BC3DE,
+    };
+    if (!nes_init(&nes, "test/nestest.nes")) {
+        LOG("FRAME TEST FAILURE\nTest ROM not found.\n");
+        return false;
+    }
+    for (int i = 0; i < 4; i++) {
+        for (int frame = 0; frame < 60; frame++) {
+            controller_set(&nes, 0, frame < 2 ? press[i] : 0);
+            nes_run_frame(&nes);
+        }
+        if (frame_hash(&nes) != expected[i]) {
+            LOG("FRAME TEST FAILURE\nFrame %d differs.\n", (i + 1) * 60);
+            return false;
+        }
+    }
+    nes_free(&nes);
+    LOG("FRAME TEST SUCCESS\n");
+    return true;
+}
+
+// Frames run with idle loop skipping match a console that never skips, instruction for instruction
+static bool test_idle(void) {
+    static nes_t nes, ref;
+    if (!nes_init(&nes, "test/nestest.nes") || !nes_init(&ref, "test/nestest.nes")) {
+        LOG("IDLE TEST FAILURE\nTest ROM not found.\n");
+        return false;
+    }
+    for (int i = 0; i < 240; i++) {
+        u8 buttons = i / 8 % 2 ? CONTROLLER_START : 0;
+        controller_set(&nes, 0, buttons);
+        controller_set(&ref, 0, buttons);
+        nes_run_frame(&nes);
+        // A budget of one cycle runs single instructions, idle loops are never skipped
+        while (ref.ppu.frame == nes.ppu.frame - 1) {
+            nes_run_cycles(&ref, 1);
+        }
+        bool same = nes.cpu.cycle == ref.cpu.cycle &&
+                    nes.cpu.instructions == ref.cpu.instructions &&
+                    !memcmp(nes.memory.ram, ref.memory.ram, NES_RAM_SIZE) &&
+                    frame_hash(&nes) == frame_hash(&ref);
+        if (!same) {
+            LOG("IDLE TEST FAILURE\nFrame %d differs.\n", i);
+            return false;
+        }
+    }
+    nes_free(&nes);
+    nes_free(&ref);
+    LOG("IDLE TEST SUCCESS\n");
+    return true;
+}
+
+// Skipped frames run like drawn ones and leave the frame buffer alone
+static bool test_skip(void) {
+    static nes_t nes, skip;
+    static u8 gram[sizeof(nes.ppu.GRAM)];
+    if (!nes_init(&nes, "test/nestest.nes") || !nes_init(&skip, "test/nestest.nes")) {
+        LOG("SKIP TEST FAILURE\nTest ROM not found.\n");
+        return false;
+    }
+    for (int frame = 0; frame < 240; frame++) {
+        u8 buttons = frame % 60 < 2 && frame >= 60 ? CONTROLLER_START : 0;
+        controller_set(&nes, 0, buttons);
+        controller_set(&skip, 0, buttons);
+        nes_run_frame(&nes);
+        bool drawn = frame % 4 == 3;
+        memcpy(gram, skip.ppu.GRAM, sizeof(gram));
+        if (drawn) {
+            nes_run_frame(&skip);
+        } else {
+            nes_skip_frame(&skip);
+        }
+        if (
+          nes.cpu.cycle != skip.cpu.cycle || nes.ppu.status.r != skip.ppu.status.r ||
+          memcmp(nes.memory.ram, skip.memory.ram, NES_RAM_SIZE) ||
+          memcmp(drawn ? nes.ppu.GRAM : gram, skip.ppu.GRAM, sizeof(gram))) {
+            LOG("SKIP TEST FAILURE\nConsoles differ at frame %d.\n", frame + 1);
+            return false;
+        }
+    }
+    nes_free(&nes);
+    nes_free(&skip);
+    LOG("SKIP TEST SUCCESS\n");
+    return true;
+}
+
+// Decoded tile rows hold the pixels of the pattern tables, flipped or not
+static bool test_tiles(void) {
+    static nes_t nes;
+    if (!nes_init(&nes, "test/nestest.nes")) {
+        LOG("TILE TEST FAILURE\nTest ROM not found.\n");
+        return false;
+    }
+    for (u16 addr = 0; addr < 0x2000; addr++) {
+        if (addr & 8) continue;
+        u8 low = cartridge_chr_rd(&nes, addr);
+        u8 high = cartridge_chr_rd(&nes, addr + 8);
+        u8 const* row = cartridge_chr_row(&nes, addr, false);
+        u8 const* flipped = cartridge_chr_row(&nes, addr, true);
+        for (int i = 0; i < 8; i++) {
+            u8 pixel = ((high >> (7 - i) & 1) << 1) | (low >> (7 - i) & 1);
+            if (row[i] != pixel || flipped[7 - i] != pixel) {
+                LOG("TILE TEST FAILURE\nRow at %04X differs.\n", addr);
+                return false;
+            }
+        }
+    }
+    nes_free(&nes);
+    LOG("TILE TEST SUCCESS\n");
+    return true;
+}
+
+// Forks continue like their parent, keep their own memory and outlive it
+static bool test_fork(void) {
+    static nes_t nes, fork, copy;
+    static u8 state[0x10000];
+    if (!nes_init(&nes, "test/nestest.nes") || !nes_init(&copy, "test/nestest.nes")) {
+        LOG("FORK TEST FAILURE\nTest ROM not found.\n");
+        return false;
+    }
+    for (int i = 0; i < 30; i++) {
+        nes_run_frame(&nes);
+    }
+    size_t size = nes_state_save(&nes, state, sizeof(state));
+    nes_fork(&fork, &nes);
+    if (!nes_state_load(&copy, state, size)) {
+        LOG("FORK TEST FAILURE\nLoad failed.\n");
+        return false;
+    }
+
+    for (int i = 0; i < 30; i++) {
+        nes_run_frame(&nes);
+        nes_run_frame(&fork);
+        if (
+          nes.cpu.cycle != fork.cpu.cycle || nes.cpu.pc != fork.cpu.pc ||
+          memcmp(nes.memory.ram, fork.memory.ram, NES_RAM_SIZE) ||
+          memcmp(nes.ppu.GRAM, fork.ppu.GRAM, sizeof(nes.ppu.GRAM))) {
+            LOG("FORK TEST FAILURE\nConsoles differ %d frames after forking.\n", i + 1);
+            return false;
+        }
+    }
+
+    nes.memory.ram[0] ^= 0xFF;
+    if (nes.memory.ram[0] == fork.memory.ram[0]) {
+        LOG("FORK TEST FAILURE\nMemory is shared.\n");
+        return false;
+    }
+    nes_free(&nes);
+    for (int i = 0; i < 30; i++) {
+        nes_run_frame(&copy);
+    }
+    if (
+      fork.cpu.cycle != copy.cpu.cycle ||
+      memcmp(fork.memory.ram, copy.memory.ram, NES_RAM_SIZE)) {
+        LOG("FORK TEST FAILURE\nFork differs from a loaded state.\n");
+        return false;
+    }
+
+    nes_free(&fork);
+    nes_free(&copy);
+    LOG("FORK TEST SUCCESS\n");
+    return true;
+}
+
+// Run-ahead advances the machine one frame at a time and shows the frame it will reach later
+static bool test_runahead(void) {
+    static nes_t nes, plain, ahead;
+    nes_runahead_t ra;
+    if (
+      !nes_init(&nes, "test/nestest.nes") || !nes_init(&plain, "test/nestest.nes") ||
+      !nes_runahead_init(&ra, &nes, 2)) {
+        LOG("RUNAHEAD TEST FAILURE\nSetup failed.\n");
+        return false;
+    }
+    for (int i = 0; i < 60; i++) {
+        u8 buttons = i / 8 % 2 ? CONTROLLER_START : 0;
+        controller_set(&nes, 0, buttons);
+        controller_set(&plain, 0, buttons);
+        if (!nes_runahead_frame(&ra, &nes)) {
+            LOG("RUNAHEAD TEST FAILURE\nFrame %d failed.\n", i);
+            return false;
+        }
+        nes_run_frame(&plain);
+        nes_fork(&ahead, &plain);
+        nes_run_frame(&ahead);
+        nes_run_frame(&ahead);
+        bool same = nes.cpu.cycle == plain.cpu.cycle &&
+                    !memcmp(nes.memory.ram, plain.memory.ram, NES_RAM_SIZE) &&
+                    !memcmp(nes.ppu.GRAM, ahead.ppu.GRAM, sizeof(nes.ppu.GRAM));
+        nes_free(&ahead);
+        if (!same) {
+            LOG("RUNAHEAD TEST FAILURE\nFrame %d differs.\n", i);
+            return false;
+        }
+    }
+
+    nes_runahead_free(&ra);
+    nes_free(&nes);
+    nes_free(&plain);
+    LOG("RUNAHEAD TEST SUCCESS\n");
+    return true;
+}
+
+// Player 1 presses start now and then, player 2 changes direction often
+static u8 netplay_buttons(u8 player, u32 frame) {
+    if (player) return CONTROLLER_UP << frame / 3 % 4;
+    return frame / 20 % 2 ? CONTROLLER_START : 0;
+}
+
+// Both sides of a session with latency and jitter end up where a console running the real input of
+// both players is
+static bool test_netplay(void) {
+    enum { FRAMES = 120 };
+    static nes_t nes[2], real;
+    static nes_loopback_t lb;
+    nes_netplay_t np[2];
+    nes_loopback_init(&lb, 2, 3, 1);
+    for (u8 i = 0; i < 2; i++) {
+        if (
+          !nes_init(&nes[i], "test/nestest.nes") ||
+          !nes_netplay_init(&np[i], &nes[i], nes_loopback_transport(&lb, i), i)) {
+            LOG("NETPLAY TEST FAILURE\nSetup failed.\n");
+            return false;
+        }
+    }
+    if (!nes_init(&real, "test/nestest.nes")) {
+        LOG("NETPLAY TEST FAILURE\nSetup failed.\n");
+        return false;
+    }
+
+    // Runs both sides until every input has arrived, sides wait for each other at times
+    for (int tick = 0; tick < 10 * FRAMES; tick++) {
+        for (u8 i = 0; i < 2; i++) {
+            bool ok = np[i].frame < FRAMES
+                        ? nes_netplay_frame(&np[i], netplay_buttons(i, np[i].frame)) !=
+                            NES_NETPLAY_FAILED
+                        : nes_netplay_poll(&np[i]);
+            if (!ok) {
+                LOG("NETPLAY TEST FAILURE\nSide %d failed to roll back.\n", i);
+                return false;
+            }
+        }
+        nes_loopback_tick(&lb);
+        if (np[0].confirmed == FRAMES && np[1].confirmed == FRAMES) break;
+    }
+    for (u32 frame = 0; frame < FRAMES; frame++) {
+        controller_set(&real, 0, netplay_buttons(0, frame));
+        controller_set(&real, 1, netplay_buttons(1, frame));
+        nes_run_frame(&real);
+    }
+
+    for (u8 i = 0; i < 2; i++) {
+        if (np[i].confirmed != FRAMES || !np[i].rollbacks) {
+            LOG("NETPLAY TEST FAILURE\nSide %d confirmed %u frames.\n", i, np[i].confirmed);
+            return false;
+        }
+        if (
+          nes[i].cpu.cycle != real.cpu.cycle ||
+          memcmp(nes[i].memory.ram, real.memory.ram, NES_RAM_SIZE)) {
+            LOG("NETPLAY TEST FAILURE\nSide %d differs from the real input.\n", i);
+            return false;
+        }
+    }
+
+    // A rollback to a damaged state ends the session instead of going on out of sync
+    nes_loopback_init(&lb, 2, 3, 1);
+    for (u8 i = 0; i < 2; i++) {
+        nes_netplay_free(&np[i]);
+        if (!nes_netplay_init(&np[i], &nes[i], nes_loopback_transport(&lb, i), i)) {
+            LOG("NETPLAY TEST FAILURE\nSetup failed.\n");
+            return false;
+        }
+    }
+    nes_netplay_result_t result = NES_NETPLAY_RAN;
+    for (int tick = 0; tick < 10 * FRAMES && result != NES_NETPLAY_FAILED; tick++) {
+        result = nes_netplay_frame(&np[0], netplay_buttons(0, np[0].frame));
+        nes_netplay_frame(&np[1], netplay_buttons(1, np[1].frame));
+        memset(np[0].states, 0, NES_NETPLAY_WINDOW * np[0].state_size);
+        nes_loopback_tick(&lb);
+    }
+    if (result != NES_NETPLAY_FAILED || nes_netplay_poll(&np[0])) {
+        LOG("NETPLAY TEST FAILURE\nDamaged state loaded.\n");
+        return false;
+    }
+
+    for (u8 i = 0; i < 2; i++) {
+        nes_netplay_free(&np[i]);
+        nes_free(&nes[i]);
+    }
+    nes_free(&real);
+    LOG("NETPLAY TEST SUCCESS\n");
+    return true;
+}
+
 int main(void) {
-    return test_cpu() ? 0 : 1;
+    bool ok = test_cpu() && test_frames() && test_idle() && test_skip() && test_tiles() &&
+              test_savestate() && test_rewind() && test_fork() && test_runahead() && test_netplay();
+    return ok ? 0 : 1;
 }
\ No newline at end of file
@@ -0,0 +1,267 @@
+#include "vec.h"
+
+#include "controller.h"
+#ifdef NES_CPU_LANES
+#include "lanes.h"
+#endif
+#include "nes.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+/* Vector environment
+ * A pool of worker threads is started once and woken for every step. Workers, the caller
+ * included, take consoles one at a time from a shared counter until all of them have run their
+ * frame, so a step costs two wake-ups and no allocation. A console whose episode ended is put
+ * back to the snapshot at the start of the next step, leaving the observation of its last frame in
+ * the buffers for the caller. With lanes set, workers take groups of consoles and run them
+ * through the lane-parallel core instead.
+ */
+
+struct nes_vec_pool {
+    mtx_t lock;
+    cnd_t wake;         // A step started or the pool is stopping
+    cnd_t idle;         // The last worker finished its part of the step
+    unsigned threads;   // Started threads, not counting the caller
+    unsigned busy;      // Threads still running the current step
+    u64 step;           // Steps started
+    bool stop;          // Threads exit instead of waiting for the next step
+    atomic_size_t next; // Next console to run
+#ifdef NES_CPU_LANES
+    atomic_uint_fast64_t vector; // Instructions run by the lane-parallel core
+    atomic_uint_fast64_t scalar; // Instructions run by the scalar core in lane groups
+#endif
+    nes_vec_t* vec;
+    thrd_t thread[];
+};
+
+// Consoles of the environment never share memory with a fork, copies between them cannot fail
+static void restore(nes_vec_t* vec, size_t index) {
+    nes_copy(&vec->consoles[index], vec->snapshot);
+    vec->reset[index] = 0;
+    vec->done[index] = 0;
+    vec->episode_frame[index] = 0;
+}
+
+static void begin_step(nes_vec_t* vec, size_t index) {
+    if (vec->done[index] || vec->reset[index]) restore(vec, index);
+    controller_set(&vec->consoles[index], 0, vec->input[index]);
+}
+
+static void end_step(nes_vec_t* vec, size_t index) {
+    nes_t const* nes = &vec->consoles[index];
+    vec->episode_frame[index]++;
+    vec->done[index] = vec->max_frames && vec->episode_frame[index] >= vec->max_frames;
+
+    memcpy(vec->ram + index * NES_RAM_SIZE, nes->memory.ram, NES_RAM_SIZE);
+    memcpy(vec->frame + index * NES_VEC_FRAME_SIZE, nes->ppu.GRAM, NES_VEC_FRAME_SIZE);
+}
+
+#ifdef NES_CPU_LANES
+// Runs the consoles in groups of NES_LANES through the lane-parallel core
+static void run_lanes(struct nes_vec_pool* pool) {
+    nes_vec_t* vec = pool->vec;
+    nes_lanes_stats_t stats = { 0, 0 };
+    for (size_t first = atomic_fetch_add(&pool->next, NES_LANES); first < vec->count;
+         first = atomic_fetch_add(&pool->next, NES_LANES)) {
+        nes_t* group[NES_LANES];
+        size_t count = vec->count - first < NES_LANES ? vec->count - first : NES_LANES;
+        for (size_t i = 0; i < count; i++) {
+            begin_step(vec, first + i);
+            group[i] = &vec->consoles[first + i];
+        }
+        nes_lanes_run_frame(group, count, &stats);
+        for (size_t i = 0; i < count; i++) {
+            end_step(vec, first + i);
+        }
+    }
+    atomic_fetch_add(&pool->vector, stats.vector);
+    atomic_fetch_add(&pool->scalar, stats.scalar);
+}
+#endif
+
+static void run_step(struct nes_vec_pool* pool) {
+    nes_vec_t* vec = pool->vec;
+#ifdef NES_CPU_LANES
+    if (vec->lanes) {
+        run_lanes(pool);
+        return;
+    }
+#endif
+    for (size_t i = atomic_fetch_add(&pool->next, 1); i < vec->count;
+         i = atomic_fetch_add(&pool->next, 1)) {
+        begin_step(vec, i);
+        nes_run_frame(&vec->consoles[i]);
+        end_step(vec, i);
+    }
+}
+
+static int worker_main(void* arg) {
+    struct nes_vec_pool* pool = arg;
+    u64 step = 0;
+
+    mtx_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->step == step) {
+            cnd_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->stop) break;
+        step = pool->step;
+        mtx_unlock(&pool->lock);
+
+        run_step(pool);
+
+        mtx_lock(&pool->lock);
+        if (--pool->busy == 0) cnd_signal(&pool->idle);
+    }
+    mtx_unlock(&pool->lock);
+    return 0;
+}
+
+static void pool_stop(struct nes_vec_pool* pool) {
+    mtx_lock(&pool->lock);
+    pool->stop = true;
+    cnd_broadcast(&pool->wake);
+    mtx_unlock(&pool->lock);
+    for (unsigned i = 0; i < pool->threads; i++) {
+        thrd_join(pool->thread[i], NULL);
+    }
+    cnd_destroy(&pool->idle);
+    cnd_destroy(&pool->wake);
+    mtx_destroy(&pool->lock);
+    free(pool);
+}
+
+// Starts workers - 1 threads, the thread calling nes_vec_step is the last worker
+static struct nes_vec_pool* pool_start(nes_vec_t* vec, unsigned workers) {
+    unsigned threads = workers > 1 ? workers - 1 : 0;
+    struct nes_vec_pool* pool = calloc(1, sizeof(struct nes_vec_pool) + threads * sizeof(thrd_t));
+    if (!pool) return NULL;
+    pool->vec = vec;
+    atomic_init(&pool->next, 0);
+#ifdef NES_CPU_LANES
+    atomic_init(&pool->vector, 0);
+    atomic_init(&pool->scalar, 0);
+#endif
+
+    if (mtx_init(&pool->lock, mtx_plain) != thrd_success) {
+        free(pool);
+        return NULL;
+    }
+    if (cnd_init(&pool->wake) != thrd_success) {
+        mtx_destroy(&pool->lock);
+        free(pool);
+        return NULL;
+    }
+    if (cnd_init(&pool->idle) != thrd_success) {
+        cnd_destroy(&pool->wake);
+        mtx_destroy(&pool->lock);
+        free(pool);
+        return NULL;
+    }
+    // Fewer threads only make steps slower
+    while (pool->threads < threads) {
+        if (thrd_create(&pool->thread[pool->threads], worker_main, pool) != thrd_success) break;
+        pool->threads++;
+    }
+    return pool;
+}
+
+// Powers on count consoles, runs the first one for warmup frames and starts every console from
+// its state. Returns false if the ROM could not be loaded or memory is missing.
+bool nes_vec_init(nes_vec_t* vec, char const* rom, size_t count, unsigned workers, u32 warmup) {
+    memset(vec, 0, sizeof(nes_vec_t));
+    vec->consoles = malloc(count * sizeof(nes_t));
+    vec->snapshot = malloc(sizeof(nes_t));
+    vec->input = calloc(count, 1);
+    vec->reset = calloc(count, 1);
+    vec->done = calloc(count, 1);
+    vec->episode_frame = calloc(count, sizeof(u32));
+    vec->ram = calloc(count, NES_RAM_SIZE);
+    vec->frame = calloc(count, NES_VEC_FRAME_SIZE);
+    bool ok = vec->consoles && vec->snapshot && vec->input && vec->reset && vec->done &&
+              vec->episode_frame && vec->ram && vec->frame;
+
+    if (ok && !nes_init(vec->snapshot, rom)) {
+        free(vec->snapshot);
+        vec->snapshot = NULL;
+        ok = false;
+    }
+    while (ok && vec->count < count) {
+        ok = nes_init(&vec->consoles[vec->count], rom);
+        if (ok) vec->count++;
+    }
+    if (ok) vec->pool = pool_start(vec, workers);
+    if (!ok || !vec->pool) {
+        nes_vec_free(vec);
+        return false;
+    }
+
+    for (u32 i = 0; i < warmup; i++) {
+        nes_run_frame(vec->snapshot);
+    }
+    nes_vec_reset(vec);
+    return true;
+}
+
+void nes_vec_free(nes_vec_t* vec) {
+    if (vec->pool) pool_stop(vec->pool);
+    for (size_t i = 0; i < vec->count; i++) {
+        nes_free(&vec->consoles[i]);
+    }
+    if (vec->snapshot) nes_free(vec->snapshot);
+    free(vec->consoles);
+    free(vec->snapshot);
+    free(vec->input);
+    free(vec->reset);
+    free(vec->done);
+    free(vec->episode_frame);
+    free(vec->ram);
+    free(vec->frame);
+    memset(vec, 0, sizeof(nes_vec_t));
+}
+
+// Makes the current state of a console the state episodes start from
+void nes_vec_snapshot(nes_vec_t* vec, size_t index) {
+    nes_copy(vec->snapshot, &vec->consoles[index]);
+}
+
+// Puts every console back to the snapshot and fills the buffers with its observation
+void nes_vec_reset(nes_vec_t* vec) {
+    for (size_t i = 0; i < vec->count; i++) {
+        restore(vec, i);
+        memcpy(vec->ram + i * NES_RAM_SIZE, vec->snapshot->memory.ram, NES_RAM_SIZE);
+        memcpy(vec->frame + i * NES_VEC_FRAME_SIZE, vec->snapshot->ppu.GRAM, NES_VEC_FRAME_SIZE);
+    }
+}
+
+// Runs one frame on every console with its input, then fills the buffers. Consoles that were done
+// or asked to reset start over from the snapshot first.
+void nes_vec_step(nes_vec_t* vec) {
+    struct nes_vec_pool* pool = vec->pool;
+
+    mtx_lock(&pool->lock);
+    atomic_store(&pool->next, 0);
+    pool->busy = pool->threads;
+    pool->step++;
+    cnd_broadcast(&pool->wake);
+    mtx_unlock(&pool->lock);
+
+    run_step(pool);
+
+    mtx_lock(&pool->lock);
+    while (pool->busy) {
+        cnd_wait(&pool->idle, &pool->lock);
+    }
+    mtx_unlock(&pool->lock);
+}
+
+#ifdef NES_CPU_LANES
+// Instructions run by each core in lane groups since the environment was created
+void nes_vec_lanes_stats(nes_vec_t const* vec, nes_lanes_stats_t* stats) {
+    stats->vector = atomic_load(&vec->pool->vector);
+    stats->scalar = atomic_load(&vec->pool->scalar);
+}
+#endif
@@ -0,0 +1,152 @@
+#include "vec.h"
+
+#include "clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+/* Vector environment benchmark
+ * Steps every console with pseudo-random input and reports the step rate. The hash covers the
+ * observations of every step, so runs with different worker counts can be compared.
+ *
+ * Usage: nes_vec [rom] [-n consoles] [-j workers] [-f steps] [-e episode frames] [-w warm-up] [-l]
+ *
+ * -l runs the consoles through the lane-parallel core.
+ */
+
+#define DEFAULT_ROM "test/nestest.nes"
+#define DEFAULT_CONSOLES 16
+#define DEFAULT_STEPS 300
+#define DEFAULT_EPISODE 100
+#define DEFAULT_WARMUP 30
+
+static unsigned default_workers(void) {
+#if defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > 0) return (unsigned)n;
+#endif
+    return 1;
+}
+
+static u64 hash(u64 h, u8 const* data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ data[i]) * 0x100000001B3;
+    }
+    return h;
+}
+
+int main(int argc, char** argv) {
+    char const* rom = DEFAULT_ROM;
+    size_t consoles = DEFAULT_CONSOLES;
+    unsigned workers = default_workers();
+    u64 steps = DEFAULT_STEPS;
+    u32 episode = DEFAULT_EPISODE;
+    u32 warmup = DEFAULT_WARMUP;
+    bool lanes = false;
+
+    for (int i = 1; i < argc; i++) {
+        char const* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (argv[i][0] != '-') {
+            rom = argv[i];
+            continue;
+        }
+        if (!strcmp(argv[i], "-l")) {
+            lanes = true;
+            continue;
+        }
+        if (!value || strlen(argv[i]) != 2) {
+            fprintf(
+              stderr,
+              "Usage: %s [rom] [-n consoles] [-j workers] [-f steps] [-e episode] [-w warm-up] "
+              "[-l]\n",
+              argv[0]);
+            return 1;
+        }
+        switch (argv[i++][1]) {
+            case 'n':
+                consoles = strtoull(value, NULL, 0);
+                break;
+            case 'j':
+                workers = strtoul(value, NULL, 0);
+                break;
+            case 'f':
+                steps = strtoull(value, NULL, 0);
+                break;
+            case 'e':
+                episode = strtoul(value, NULL, 0);
+                break;
+            case 'w':
+                warmup = strtoul(value, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Unknown option %s\n", argv[i - 1]);
+                return 1;
+        }
+    }
+    if (!consoles || !steps) {
+        fprintf(stderr, "Nothing to run\n");
+        return 1;
+    }
+
+    nes_vec_t vec;
+    if (!nes_vec_init(&vec, rom, consoles, workers, warmup)) {
+        fprintf(stderr, "Failed to load %s\n", rom);
+        return 1;
+    }
+    vec.max_frames = episode;
+    vec.lanes = lanes;
+#ifndef NES_CPU_LANES
+    if (lanes) fprintf(stderr, "Built without the lane-parallel core, ignoring -l\n");
+#endif
+
+    u64 h = 0xCBF29CE484222325;
+    u64 episodes = 0;
+    u32 seed = 1;
+    double busy = 0;
+    for (u64 step = 0; step < steps; step++) {
+        for (size_t i = 0; i < consoles; i++) {
+            seed = seed * 1103515245 + 12345;
+            vec.input[i] = seed >> 24;
+        }
+        double start = clock_now();
+        nes_vec_step(&vec);
+        busy += clock_now() - start;
+        for (size_t i = 0; i < consoles; i++) {
+            episodes += vec.done[i];
+        }
+        h = hash(h, vec.ram, consoles * NES_RAM_SIZE);
+        h = hash(h, vec.frame, consoles * NES_VEC_FRAME_SIZE);
+    }
+
+    printf(
+      "%s: %zu consoles x %llu steps on %u workers, %llu episodes ended\n",
+      rom,
+      consoles,
+      (unsigned long long)steps,
+      workers,
+      (unsigned long long)episodes);
+    printf(
+      "%.3f s, %.1f steps/s, %.1f frames/s, hash %016llx\n",
+      busy,
+      steps / busy,
+      steps * consoles / busy,
+      (unsigned long long)h);
+#ifdef NES_CPU_LANES
+    if (lanes) {
+        nes_lanes_stats_t stats;
+        nes_vec_lanes_stats(&vec, &stats);
+        printf(
+          "%.1f%% of %llu instructions run by the lane-parallel core\n",
+          100.0 * stats.vector / (stats.vector + stats.scalar),
+          (unsigned long long)(stats.vector + stats.scalar));
+    }
+#endif
+
+    nes_vec_free(&vec);
+    return 0;
+}
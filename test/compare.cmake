@@ -0,0 +1,33 @@
+# Runs two commands and fails unless they print the same results
+# FIRST and SECOND are the commands, PATTERN matches the output lines holding results and RESULT
+# replaces a matched line with the part that must not differ, dropping timings and the like.
+#
+# Usage: cmake -DFIRST=cmd;args -DSECOND=cmd;args -DPATTERN=regex -DRESULT=replacement
+#   -P compare.cmake
+
+function(results command out)
+  execute_process(COMMAND ${command} OUTPUT_VARIABLE output RESULT_VARIABLE status)
+  if(NOT status EQUAL 0)
+    message(FATAL_ERROR "${command} failed: ${status}")
+  endif()
+  string(REPLACE "\n" ";" lines "${output}")
+  set(kept "")
+  foreach(line IN LISTS lines)
+    if(line MATCHES "${PATTERN}")
+      string(REGEX REPLACE "${PATTERN}" "${RESULT}" line "${line}")
+      list(APPEND kept "${line}")
+    endif()
+  endforeach()
+  if(NOT kept)
+    message(FATAL_ERROR "${command} printed no results:\n${output}")
+  endif()
+  set(${out} "${kept}" PARENT_SCOPE)
+endfunction()
+
+results("${FIRST}" first)
+results("${SECOND}" second)
+if(NOT first STREQUAL second)
+  string(REPLACE ";" "\n" first "${first}")
+  string(REPLACE ";" "\n" second "${second}")
+  message(FATAL_ERROR "Results differ\n${FIRST}:\n${first}\n${SECOND}:\n${second}")
+endif()